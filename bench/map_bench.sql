@@ -0,0 +1,48 @@
+--
+-- PgFincore
+-- map_bench.sql
+--
+-- Compare the size and the decoding time of the varbit from pgfincore() and
+-- of pgfincore_map, for a segment of 1GB with 4KB pages (262144 pages) in a
+-- few cache states.
+--
+-- Run with:
+--     psql -f bench/map_bench.sql
+--
+\timing off
+set client_min_messages to warning;
+
+create temp table map_bench as
+select pattern, databit::varbit, databit::varbit::pgfincore_map as map
+from (
+	select 'all cached' as pattern,
+		   repeat('1', 262144) as databit
+	union all
+	select 'none cached',
+		   repeat('0', 262144)
+	union all
+	select 'runs of 1000 pages',
+		   string_agg(case when (i / 1000) % 2 = 0 then '1' else '0' end, '' order by i)
+	from generate_series(0, 262143) i
+	union all
+	select 'runs of 16 pages',
+		   string_agg(case when (i / 16) % 2 = 0 then '1' else '0' end, '' order by i)
+	from generate_series(0, 262143) i
+	union all
+	select 'random',
+		   string_agg(case when random() < 0.5 then '1' else '0' end, '' order by i)
+	from generate_series(0, 262143) i
+) s;
+
+-- the stored sizes, after TOAST compression
+select pattern,
+	   pg_size_pretty(pg_column_size(databit)::bigint) as varbit,
+	   pg_size_pretty(pg_column_size(map)::bigint) as pgfincore_map
+from map_bench;
+
+-- decoding time, 100 times each value
+\timing on
+select count(pgfincore_drawer(databit)) from map_bench, generate_series(1, 100);
+select count(pgfincore_drawer(map)) from map_bench, generate_series(1, 100);
+select count(map::varbit) from map_bench, generate_series(1, 100);
+\timing off
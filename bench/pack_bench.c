@@ -0,0 +1,207 @@
+/*
+*  PgFincore
+*  pack_bench.c
+*
+*  Micro benchmark of the packing of the mincore(2) vector into the varbit.
+*  It compares the per page loop used up to pgfincore 1.3.1 with the kernels
+*  of pgfincore_pack.h, and checks they all give the same result.
+*
+*  Build and run with:
+*      make bench
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pgfincore_pack.h"
+
+#define NPAGES		(64 * 1024 * 1024 / 4096)	/* one window of 64MB */
+#define LOOPS		200
+
+/*
+ * stands for elog(DEBUG5, ...) when DEBUG5 is not enabled: errstart() is
+ * called and returns false.
+ */
+__attribute__((noinline)) static int
+fake_errstart(int elevel)
+{
+	return elevel >= 20;
+}
+
+/*
+ * the loop of pgfincore_file() in 1.3.1
+ */
+static void
+pack_old(const unsigned char *vec, size_t npages,
+		 uint8_t *out, pgfincore_pack_state *st)
+{
+	int			flag = st->prev ? 0 : 1;
+	uint8_t	   *r = out;
+	uint8_t		x = 0x80;
+	size_t		pageIndex;
+
+	for (pageIndex = 0; pageIndex < npages; pageIndex++)
+	{
+		if (vec[pageIndex] & 0x1)
+		{
+			st->pages_mem++;
+			*r |= x;
+			if (fake_errstart(10))
+				printf("in memory blocks : %zu / %zu\n", pageIndex, npages);
+			if (flag)
+				st->group_mem++;
+			flag = 0;
+		}
+		else
+			flag = 1;
+
+		x >>= 1;
+		if (x == 0)
+		{
+			x = 0x80;
+			r++;
+		}
+	}
+	st->prev = flag ? 0 : 1;
+}
+
+typedef struct
+{
+	const char *name;
+	pgfincore_pack_fn fn;
+} kernel;
+
+static const kernel kernels[] = {
+	{"1.3.1 loop", pack_old},
+	{"scalar", pgfincore_pack_scalar},
+#if defined(PGFINCORE_PACK_X86)
+	{"sse2", pgfincore_pack_sse2},
+	{"avx2", pgfincore_pack_avx2},
+#endif
+#if defined(PGFINCORE_PACK_NEON)
+	{"neon", pgfincore_pack_neon},
+#endif
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * fill the vector, mincore only defines bit 0 so set garbage in the others
+ */
+static void
+fill(unsigned char *vec, size_t npages, int pattern)
+{
+	size_t		i;
+
+	for (i = 0; i < npages; i++)
+	{
+		int			in;
+
+		switch (pattern)
+		{
+			case 0:				/* all pages in cache */
+				in = 1;
+				break;
+			case 1:				/* no page in cache */
+				in = 0;
+				break;
+			case 2:				/* random */
+				in = rand() & 1;
+				break;
+			default:			/* runs of 1000 pages */
+				in = (i / 1000) & 1;
+				break;
+		}
+		vec[i] = (unsigned char) ((rand() & 0xfe) | in);
+	}
+}
+
+int
+main(void)
+{
+	static const char *patterns[] = {"all cached", "none cached", "random", "runs"};
+	unsigned char *vec = malloc(NPAGES + 64);
+	uint8_t	   *ref = malloc(NPAGES / 8 + 8);
+	uint8_t	   *out = malloc(NPAGES / 8 + 8);
+	size_t		k;
+	int			p;
+
+	if (vec == NULL || ref == NULL || out == NULL)
+		return 1;
+
+	printf("selected kernel: ");
+	for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+		if (kernels[k].fn == pgfincore_pack_select())
+			printf("%s\n", kernels[k].name);
+
+	for (p = 0; p < 4; p++)
+	{
+		pgfincore_pack_state refst;
+		size_t		npages;
+
+		fill(vec, NPAGES, p);
+
+		/* check every kernel on a few sizes, windows of 64 pages and tails */
+		for (npages = NPAGES - 67; npages <= NPAGES; npages += 67)
+		{
+			memset(&refst, 0, sizeof(refst));
+			memset(ref, 0, NPAGES / 8 + 8);
+			pack_old(vec, npages, ref, &refst);
+
+			for (k = 1; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+			{
+				pgfincore_pack_state st;
+
+				memset(&st, 0, sizeof(st));
+				memset(out, 0, NPAGES / 8 + 8);
+				/* in two calls, as pgfincore_file does by windows */
+				kernels[k].fn(vec, 4096, out, &st);
+				kernels[k].fn(vec + 4096, npages - 4096, out + 4096 / 8, &st);
+				if (st.pages_mem != refst.pages_mem ||
+					st.group_mem != refst.group_mem ||
+					memcmp(out, ref, (npages + 7) / 8) != 0)
+				{
+					fprintf(stderr, "%s: mismatch on %s, %zu pages\n",
+							kernels[k].name, patterns[p], npages);
+					return 1;
+				}
+			}
+		}
+
+		printf("\n%s, %d pages, %llu in cache, %llu groups\n",
+			   patterns[p], NPAGES,
+			   (unsigned long long) refst.pages_mem,
+			   (unsigned long long) refst.group_mem);
+		for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+		{
+			pgfincore_pack_state st;
+			double		start;
+			double		elapsed;
+			int			l;
+
+			start = now();
+			for (l = 0; l < LOOPS; l++)
+			{
+				memset(&st, 0, sizeof(st));
+				memset(out, 0, NPAGES / 8);
+				kernels[k].fn(vec, NPAGES, out, &st);
+			}
+			elapsed = now() - start;
+			printf("  %-12s %10.1f Mpages/s\n", kernels[k].name,
+				   (double) NPAGES * LOOPS / elapsed / 1e6);
+		}
+	}
+
+	free(vec);
+	free(ref);
+	free(out);
+	return 0;
+}
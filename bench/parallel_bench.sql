@@ -0,0 +1,38 @@
+--
+-- PgFincore
+-- parallel_bench.sql
+--
+-- Time pgfincore_database() against pgfincore_database_parallel() with 0 to
+-- 8 workers, on a database with many relations: 5000 tables of 10 blocks,
+-- each with an index, about 20000 segment files with their fsm and vm forks.
+-- The workers come from max_worker_processes.
+--
+-- Run with:
+--     psql -f bench/parallel_bench.sql
+--
+\timing off
+set client_min_messages to warning;
+
+create schema pgfincore_bench;
+
+select format('create table pgfincore_bench.t%s as select i from generate_series(1, 2000) i', n)
+from generate_series(1, 5000) n
+\gexec
+select format('create index on pgfincore_bench.t%s (i)', n)
+from generate_series(1, 5000) n
+\gexec
+vacuum;
+
+-- the number of forks scanned, once to have the catalog in cache
+select count(*), sum(rel_os_pages) from pgfincore_database();
+
+\timing on
+select count(*) from pgfincore_database();
+select count(*) from pgfincore_database_parallel(0);
+select count(*) from pgfincore_database_parallel(1);
+select count(*) from pgfincore_database_parallel(2);
+select count(*) from pgfincore_database_parallel(4);
+select count(*) from pgfincore_database_parallel(8);
+\timing off
+
+drop schema pgfincore_bench cascade;
@@ -0,0 +1,47 @@
+--
+-- PgFincore
+-- scan_prefetch_bench.sql
+--
+-- Time a cold sequential scan of a 2GB table, with the readahead of the
+-- kernel only then with pgfincore.scan_prefetch_window of 16MB to 256MB.
+-- The table is removed from the page cache with pgfadvise_dontneed() before
+-- each scan; it must not fit in shared_buffers. pgfincore must be loaded in
+-- the backend: shared_preload_libraries or session_preload_libraries.
+--
+-- Run with:
+--     psql -f bench/scan_prefetch_bench.sql
+--
+\timing off
+set client_min_messages to warning;
+set max_parallel_workers_per_gather to 0;
+
+create table pgfincore_scan_bench as
+select i, repeat('x', 200) as filler from generate_series(1, 8000000) i;
+select pg_size_pretty(pg_relation_size('pgfincore_scan_bench'));
+
+set pgfincore.scan_prefetch_min_size to '1GB';
+
+select count(*) from pgfadvise_dontneed('pgfincore_scan_bench');
+\timing on
+select count(*) from pgfincore_scan_bench;
+\timing off
+
+set pgfincore.scan_prefetch_window to '16MB';
+select count(*) from pgfadvise_dontneed('pgfincore_scan_bench');
+\timing on
+select count(*) from pgfincore_scan_bench;
+\timing off
+
+set pgfincore.scan_prefetch_window to '64MB';
+select count(*) from pgfadvise_dontneed('pgfincore_scan_bench');
+\timing on
+select count(*) from pgfincore_scan_bench;
+\timing off
+
+set pgfincore.scan_prefetch_window to '256MB';
+select count(*) from pgfadvise_dontneed('pgfincore_scan_bench');
+\timing on
+select count(*) from pgfincore_scan_bench;
+\timing off
+
+drop table pgfincore_scan_bench;
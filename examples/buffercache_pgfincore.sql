@@ -5,37 +5,28 @@ with my_table as (
   from pg_class
   where relname = 'pgbench_accounts'
 )
-, t as (
-  select generate_series(1, relpages) as g
-  from my_table
-  join pg_class using (relname)
-)
 , buf as (
-  select relblocknumber * 2 as bn -- Pgfincore use filesystem block size
+  select relblocknumber as bn
        , usagecount as c
        , isdirty as d
   from my_table
   join pg_buffercache using (relfilenode)
   where relforknumber = 0
+    and reldatabase = (select oid from pg_database
+                       where datname = current_database())
 )
 , pgf as (
-  select (row_number() over (partition by c)) - 1 as bn -- pascal vs C
-  	   , c
-	   , NULL as d
-  from (select unnest(
-                      string_to_array(
-			               (pgfincore(my_table.oid, true)).databit::text, NULL
-			          )
-               ) as c 
-        from my_table ) g
+  select relblocknumber as bn -- one row per PostgreSQL block
+       , state as c -- full, partial or absent
+  from my_table
+     , pgfincore_blocks(my_table.oid)
 )
 , fb as (
    select pgf.bn as file_block_number
        	, buf.c as pgcache
       	, buf.d as pgdirty
         , pgf.c as oscache
-        , pgf.d as osdirty
-  from buf 
+  from buf
   right join pgf using (bn)
   order by 1, 2, 3
 ),
@@ -0,0 +1,1051 @@
+--
+-- PGFADVISE_LOADER
+--
+-- new output column: syscalls
+--
+DROP FUNCTION pgfadvise_loader(regclass, int, bool, bool, varbit);
+DROP FUNCTION pgfadvise_loader(regclass, text, int, bool, bool, varbit);
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_loader(IN regclass, IN text, IN int, IN bool, IN bool, IN varbit,
+				 OUT relpath text,
+				 OUT os_page_size bigint,
+				 OUT os_pages_free bigint,
+				 OUT pages_loaded bigint,
+				 OUT pages_unloaded bigint,
+				 OUT syscalls bigint,
+				 OUT pages_skipped bigint)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfadvise_loader(regclass, text, int, bool, bool, varbit)
+IS 'Restore cache from the snapshot, options to load/unload each block to/from cache';
+
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_loader(IN regclass, IN int, IN bool, IN bool, IN varbit,
+				 OUT relpath text,
+				 OUT os_page_size bigint,
+				 OUT os_pages_free bigint,
+				 OUT pages_loaded bigint,
+				 OUT pages_unloaded bigint,
+				 OUT syscalls bigint,
+				 OUT pages_skipped bigint)
+RETURNS setof record
+AS 'SELECT pgfadvise_loader($1, ''main'', $2, $3, $4, $5)'
+LANGUAGE SQL;
+
+--
+-- PGFINCORE
+--
+-- new output columns from cachestat: pages_writeback, pages_evicted,
+-- pages_recently_evicted
+--
+DROP FUNCTION pgfincore(regclass);
+DROP FUNCTION pgfincore(regclass, bool);
+DROP FUNCTION pgfincore(regclass, text, bool);
+
+CREATE OR REPLACE FUNCTION
+pgfincore(IN regclass, IN text, IN bool,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint,
+		  OUT group_mem bigint,
+		  OUT os_pages_free bigint,
+		  OUT databit      varbit,
+		  OUT pages_dirty bigint,
+		  OUT group_dirty bigint,
+		  OUT pages_writeback bigint,
+		  OUT pages_evicted bigint,
+		  OUT pages_recently_evicted bigint,
+		  OUT pinned bool)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore(regclass, text, bool)
+IS 'Utility to inspect and get a snapshot of the system cache';
+
+CREATE OR REPLACE FUNCTION
+pgfincore(IN regclass, IN bool,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint,
+		  OUT group_mem bigint,
+		  OUT os_pages_free bigint,
+		  OUT databit      varbit,
+		  OUT pages_dirty bigint,
+		  OUT group_dirty bigint,
+		  OUT pages_writeback bigint,
+		  OUT pages_evicted bigint,
+		  OUT pages_recently_evicted bigint,
+		  OUT pinned bool)
+RETURNS setof record
+AS 'SELECT * from pgfincore($1, ''main'', $2)'
+LANGUAGE SQL;
+
+CREATE OR REPLACE FUNCTION
+pgfincore(IN regclass,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint,
+		  OUT group_mem bigint,
+		  OUT os_pages_free bigint,
+		  OUT databit      varbit,
+		  OUT pages_dirty bigint,
+		  OUT group_dirty bigint,
+		  OUT pages_writeback bigint,
+		  OUT pages_evicted bigint,
+		  OUT pages_recently_evicted bigint,
+		  OUT pinned bool)
+RETURNS setof record
+AS 'SELECT * from pgfincore($1, ''main'', false)'
+LANGUAGE SQL;
+
+--
+-- new functions: pgfincore_snapshot_database, pgfincore_restore_database
+--
+CREATE OR REPLACE FUNCTION
+pgfincore_snapshot_database(IN text,
+		  OUT relations bigint,
+		  OUT segments bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint)
+RETURNS record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_snapshot_database(text)
+IS 'Write the system cache state of all relations of the current database into a file';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_restore_database(IN text, IN bool, IN bool,
+		  OUT relations bigint,
+		  OUT segments bigint,
+		  OUT segments_skipped bigint,
+		  OUT pages_loaded bigint,
+		  OUT pages_unloaded bigint,
+		  OUT syscalls bigint)
+RETURNS record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_restore_database(text, bool, bool)
+IS 'Restore the system cache state from a file written by pgfincore_snapshot_database, options to load/unload';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_restore_database(IN text,
+		  OUT relations bigint,
+		  OUT segments bigint,
+		  OUT segments_skipped bigint,
+		  OUT pages_loaded bigint,
+		  OUT pages_unloaded bigint,
+		  OUT syscalls bigint)
+RETURNS record
+AS 'SELECT * from pgfincore_restore_database($1, true, false)'
+LANGUAGE SQL;
+
+-- the files are read and written by the server
+REVOKE EXECUTE ON FUNCTION pgfincore_snapshot_database(text) FROM PUBLIC;
+REVOKE EXECUTE ON FUNCTION pgfincore_restore_database(text, bool, bool) FROM PUBLIC;
+REVOKE EXECUTE ON FUNCTION pgfincore_restore_database(text) FROM PUBLIC;
+
+--
+-- new type: pgfincore_map
+--
+CREATE TYPE pgfincore_map;
+
+CREATE OR REPLACE FUNCTION
+pgfincore_map_in(cstring)
+RETURNS pgfincore_map
+AS '$libdir/pgfincore'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION
+pgfincore_map_out(pgfincore_map)
+RETURNS cstring
+AS '$libdir/pgfincore'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE TYPE pgfincore_map (
+	INPUT = pgfincore_map_in,
+	OUTPUT = pgfincore_map_out,
+	INTERNALLENGTH = VARIABLE,
+	STORAGE = extended
+);
+
+COMMENT ON TYPE pgfincore_map
+IS 'Run-length encoded map of the pages of a segment, text is the lengths of the runs starting with pages not in cache';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_map_from_varbit(varbit)
+RETURNS pgfincore_map
+AS '$libdir/pgfincore'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION
+pgfincore_map_to_varbit(pgfincore_map)
+RETURNS varbit
+AS '$libdir/pgfincore'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE CAST (varbit AS pgfincore_map)
+WITH FUNCTION pgfincore_map_from_varbit(varbit);
+
+CREATE CAST (pgfincore_map AS varbit)
+WITH FUNCTION pgfincore_map_to_varbit(pgfincore_map);
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_loader(IN regclass, IN text, IN int, IN bool, IN bool, IN pgfincore_map,
+				 OUT relpath text,
+				 OUT os_page_size bigint,
+				 OUT os_pages_free bigint,
+				 OUT pages_loaded bigint,
+				 OUT pages_unloaded bigint,
+				 OUT syscalls bigint,
+				 OUT pages_skipped bigint)
+RETURNS setof record
+AS '$libdir/pgfincore', 'pgfadvise_loader_map'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfadvise_loader(regclass, text, int, bool, bool, pgfincore_map)
+IS 'Restore cache from the snapshot, options to load/unload each block to/from cache';
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_loader(IN regclass, IN int, IN bool, IN bool, IN pgfincore_map,
+				 OUT relpath text,
+				 OUT os_page_size bigint,
+				 OUT os_pages_free bigint,
+				 OUT pages_loaded bigint,
+				 OUT pages_unloaded bigint,
+				 OUT syscalls bigint,
+				 OUT pages_skipped bigint)
+RETURNS setof record
+AS 'SELECT pgfadvise_loader($1, ''main'', $2, $3, $4, $5)'
+LANGUAGE SQL;
+
+CREATE OR REPLACE FUNCTION
+pgfincore_drawer(IN pgfincore_map,
+		  OUT drawer cstring)
+RETURNS cstring
+AS '$libdir/pgfincore', 'pgfincore_drawer_map'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_drawer(pgfincore_map)
+IS 'A naive drawing function to visualize page cache per object';
+
+--
+-- new function: pgfadvise_prefetch
+--
+CREATE OR REPLACE FUNCTION
+pgfadvise_prefetch(IN regclass, IN text,
+				   OUT relpath text,
+				   OUT engine text,
+				   OUT os_page_size bigint,
+				   OUT rel_os_pages bigint,
+				   OUT pages_completed bigint,
+				   OUT elapsed_ms float8)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfadvise_prefetch(regclass, text)
+IS 'Load a relation with pgfincore.prefetch_engine, reporting completion when the engine knows it';
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_prefetch(IN regclass,
+				   OUT relpath text,
+				   OUT engine text,
+				   OUT os_page_size bigint,
+				   OUT rel_os_pages bigint,
+				   OUT pages_completed bigint,
+				   OUT elapsed_ms float8)
+RETURNS setof record
+AS 'SELECT * from pgfadvise_prefetch($1, ''main'')'
+LANGUAGE SQL;
+
+--
+-- new: variants within a budget, max MB/s and min free memory in MB
+--
+CREATE OR REPLACE FUNCTION
+pgfadvise_willneed(IN regclass, IN text, IN int, IN bigint,
+				   OUT relpath text,
+				   OUT os_page_size bigint,
+				   OUT rel_os_pages bigint,
+				   OUT os_pages_free bigint,
+				   OUT pages_loaded bigint,
+				   OUT pages_skipped bigint)
+RETURNS setof record
+AS '$libdir/pgfincore', 'pgfadvise_willneed_budget'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfadvise_willneed(regclass, text, int, bigint)
+IS 'Load a relation within a budget: max MB/s and min free memory in MB';
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_willneed(IN regclass, IN int, IN bigint,
+				   OUT relpath text,
+				   OUT os_page_size bigint,
+				   OUT rel_os_pages bigint,
+				   OUT os_pages_free bigint,
+				   OUT pages_loaded bigint,
+				   OUT pages_skipped bigint)
+RETURNS setof record
+AS 'SELECT * from pgfadvise_willneed($1, ''main'', $2, $3)'
+LANGUAGE SQL;
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_loader(IN regclass, IN text, IN int, IN bool, IN bool, IN varbit, IN int, IN bigint,
+				 OUT relpath text,
+				 OUT os_page_size bigint,
+				 OUT os_pages_free bigint,
+				 OUT pages_loaded bigint,
+				 OUT pages_unloaded bigint,
+				 OUT syscalls bigint,
+				 OUT pages_skipped bigint)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfadvise_loader(regclass, text, int, bool, bool, varbit, int, bigint)
+IS 'Restore cache from the snapshot within a budget: max MB/s and min free memory in MB';
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_loader(IN regclass, IN int, IN bool, IN bool, IN varbit, IN int, IN bigint,
+				 OUT relpath text,
+				 OUT os_page_size bigint,
+				 OUT os_pages_free bigint,
+				 OUT pages_loaded bigint,
+				 OUT pages_unloaded bigint,
+				 OUT syscalls bigint,
+				 OUT pages_skipped bigint)
+RETURNS setof record
+AS 'SELECT pgfadvise_loader($1, ''main'', $2, $3, $4, $5, $6, $7)'
+LANGUAGE SQL;
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_loader(IN regclass, IN text, IN int, IN bool, IN bool, IN pgfincore_map, IN int, IN bigint,
+				 OUT relpath text,
+				 OUT os_page_size bigint,
+				 OUT os_pages_free bigint,
+				 OUT pages_loaded bigint,
+				 OUT pages_unloaded bigint,
+				 OUT syscalls bigint,
+				 OUT pages_skipped bigint)
+RETURNS setof record
+AS '$libdir/pgfincore', 'pgfadvise_loader_map'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfadvise_loader(regclass, text, int, bool, bool, pgfincore_map, int, bigint)
+IS 'Restore cache from the snapshot within a budget: max MB/s and min free memory in MB';
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_loader(IN regclass, IN int, IN bool, IN bool, IN pgfincore_map, IN int, IN bigint,
+				 OUT relpath text,
+				 OUT os_page_size bigint,
+				 OUT os_pages_free bigint,
+				 OUT pages_loaded bigint,
+				 OUT pages_unloaded bigint,
+				 OUT syscalls bigint,
+				 OUT pages_skipped bigint)
+RETURNS setof record
+AS 'SELECT pgfadvise_loader($1, ''main'', $2, $3, $4, $5, $6, $7)'
+LANGUAGE SQL;
+
+--
+-- new: block range variants, start_block and nblocks
+--
+CREATE OR REPLACE FUNCTION
+pgfadvise(IN regclass, IN text, IN int, IN bigint, IN bigint,
+		  OUT relpath text,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT os_pages_free bigint)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfadvise(regclass, text, int, bigint, bigint)
+IS 'Predeclare an access pattern for a range of blocks: start_block, nblocks';
+
+CREATE OR REPLACE FUNCTION
+pgfincore(IN regclass, IN text, IN bool, IN bigint, IN bigint,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint,
+		  OUT group_mem bigint,
+		  OUT os_pages_free bigint,
+		  OUT databit      varbit,
+		  OUT pages_dirty bigint,
+		  OUT group_dirty bigint,
+		  OUT pages_writeback bigint,
+		  OUT pages_evicted bigint,
+		  OUT pages_recently_evicted bigint,
+		  OUT pinned bool)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore(regclass, text, bool, bigint, bigint)
+IS 'Inspect the system cache for a range of blocks: start_block, nblocks';
+
+CREATE OR REPLACE FUNCTION
+pgfincore(IN regclass, IN text, IN bigint, IN bigint,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint,
+		  OUT group_mem bigint,
+		  OUT os_pages_free bigint,
+		  OUT databit      varbit,
+		  OUT pages_dirty bigint,
+		  OUT group_dirty bigint,
+		  OUT pages_writeback bigint,
+		  OUT pages_evicted bigint,
+		  OUT pages_recently_evicted bigint,
+		  OUT pinned bool)
+RETURNS setof record
+AS 'SELECT * from pgfincore($1, $2, false, $3, $4)'
+LANGUAGE SQL;
+
+--
+-- new function: pgfincore_blocks
+--
+CREATE OR REPLACE FUNCTION
+pgfincore_blocks(IN regclass, IN text,
+				 OUT relblocknumber bigint,
+				 OUT segment int,
+				 OUT os_pages int,
+				 OUT os_pages_mem int,
+				 OUT state text)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_blocks(regclass, text)
+IS 'System cache state of each block of a relation: full, partial or absent';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_blocks(IN regclass,
+				 OUT relblocknumber bigint,
+				 OUT segment int,
+				 OUT os_pages int,
+				 OUT os_pages_mem int,
+				 OUT state text)
+RETURNS setof record
+AS 'SELECT * from pgfincore_blocks($1, ''main'')'
+LANGUAGE SQL;
+
+CREATE OR REPLACE FUNCTION
+pgfincore_blocks(IN regclass, IN text, IN bigint, IN bigint,
+				 OUT relblocknumber bigint,
+				 OUT segment int,
+				 OUT os_pages int,
+				 OUT os_pages_mem int,
+				 OUT state text)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_blocks(regclass, text, bigint, bigint)
+IS 'System cache state of each block of a range of blocks: start_block, nblocks';
+
+--
+-- new function: pgfincore_double_buffered
+--
+CREATE OR REPLACE FUNCTION
+pgfincore_double_buffered(IN regclass, IN text, IN bool,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT shared_blocks bigint,
+		  OUT os_pages_double bigint,
+		  OUT os_pages_evicted bigint)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_double_buffered(regclass, text, bool)
+IS 'Pages of a relation both in shared_buffers and in the system cache, option to remove the clean ones from the system cache';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_double_buffered(IN regclass, IN bool,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT shared_blocks bigint,
+		  OUT os_pages_double bigint,
+		  OUT os_pages_evicted bigint)
+RETURNS setof record
+AS 'SELECT * from pgfincore_double_buffered($1, ''main'', $2)'
+LANGUAGE SQL;
+
+CREATE OR REPLACE FUNCTION
+pgfincore_double_buffered(IN regclass,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT shared_blocks bigint,
+		  OUT os_pages_double bigint,
+		  OUT os_pages_evicted bigint)
+RETURNS setof record
+AS 'SELECT * from pgfincore_double_buffered($1, ''main'', false)'
+LANGUAGE SQL;
+
+--
+-- new: regclass[] variants, option to include the dependent relations
+--
+CREATE OR REPLACE FUNCTION
+pgfadvise(IN regclass[], IN text, IN int, IN bool,
+		  OUT relid regclass,
+		  OUT fork text,
+		  OUT relpath text,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT os_pages_free bigint)
+RETURNS setof record
+AS '$libdir/pgfincore', 'pgfadvise_batch'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pgfadvise(regclass[], text, int, bool)
+IS 'Predeclare an access pattern for a list of relations, option to include their partitions, indexes and TOAST';
+
+CREATE OR REPLACE FUNCTION
+pgfincore(IN regclass[], IN text, IN bool, IN bool,
+		  OUT relid regclass,
+		  OUT fork text,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint,
+		  OUT group_mem bigint,
+		  OUT os_pages_free bigint,
+		  OUT databit      varbit,
+		  OUT pages_dirty bigint,
+		  OUT group_dirty bigint,
+		  OUT pages_writeback bigint,
+		  OUT pages_evicted bigint,
+		  OUT pages_recently_evicted bigint,
+		  OUT pinned bool)
+RETURNS setof record
+AS '$libdir/pgfincore', 'pgfincore_batch'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pgfincore(regclass[], text, bool, bool)
+IS 'Inspect the system cache for a list of relations, option to include their partitions, indexes and TOAST';
+
+--
+-- new: entire object, all the forks of a relation and its dependents
+--
+CREATE OR REPLACE FUNCTION
+pgfadvise_object(IN regclass, IN int,
+		  OUT relid regclass,
+		  OUT fork text,
+		  OUT relpath text,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT os_pages_free bigint)
+RETURNS setof record
+AS 'SELECT * from pgfadvise(array[$1], NULL, $2, true)'
+LANGUAGE SQL;
+
+COMMENT ON FUNCTION pgfadvise_object(regclass, int)
+IS 'Predeclare an access pattern for all the forks of a relation, its partitions, indexes and TOAST';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_object(IN regclass, IN bool,
+		  OUT relid regclass,
+		  OUT fork text,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint,
+		  OUT group_mem bigint,
+		  OUT os_pages_free bigint,
+		  OUT databit      varbit,
+		  OUT pages_dirty bigint,
+		  OUT group_dirty bigint,
+		  OUT pages_writeback bigint,
+		  OUT pages_evicted bigint,
+		  OUT pages_recently_evicted bigint,
+		  OUT pinned bool)
+RETURNS setof record
+AS 'SELECT * from pgfincore(array[$1], NULL, $2, true)'
+LANGUAGE SQL;
+
+COMMENT ON FUNCTION pgfincore_object(regclass, bool)
+IS 'Inspect the system cache for all the forks of a relation, its partitions, indexes and TOAST';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_object(IN regclass,
+		  OUT relid regclass,
+		  OUT fork text,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint,
+		  OUT group_mem bigint,
+		  OUT os_pages_free bigint,
+		  OUT databit      varbit,
+		  OUT pages_dirty bigint,
+		  OUT group_dirty bigint,
+		  OUT pages_writeback bigint,
+		  OUT pages_evicted bigint,
+		  OUT pages_recently_evicted bigint,
+		  OUT pinned bool)
+RETURNS setof record
+AS 'SELECT * from pgfincore(array[$1], NULL, false, true)'
+LANGUAGE SQL;
+
+--
+-- new: lock-free variants, the paths come from the catalog
+--
+CREATE OR REPLACE FUNCTION
+pgfadvise_nolock(IN regclass, IN text, IN int,
+		  OUT relpath text,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT os_pages_free bigint)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfadvise_nolock(regclass, text, int)
+IS 'Predeclare an access pattern for a relation without locking it';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_nolock(IN regclass, IN text, IN bool,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint,
+		  OUT group_mem bigint,
+		  OUT os_pages_free bigint,
+		  OUT databit      varbit,
+		  OUT pages_dirty bigint,
+		  OUT group_dirty bigint,
+		  OUT pages_writeback bigint,
+		  OUT pages_evicted bigint,
+		  OUT pages_recently_evicted bigint,
+		  OUT pinned bool)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_nolock(regclass, text, bool)
+IS 'Inspect the system cache for a relation without locking it';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_nolock(IN regclass,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint,
+		  OUT group_mem bigint,
+		  OUT os_pages_free bigint,
+		  OUT databit      varbit,
+		  OUT pages_dirty bigint,
+		  OUT group_dirty bigint,
+		  OUT pages_writeback bigint,
+		  OUT pages_evicted bigint,
+		  OUT pages_recently_evicted bigint,
+		  OUT pinned bool)
+RETURNS setof record
+AS 'SELECT * from pgfincore_nolock($1, ''main'', false)'
+LANGUAGE SQL;
+
+CREATE OR REPLACE FUNCTION
+pgfincore_database(IN bool,
+		  OUT relid regclass,
+		  OUT fork text,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint,
+		  OUT group_mem bigint,
+		  OUT os_pages_free bigint,
+		  OUT databit      varbit,
+		  OUT pages_dirty bigint,
+		  OUT group_dirty bigint,
+		  OUT pages_writeback bigint,
+		  OUT pages_evicted bigint,
+		  OUT pages_recently_evicted bigint,
+		  OUT pinned bool)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_database(bool)
+IS 'Inspect the system cache for all the relations of the current database without locking them';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_database(
+		  OUT relid regclass,
+		  OUT fork text,
+		  OUT relpath text,
+		  OUT segment int,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint,
+		  OUT group_mem bigint,
+		  OUT os_pages_free bigint,
+		  OUT databit      varbit,
+		  OUT pages_dirty bigint,
+		  OUT group_dirty bigint,
+		  OUT pages_writeback bigint,
+		  OUT pages_evicted bigint,
+		  OUT pages_recently_evicted bigint,
+		  OUT pinned bool)
+RETURNS setof record
+AS 'SELECT * from pgfincore_database(false)'
+LANGUAGE SQL;
+
+--
+-- new function: pgfincore_database_parallel
+--
+CREATE OR REPLACE FUNCTION
+pgfincore_database_parallel(IN int,
+		  OUT relid regclass,
+		  OUT fork text,
+		  OUT segments bigint,
+		  OUT rel_os_pages bigint,
+		  OUT pages_mem bigint)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_database_parallel(int)
+IS 'Inspect the system cache for all the relations of the current database with background workers, one row per fork';
+
+--
+-- new function: pgfincore_estimate
+--
+CREATE OR REPLACE FUNCTION
+pgfincore_estimate(IN regclass, IN text, IN int, IN int,
+		  OUT relpath text,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT sampled_pages bigint,
+		  OUT sampled_pages_mem bigint,
+		  OUT pages_mem bigint,
+		  OUT pages_mem_low bigint,
+		  OUT pages_mem_high bigint)
+RETURNS record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_estimate(regclass, text, int, int)
+IS 'Estimate the pages of a relation in the system cache from a sample of windows of os pages, with a 95% confidence interval';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_estimate(IN regclass,
+		  OUT relpath text,
+		  OUT os_page_size bigint,
+		  OUT rel_os_pages bigint,
+		  OUT sampled_pages bigint,
+		  OUT sampled_pages_mem bigint,
+		  OUT pages_mem bigint,
+		  OUT pages_mem_low bigint,
+		  OUT pages_mem_high bigint)
+RETURNS record
+AS 'SELECT * from pgfincore_estimate($1, ''main'', 1000, 64)'
+LANGUAGE SQL;
+
+--
+-- new table: pgfincore_advice
+--
+CREATE TABLE pgfincore_advice (
+	relid	regclass PRIMARY KEY,
+	advice	text NOT NULL
+			CHECK (advice IN ('normal', 'sequential', 'random'))
+);
+
+COMMENT ON TABLE pgfincore_advice
+IS 'Access pattern policy of the relations: normal, sequential or random';
+
+SELECT pg_catalog.pg_extension_config_dump('pgfincore_advice', '');
+
+CREATE OR REPLACE FUNCTION
+pgfincore_advice_invalidate()
+RETURNS trigger
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_advice_invalidate()
+IS 'Reload the access pattern policies in the backends';
+
+CREATE TRIGGER pgfincore_advice_invalidate
+AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON pgfincore_advice
+FOR EACH STATEMENT EXECUTE PROCEDURE pgfincore_advice_invalidate();
+
+-- the backends of the database which did not find the table look for it again
+TRUNCATE pgfincore_advice;
+
+--
+-- new table: pgfincore_pin
+--
+CREATE TABLE pgfincore_pin (
+	relid	regclass NOT NULL,
+	fork	text NOT NULL DEFAULT 'main'
+			CHECK (fork IN ('main', 'fsm', 'vm', 'init')),
+	mode	text NOT NULL DEFAULT 'soft'
+			CHECK (mode IN ('soft', 'hard')),
+	PRIMARY KEY (relid, fork)
+);
+
+COMMENT ON TABLE pgfincore_pin
+IS 'Relation forks kept in the page cache by the background worker';
+
+SELECT pg_catalog.pg_extension_config_dump('pgfincore_pin', '');
+
+CREATE OR REPLACE FUNCTION
+pgfincore_pin_stats(OUT relid regclass,
+					OUT fork text,
+					OUT checks bigint,
+					OUT refills bigint,
+					OUT pages_refilled bigint,
+					OUT pages_locked bigint,
+					OUT last_check timestamptz,
+					OUT last_refill timestamptz)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_pin_stats()
+IS 'How often and how much the pinned relations of the database have been refilled';
+
+--
+-- new functions: pgfincore_diff and pgfadvise_loader_delta
+--
+CREATE OR REPLACE FUNCTION
+pgfincore_diff(IN regclass, IN text, IN int, IN varbit,
+			   OUT relpath text,
+			   OUT os_page_size bigint,
+			   OUT rel_os_pages bigint,
+			   OUT pages_to_load bigint,
+			   OUT pages_to_unload bigint,
+			   OUT load varbit,
+			   OUT unload varbit)
+RETURNS record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_diff(regclass, text, int, varbit)
+IS 'Compare a snapshot of a segment with the page cache, the pages to load and to unload to restore it';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_diff(IN regclass, IN text, IN int, IN pgfincore_map,
+			   OUT relpath text,
+			   OUT os_page_size bigint,
+			   OUT rel_os_pages bigint,
+			   OUT pages_to_load bigint,
+			   OUT pages_to_unload bigint,
+			   OUT load varbit,
+			   OUT unload varbit)
+RETURNS record
+AS '$libdir/pgfincore', 'pgfincore_diff_map'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_diff(regclass, text, int, pgfincore_map)
+IS 'Compare a snapshot of a segment with the page cache, the pages to load and to unload to restore it';
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_loader_delta(IN regclass, IN text, IN int, IN bool, IN bool, IN varbit,
+					   OUT relpath text,
+					   OUT os_page_size bigint,
+					   OUT os_pages_free bigint,
+					   OUT pages_loaded bigint,
+					   OUT pages_unloaded bigint,
+					   OUT syscalls bigint,
+					   OUT pages_skipped bigint)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfadvise_loader_delta(regclass, text, int, bool, bool, varbit)
+IS 'Restore cache from the snapshot, only the pages whose state differs are loaded or unloaded';
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_loader_delta(IN regclass, IN text, IN int, IN bool, IN bool, IN pgfincore_map,
+					   OUT relpath text,
+					   OUT os_page_size bigint,
+					   OUT os_pages_free bigint,
+					   OUT pages_loaded bigint,
+					   OUT pages_unloaded bigint,
+					   OUT syscalls bigint,
+					   OUT pages_skipped bigint)
+RETURNS setof record
+AS '$libdir/pgfincore', 'pgfadvise_loader_delta_map'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfadvise_loader_delta(regclass, text, int, bool, bool, pgfincore_map)
+IS 'Restore cache from the snapshot, only the pages whose state differs are loaded or unloaded';
+
+--
+-- new functions: pgfincore_heat_agg, pgfincore_heat_databit and
+-- pgfadvise_loader_heat
+--
+CREATE OR REPLACE FUNCTION
+pgfincore_heat_trans(internal, varbit)
+RETURNS internal
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION
+pgfincore_heat_trans(internal, pgfincore_map)
+RETURNS internal
+AS '$libdir/pgfincore', 'pgfincore_heat_trans_map'
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION
+pgfincore_heat_final(internal)
+RETURNS bytea
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+CREATE AGGREGATE pgfincore_heat_agg(varbit) (
+	SFUNC = pgfincore_heat_trans,
+	STYPE = internal,
+	FINALFUNC = pgfincore_heat_final
+);
+
+COMMENT ON AGGREGATE pgfincore_heat_agg(varbit)
+IS 'Heat map of snapshots of a segment: for each page, the number of snapshots with the page in cache';
+
+CREATE AGGREGATE pgfincore_heat_agg(pgfincore_map) (
+	SFUNC = pgfincore_heat_trans,
+	STYPE = internal,
+	FINALFUNC = pgfincore_heat_final
+);
+
+COMMENT ON AGGREGATE pgfincore_heat_agg(pgfincore_map)
+IS 'Heat map of snapshots of a segment: for each page, the number of snapshots with the page in cache';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_heat_databit(IN bytea, IN int)
+RETURNS varbit
+AS '$libdir/pgfincore'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION pgfincore_heat_databit(bytea, int)
+IS 'The pages of a heat map in cache in at least min_heat snapshots';
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_loader_heat(IN regclass, IN text, IN int, IN bool, IN bool, IN bytea, IN bigint,
+					  OUT relpath text,
+					  OUT os_page_size bigint,
+					  OUT os_pages_free bigint,
+					  OUT pages_loaded bigint,
+					  OUT pages_unloaded bigint,
+					  OUT syscalls bigint,
+					  OUT pages_skipped bigint)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfadvise_loader_heat(regclass, text, int, bool, bool, bytea, bigint)
+IS 'Restore cache from a heat map, hottest pages first within a budget in MB';
+
+--
+-- new functions: pgfincore_ranges and pgfadvise_loader_ranges
+--
+CREATE OR REPLACE FUNCTION
+pgfincore_ranges(IN regclass, IN text,
+				 OUT segment int,
+				 OUT start_page bigint,
+				 OUT npages bigint,
+				 OUT dirty bool)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfincore_ranges(regclass, text)
+IS 'The runs of contiguous OS pages of a relation fork in the page cache';
+
+CREATE OR REPLACE FUNCTION
+pgfincore_ranges(IN regclass,
+				 OUT segment int,
+				 OUT start_page bigint,
+				 OUT npages bigint,
+				 OUT dirty bool)
+RETURNS setof record
+AS 'SELECT * from pgfincore_ranges($1, ''main'')'
+LANGUAGE SQL;
+
+CREATE OR REPLACE FUNCTION
+pgfadvise_loader_ranges(IN regclass, IN text, IN bigint[], IN bigint[],
+						OUT relpath text,
+						OUT os_page_size bigint,
+						OUT os_pages_free bigint,
+						OUT pages_loaded bigint,
+						OUT pages_unloaded bigint,
+						OUT syscalls bigint,
+						OUT pages_skipped bigint)
+RETURNS setof record
+AS '$libdir/pgfincore'
+LANGUAGE C;
+
+COMMENT ON FUNCTION pgfadvise_loader_ranges(regclass, text, bigint[], bigint[])
+IS 'Load the ranges of OS pages given by their first page and their number of pages, one WILLNEED call per run';
+
+--
+-- PARALLEL SAFE, PostgreSQL >= 9.6
+-- the functions which only read the page cache, without local buffers nor
+-- background workers
+--
+DO $$
+DECLARE
+	f text;
+BEGIN
+	IF current_setting('server_version_num')::int >= 90600 THEN
+		FOREACH f IN ARRAY ARRAY[
+			'pgsysconf()',
+			'pgsysconf_pretty()',
+			'pgfincore(regclass, text, bool)',
+			'pgfincore(regclass, text, bool, bigint, bigint)',
+			'pgfincore(regclass, text, bigint, bigint)',
+			'pgfincore(regclass, bool)',
+			'pgfincore(regclass)',
+			'pgfincore(regclass[], text, bool, bool)',
+			'pgfincore_blocks(regclass, text)',
+			'pgfincore_blocks(regclass)',
+			'pgfincore_blocks(regclass, text, bigint, bigint)',
+			'pgfincore_object(regclass, bool)',
+			'pgfincore_object(regclass)',
+			'pgfincore_nolock(regclass, text, bool)',
+			'pgfincore_nolock(regclass)',
+			'pgfincore_database(bool)',
+			'pgfincore_database()',
+			'pgfincore_estimate(regclass, text, int, int)',
+			'pgfincore_estimate(regclass)',
+			'pgfincore_diff(regclass, text, int, varbit)',
+			'pgfincore_diff(regclass, text, int, pgfincore_map)',
+			'pgfincore_heat_databit(bytea, int)',
+			'pgfincore_ranges(regclass, text)',
+			'pgfincore_ranges(regclass)',
+			'pgfincore_drawer(varbit)',
+			'pgfincore_drawer(pgfincore_map)',
+			'pgfincore_map_in(cstring)',
+			'pgfincore_map_out(pgfincore_map)',
+			'pgfincore_map_from_varbit(varbit)',
+			'pgfincore_map_to_varbit(pgfincore_map)'
+		]
+		LOOP
+			EXECUTE 'ALTER FUNCTION ' || f || ' PARALLEL SAFE';
+		END LOOP;
+	END IF;
+END
+$$;
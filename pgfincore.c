@@ -8,27 +8,85 @@
 #define _XOPEN_SOURCE 600 /* fadvise */
 
 #include <fcntl.h>  /* fadvise */
-#include <stdlib.h> /* exit, calloc, free */
+#include <stdlib.h> /* exit */
 #include <sys/stat.h> /* stat, fstat */
 #include <sys/types.h> /* size_t, mincore */
 #include <sys/mman.h> /* mmap, mincore */
+#include <sys/resource.h> /* getrlimit */
 #include <unistd.h> /* sysconf, close */
+#include <signal.h> /* sig_atomic_t */
+#include <math.h> /* sqrt */
+#ifdef __linux__
+#include <sys/syscall.h> /* cachestat */
+#endif
+#ifdef PGFINCORE_LIBURING
+#include <liburing.h> /* io_uring prefetch engine */
+#endif
 /* } */
 
 /* PostgreSQL stuff */
 #include "postgres.h" /* general Postgres declarations */
 
+#include "access/genam.h" /* systable_beginscan */
 #include "access/heapam.h" /* relation_open */
 #include "catalog/catalog.h" /* relpath */
 #include "catalog/namespace.h" /* makeRangeVarFromNameList */
+#include "catalog/pg_class.h" /* Form_pg_class */
+#include "catalog/pg_extension.h" /* Form_pg_extension */
+#if PG_VERSION_NUM >= 110000
+#include "catalog/pg_inherits.h" /* find_all_inheritors */
+#else
+#include "catalog/pg_inherits_fn.h" /* find_all_inheritors */
+#endif
 #include "catalog/pg_type.h" /* TEXTOID for tuple_desc */
+#include "commands/extension.h" /* get_extension_oid */
+#include "commands/trigger.h" /* TriggerData */
+#include "executor/executor.h" /* ExecutorStart_hook */
 #include "funcapi.h" /* SRF */
+#include "lib/stringinfo.h" /* StringInfo */
+#include "miscadmin.h" /* MyDatabaseId */
+#include "nodes/execnodes.h" /* ReturnSetInfo */
+#include "utils/array.h" /* deconstruct_array */
 #include "utils/builtins.h" /* textToQualifiedNameList */
+#include "utils/guc.h" /* DefineCustomBoolVariable */
+#include "utils/inval.h" /* CacheInvalidateRelcache */
+#include "utils/lsyscache.h" /* get_relname_relid */
+#include "utils/memutils.h" /* AllocSetContextCreate */
 #include "utils/rel.h" /* Relation */
+#include "utils/sampling.h" /* BlockSampler */
+#include "utils/relmapper.h" /* RelationMapOidToFilenode */
+#include "utils/syscache.h" /* SearchSysCache1 */
+#include "utils/tuplestore.h" /* tuplestore_putvalues */
 #include "utils/varbit.h" /* bitstring datatype */
+#include "storage/buf_internals.h" /* GetBufferDescriptor */
+#include "storage/bufmgr.h" /* NBuffers */
 #include "storage/fd.h"
+#include "storage/smgr.h" /* smgrnblocks */
 #include "access/htup_details.h" /* heap_form_tuple */
 #include "common/relpath.h" /* relpathbackend */
+#include "access/xact.h" /* StartTransactionCommand */
+#include "pgstat.h" /* pgstat_report_activity, PG_WAIT_EXTENSION */
+#include "postmaster/bgworker.h" /* RegisterBackgroundWorker */
+#include "storage/ipc.h" /* proc_exit */
+#include "storage/lwlock.h" /* LWLockAcquire */
+#include "storage/shmem.h" /* ShmemInitStruct */
+#include "storage/latch.h" /* WaitLatch */
+#include "utils/snapmgr.h" /* InvalidateCatalogSnapshot */
+#include "utils/timestamp.h" /* GetCurrentTimestamp */
+#if PG_VERSION_NUM >= 120000
+#include "access/relscan.h" /* ParallelBlockTableScanDesc */
+#include "access/table.h" /* table_open */
+#include "access/tableam.h" /* GetHeapamTableAmRoutine */
+#include "nodes/nodeFuncs.h" /* planstate_tree_walker */
+#include "port/atomics.h" /* pg_atomic_fetch_add_u32 */
+#include "storage/dsm.h" /* dsm_create */
+#include "tcop/tcopprot.h" /* die */
+#include "utils/hsearch.h" /* hash_search */
+#include "utils/resowner.h" /* ResourceOwnerCreate */
+#include "utils/varlena.h" /* SplitIdentifierString */
+#endif
+
+#include "pgfincore_pack.h" /* mincore vector to varbit */
 
 #ifdef PG_VERSION_NUM
 #define PG_MAJOR_VERSION (PG_VERSION_NUM / 100)
@@ -40,14 +98,36 @@
 #error "Unsupported postgresql version"
 #endif
 
+#if PG_VERSION_NUM < 90500
+#define FLEXIBLE_ARRAY_MEMBER	1
+#define PG_INT64_MAX			INT64CONST(0x7FFFFFFFFFFFFFFF)
+#endif
+
+#if PG_VERSION_NUM < 90600
+#define ALLOCSET_DEFAULT_SIZES \
+	ALLOCSET_DEFAULT_MINSIZE, ALLOCSET_DEFAULT_INITSIZE, ALLOCSET_DEFAULT_MAXSIZE
+#endif
+
 #ifdef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
 #endif
 
 #define PGSYSCONF_COLS  		3
 #define PGFADVISE_COLS			4
-#define PGFADVISE_LOADER_COLS	5
-#define PGFINCORE_COLS  		10
+#define PGFADVISE_PREFETCH_COLS	6
+#define PGFADVISE_LOADER_COLS	7
+#define PGFADVISE_BUDGET_COLS	6
+#define PGFINCORE_COLS  		14
+#define PGFINCORE_BLOCKS_COLS	5
+#define PGFINCORE_DOUBLE_COLS	5
+#define PGFINCORE_PARALLEL_COLS	5
+#define PGFINCORE_ESTIMATE_COLS	8
+#define PGFINCORE_PIN_STATS_COLS	8
+#define PGFINCORE_DIFF_COLS		7
+#define PGFINCORE_RANGES_COLS	4
+
+/* upper bound of the workers of pgfincore_database_parallel */
+#define PGF_SWEEP_MAX_WORKERS	64
 
 #define PGF_WILLNEED	10
 #define PGF_DONTNEED	20
@@ -55,6 +135,16 @@ PG_MODULE_MAGIC;
 #define PGF_SEQUENTIAL	40
 #define PGF_RANDOM		50
 
+/* how pgfadvise WILLNEED and pgfadvise_loader load the pages */
+#define PGF_ENGINE_FADVISE	0
+#define PGF_ENGINE_IO_URING	1
+
+/*
+ * pgfincore_file works on windows of that size, it bounds the address space
+ * mmaped and the vector allocated per call whatever the size of the segment.
+ */
+#define PGF_WINDOW_SIZE	(64 * 1024 * 1024)
+
 #define FINCORE_PRESENT 0x1
 #define FINCORE_DIRTY   0x2
 #ifndef HAVE_FINCORE
@@ -62,6 +152,82 @@ PG_MODULE_MAGIC;
 #else
 #define FINCORE_BITS    2
 #endif
+
+/*
+ * cachestat(2), Linux >= 6.5
+ * returns the page cache counters of a file range without mmap nor vector.
+ * It is detected at runtime, the structures are declared here because the
+ * libc headers may not have them. Older headers do not define its number
+ * either, 451 is known only for x86 and the architectures of asm-generic,
+ * the others use mincore() until their headers have it.
+ */
+#if defined(__linux__) && !defined(__NR_cachestat) && \
+	(defined(__i386__) || (defined(__x86_64__) && !defined(__ILP32__)) || \
+	 defined(__aarch64__) || defined(__riscv) || defined(__loongarch__))
+#define __NR_cachestat	451
+#endif
+
+#if defined(__linux__) && defined(__NR_cachestat) && !defined(HAVE_FINCORE)
+#define HAVE_CACHESTAT
+
+typedef struct
+{
+	uint64	off;
+	uint64	len;
+} pgfincore_cachestat_range;
+
+typedef struct
+{
+	uint64	nr_cache;
+	uint64	nr_dirty;
+	uint64	nr_writeback;
+	uint64	nr_evicted;
+	uint64	nr_recently_evicted;
+} pgfincore_cachestat;
+#endif
+
+/* GUC: use cachestat when available */
+static bool		pgfincore_use_cachestat = false;
+
+/* GUCs of the prefetch engine */
+static const struct config_enum_entry pgfincore_engine_options[] = {
+	{"fadvise", PGF_ENGINE_FADVISE, false},
+	{"io_uring", PGF_ENGINE_IO_URING, false},
+	{NULL, 0, false}
+};
+static int		pgfincore_prefetch_engine = PGF_ENGINE_FADVISE;
+static int		pgfincore_io_uring_queue_depth = 32;
+
+/* GUCs of the background worker */
+static char		*pgfincore_databases = NULL;
+static int		pgfincore_snapshot_interval = 300;
+static int		pgfincore_restore_rate = 0;
+static int		pgfincore_pin_interval = 10;
+static int		pgfincore_max_pins = 1000;
+static int		pgfincore_max_hard_segments = 10000;
+static int		pgfincore_pin_budget = 0;
+
+/* the workers registered by the postmaster */
+static int		pgfincore_nworkers = 0;
+
+/* GUCs of the scan-following prefetch */
+static int		pgfincore_scan_prefetch_window = 0;
+static int		pgfincore_scan_prefetch_min_size = 1024;
+
+/* the access pattern policies and the scan prefetch start at ExecutorStart */
+static ExecutorStart_hook_type prev_ExecutorStart = NULL;
+
+/* the shared memory of the counters of the pins */
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+#if PG_VERSION_NUM >= 120000
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#endif
+
+/* set by the signal handlers of the background worker */
+static volatile sig_atomic_t pgfincore_got_sighup = false;
+static volatile sig_atomic_t pgfincore_got_sigterm = false;
 /*
  * pgfadvise_fctx structure is needed
  * to keep track of relation path, segment number, ...
@@ -73,6 +239,9 @@ typedef struct
 	Relation		rel;			/* the relation */
 	unsigned int	segcount;		/* the segment current number */
 	char 			*relationpath;	/* the relation path */
+	bool			prefetch;		/* called by pgfadvise_prefetch */
+	int64			startBlock;		/* the block range, */
+	int64			endBlock;		/* endBlock is -1 for all the blocks */
 } pgfadvise_fctx;
 
 /*
@@ -84,6 +253,10 @@ typedef struct
 	size_t			pageSize;	/* os page size */
 	size_t			pagesFree;	/* free page cache */
 	size_t			filesize;	/* the filesize */
+	const char		*engine;	/* engine used for WILLNEED */
+	bool			hasCompleted;	/* the engine reports completions */
+	int64			pagesCompleted;	/* pages read by the engine */
+	double			elapsed;	/* time spent, in ms */
 } pgfadviseStruct;
 
 /*
@@ -96,6 +269,9 @@ typedef struct
 	size_t	pagesFree;		/* free page cache */
 	size_t	pagesLoaded;	/* pages loaded */
 	size_t	pagesUnloaded;	/* pages unloaded  */
+	size_t	pagesSkipped;	/* pages not loaded, budget reached */
+	size_t	relPages;		/* pages used by the segment */
+	size_t	syscalls;		/* posix_fadvise calls issued */
 } pgfloaderStruct;
 
 /*
@@ -109,8 +285,46 @@ typedef struct
 	Relation 		rel;			/* the relation */
 	unsigned int	segcount;		/* the segment current number */
 	char			*relationpath;	/* the relation path */
+	int64			startBlock;		/* the block range, */
+	int64			endBlock;		/* endBlock is -1 for all the blocks */
 } pgfincore_fctx;
 
+/*
+ * pgfincore_blocks_fctx structure is needed
+ * to keep track of the segment and of the block we are at
+ */
+typedef struct
+{
+	TupleDesc		tupd;			/* the tuple descriptor */
+	Relation 		rel;			/* the relation */
+	unsigned int	segcount;		/* the segment current number */
+	char			*relationpath;	/* the relation path */
+	int64			startBlock;		/* the block range, */
+	int64			endBlock;		/* endBlock is -1 for all the blocks */
+	bool			started;		/* a segment has been read */
+	VarBit			*databit;		/* the map of the current segment */
+	size_t			pageSize;		/* os page size */
+	off_t			bitBase;		/* offset of the first page of the map */
+	int64			block;			/* next block of the current segment */
+	int64			lastBlock;		/* end of the blocks of the segment */
+} pgfincore_blocks_fctx;
+
+/*
+ * pgfincore_double_fctx structure is needed
+ * to keep track of the blocks in shared_buffers and of the segment we are at
+ */
+typedef struct
+{
+	TupleDesc		tupd;			/* the tuple descriptor */
+	Relation 		rel;			/* the relation */
+	unsigned int	segcount;		/* the segment current number */
+	char			*relationpath;	/* the relation path */
+	bool			evict;			/* remove them from the OS cache ? */
+	BlockNumber		*blocks;		/* the blocks in shared_buffers, sorted */
+	int				nblocks;
+	int				next;			/* first block of the current segment */
+} pgfincore_double_fctx;
+
 /*
  * pgfadvise_loader_struct structure is needed
  * to keep track of relation path, segment number, ...
@@ -124,36 +338,530 @@ typedef struct
 	size_t	group_mem;
 	size_t	pages_dirty;
 	size_t	group_dirty;
+	size_t	pages_writeback;
+	size_t	pages_evicted;
+	size_t	pages_recently_evicted;
+	bool	has_group_mem;	/* group_mem is counted, by mincore */
+	bool	has_cachestat;	/* counters from cachestat are set */
+	bool	pinned;			/* locked in memory by the worker */
+	off_t	rangeEnd;		/* end of the bytes inspected */
 	VarBit	*databit;
 } pgfincoreStruct;
 
+/*
+ * pgfincore_map datatype
+ * a bit string stored as the lengths of its runs of contiguous bits in the
+ * same state, each one as a varint (7 bits per byte, lowest first). The runs
+ * alternate, the first one is a run of unset bits and may be empty.
+ * When the runs take more room than the bit string itself (pages in and out
+ * of cache one by one), the bit string is stored instead.
+ *
+ * data: format, varint bit length, then runs or bit string
+ */
+typedef struct
+{
+	int32	vl_len_;		/* varlena header (do not touch directly!) */
+	uint8	data[FLEXIBLE_ARRAY_MEMBER];
+} PgfincoreMap;
+
+#define PGF_MAP_RUNS	0	/* the runs */
+#define PGF_MAP_BITMAP	1	/* the bit string, varbit layout */
+
+#define PGF_MAP_END(map)	((uint8 *) (map) + VARSIZE(map))
+#define PG_GETARG_PGFINCORE_MAP_P(n)	((PgfincoreMap *) PG_DETOAST_DATUM(PG_GETARG_DATUM(n)))
+
+/*
+ * pgfincore_throttle
+ * pace the WILLNEED calls of the loader to a rate in bytes per second, and
+ * stop them when the free memory goes below a floor
+ */
+typedef struct
+{
+	int64		rate;		/* bytes per second, 0 for no limit */
+	int64		minFree;	/* free memory floor in bytes, 0 for none */
+	int64		bytes;		/* bytes advised since start */
+	TimestampTz	start;
+} pgfincore_throttle;
+
+/*
+ * pgfadvise_budget_fctx structure is needed
+ * to keep track of relation path, segment number and of the budget spent
+ * on the previous segments
+ */
+typedef struct
+{
+	TupleDesc			tupd;			/* the tuple descriptor */
+	Relation			rel;			/* the relation */
+	unsigned int		segcount;		/* the segment current number */
+	char				*relationpath;	/* the relation path */
+	pgfincore_throttle	throttle;		/* the budget */
+} pgfadvise_budget_fctx;
+
+/*
+ * what a snapshot or a restore of a database reports
+ */
+typedef struct
+{
+	int64	relations;
+	int64	segments;
+	int64	segments_skipped;
+	int64	rel_os_pages;
+	int64	pages_mem;
+	int64	pages_loaded;
+	int64	pages_unloaded;
+	int64	syscalls;
+} pgfincore_db_counters;
+
+/*
+ * pgfincore_runs
+ * iterator on the runs of a bit string or of a pgfincore_map
+ */
+typedef struct
+{
+	int64		bitlen;
+	int64		pos;	/* start of the next run */
+	const bits8	*bits;	/* the bit string, NULL for encoded runs */
+	const uint8	*p;		/* next encoded run */
+	const uint8	*end;
+	bool		set;	/* state of the next encoded run */
+} pgfincore_runs;
+
+/*
+ * pgfincore_range_writer
+ * the runs of pages in cache found by pgfincore_file, each one is written to
+ * the tuplestore once it ends
+ */
+typedef struct
+{
+	Tuplestorestate	*tupstore;
+	TupleDesc		tupdesc;
+	unsigned int	segno;		/* the current segment */
+	int64			segPages;	/* OS pages of a full segment */
+	int64			start;		/* first page of the current run, -1 for none */
+	int64			end;
+	bool			dirty;
+} pgfincore_range_writer;
+
+/*
+ * pgfincore_range
+ * a range of OS pages of a relation given to pgfadvise_loader_ranges
+ */
+typedef struct
+{
+	int64	start;
+	int64	end;
+} pgfincore_range;
+
+void		_PG_init(void);
+
 Datum pgsysconf(PG_FUNCTION_ARGS);
 
 Datum 		pgfadvise(PG_FUNCTION_ARGS);
-static int	pgfadvise_file(char *filename, int advice, pgfadviseStruct *pgfdv);
+Datum 		pgfadvise_prefetch(PG_FUNCTION_ARGS);
+Datum 		pgfadvise_nolock(PG_FUNCTION_ARGS);
+static Datum pgfadvise_srf(FunctionCallInfo fcinfo, bool prefetch, bool nolock);
+static int	pgfadvise_file(char *filename, int advice, off_t offset, off_t len,
+						   pgfadviseStruct *pgfdv);
+static void	pgfadvise_values(const char *filename, pgfadviseStruct *pgfdv,
+							 Datum *values);
+static void	pgfincore_block_range(FunctionCallInfo fcinfo, int argno,
+								  int64 *startBlock, int64 *endBlock);
+static bool	pgfincore_segment_range(int64 startBlock, int64 endBlock,
+									unsigned int segno,
+									off_t *offset, off_t *len);
+
+Datum		pgfadvise_willneed_budget(PG_FUNCTION_ARGS);
 
 Datum		pgfadvise_loader(PG_FUNCTION_ARGS);
+Datum		pgfadvise_loader_map(PG_FUNCTION_ARGS);
+Datum		pgfadvise_loader_delta(PG_FUNCTION_ARGS);
+Datum		pgfadvise_loader_delta_map(PG_FUNCTION_ARGS);
+static Datum pgfadvise_loader_runs(FunctionCallInfo fcinfo,
+								   pgfincore_runs *runs, bool delta);
+static int	pgfadvise_loader_delta_file(char *filename,
+										bool willneed, bool dontneed,
+										pgfincore_runs *runs,
+										pgfincore_throttle *throttle,
+										pgfloaderStruct *pgfloader);
+Datum		pgfincore_diff(PG_FUNCTION_ARGS);
+Datum		pgfincore_diff_map(PG_FUNCTION_ARGS);
+static Datum pgfincore_diff_runs(FunctionCallInfo fcinfo,
+								 pgfincore_runs *runs);
+Datum		pgfincore_heat_trans(PG_FUNCTION_ARGS);
+Datum		pgfincore_heat_trans_map(PG_FUNCTION_ARGS);
+static Datum pgfincore_heat_trans_runs(FunctionCallInfo fcinfo,
+									   pgfincore_runs *runs);
+Datum		pgfincore_heat_final(PG_FUNCTION_ARGS);
+Datum		pgfincore_heat_databit(PG_FUNCTION_ARGS);
+Datum		pgfadvise_loader_heat(PG_FUNCTION_ARGS);
 static int	pgfadvise_loader_file(char *filename,
 								  bool willneed, bool dontneed,
-								  VarBit *databit,
+								  pgfincore_runs *runs,
+								  pgfincore_throttle *throttle,
 								  pgfloaderStruct *pgfloader);
+static void	pgfincore_throttle_init(pgfincore_throttle *throttle, int rate,
+									int64 minFree);
+static bool	pgfincore_throttle_wait(pgfincore_throttle *throttle, int64 bytes);
 
 Datum		pgfincore(PG_FUNCTION_ARGS);
-static int	pgfincore_file(char *filename, pgfincoreStruct *pgfncr);
+Datum		pgfincore_nolock(PG_FUNCTION_ARGS);
+static Datum pgfincore_srf(FunctionCallInfo fcinfo, bool nolock);
+Datum		pgfincore_database(PG_FUNCTION_ARGS);
+Datum		pgfincore_database_parallel(PG_FUNCTION_ARGS);
+Datum		pgfincore_advice_invalidate(PG_FUNCTION_ARGS);
+Datum		pgfincore_pin_stats(PG_FUNCTION_ARGS);
+static void	pgfincore_advice_inval(Datum arg, Oid relid);
+static Oid	pgfincore_extension_table(const char *relname);
+static void	pgfincore_ExecutorStart(QueryDesc *queryDesc, int eflags);
+static void	pgfincore_values(const char *filename, unsigned int segno,
+							 pgfincoreStruct *pgfncr, Datum *values,
+							 bool *nulls);
+Datum		pgfincore_batch(PG_FUNCTION_ARGS);
+Datum		pgfadvise_batch(PG_FUNCTION_ARGS);
+static Tuplestorestate *pgfincore_materialize(FunctionCallInfo fcinfo,
+											  TupleDesc *tupdesc);
+static List	*pgfincore_relation_list(ArrayType *relids, bool dependents);
+static void	pgfincore_fork_range(FunctionCallInfo fcinfo, int argno,
+								 ForkNumber *firstFork, ForkNumber *lastFork);
+Datum		pgfincore_estimate(PG_FUNCTION_ARGS);
+Datum		pgfincore_blocks(PG_FUNCTION_ARGS);
+Datum		pgfincore_ranges(PG_FUNCTION_ARGS);
+Datum		pgfadvise_loader_ranges(PG_FUNCTION_ARGS);
+Datum		pgfincore_double_buffered(PG_FUNCTION_ARGS);
+static BlockNumber *pgfincore_shared_blocks(Relation rel, ForkNumber forknum,
+											int *nblocks);
+static int	pgfincore_double_file(char *filename, const BlockNumber *blocks,
+								  int nblocks, bool evict,
+								  int64 *pagesDouble, int64 *pagesEvicted);
+static int	pgfincore_file_ranges(char *filename, bool getvector,
+								  off_t rangeOffset, off_t rangeLen,
+								  pgfincoreStruct *pgfncr,
+								  pgfincore_range_writer *ranges);
+static int	pgfincore_file(char *filename, bool getvector,
+						   off_t rangeOffset, off_t rangeLen,
+						   pgfincoreStruct *pgfncr);
+static bool	pgfincore_hard_pinned(dev_t dev, ino_t ino);
 
 Datum		pgfincore_drawer(PG_FUNCTION_ARGS);
+Datum		pgfincore_drawer_map(PG_FUNCTION_ARGS);
+
+Datum		pgfincore_map_in(PG_FUNCTION_ARGS);
+Datum		pgfincore_map_out(PG_FUNCTION_ARGS);
+Datum		pgfincore_map_from_varbit(PG_FUNCTION_ARGS);
+Datum		pgfincore_map_to_varbit(PG_FUNCTION_ARGS);
+static void	pgfincore_runs_bitmap(pgfincore_runs *runs,
+								  const bits8 *bits, int64 bitlen);
+static void	pgfincore_runs_map(pgfincore_runs *runs, const PgfincoreMap *map);
+static bool	pgfincore_runs_next(pgfincore_runs *runs,
+								int64 *start, int64 *end, bool *set);
+
+Datum		pgfincore_snapshot_database(PG_FUNCTION_ARGS);
+Datum		pgfincore_restore_database(PG_FUNCTION_ARGS);
+static char	*pgfincore_nolock_relpath(Oid relid, text *forkName);
+static bool	pgfincore_class_file(Oid relid, Form_pg_class classForm,
+								 Oid *spcOid, Oid *dbOid, Oid *relfilenode);
+static char	*pgfincore_class_relpath(Oid relid, Form_pg_class classForm,
+									 ForkNumber forknum, Oid *relfilenode);
+static void	pgfincore_segment_path(char *filename, const char *relationpath,
+								   unsigned int segno);
+static bool	pgfincore_snapshot_file(const char *path,
+									pgfincore_db_counters *counters,
+									TimestampTz deadline);
+static void	pgfincore_restore_file(const char *path, bool willneed,
+								   bool dontneed, pgfincore_throttle *throttle,
+								   pgfincore_db_counters *counters);
+
+#if PG_VERSION_NUM >= 120000
+PGDLLEXPORT void pgfincore_worker_main(Datum main_arg);
+static void	pgfincore_worker_register(void);
+static void	pgfincore_shmem_request(void);
+static void	pgfincore_shmem_startup(void);
+#endif
 
 #if PG_MAJOR_VERSION < 1600
-#define relpathpg(rel, forkName) \
-        relpathbackend((rel)->rd_node, (rel)->rd_backend, (forkname_to_number(text_to_cstring(forkName))))
+#define relpathpg_forknum(rel, forknum) \
+        relpathbackend((rel)->rd_node, (rel)->rd_backend, (forknum))
 #elif PG_MAJOR_VERSION < 1800
-#define relpathpg(rel, forkName) \
-        relpathbackend((rel)->rd_locator, (rel)->rd_backend, (forkname_to_number(text_to_cstring(forkName))))
+#define relpathpg_forknum(rel, forknum) \
+        relpathbackend((rel)->rd_locator, (rel)->rd_backend, (forknum))
 #else
+#define relpathpg_forknum(rel, forknum) \
+        relpathbackend((rel)->rd_locator, (rel)->rd_backend, (forknum)).str
+#endif
 #define relpathpg(rel, forkName) \
-        relpathbackend((rel)->rd_locator, (rel)->rd_backend, (forkname_to_number(text_to_cstring(forkName)))).str
+        relpathpg_forknum((rel), (forkname_to_number(text_to_cstring(forkName))))
+
+/*
+ * path of a fork from the pg_class entry, without opening the relation
+ */
+#if PG_MAJOR_VERSION < 1700
+#define pgfincore_relpath(dbOid, spcOid, relNumber, forknum) \
+        GetRelationPath((dbOid), (spcOid), (relNumber), InvalidBackendId, (forknum))
+#elif PG_MAJOR_VERSION < 1800
+#define pgfincore_relpath(dbOid, spcOid, relNumber, forknum) \
+        GetRelationPath((dbOid), (spcOid), (relNumber), INVALID_PROC_NUMBER, (forknum))
+#else
+#define pgfincore_relpath(dbOid, spcOid, relNumber, forknum) \
+        pstrdup(GetRelationPath((dbOid), (spcOid), (relNumber), INVALID_PROC_NUMBER, (forknum)).str)
+#endif
+
+#if PG_MAJOR_VERSION >= 1600
+#define RelationMapOidToFilenode(relid, shared) \
+        RelationMapOidToFilenumber((relid), (shared))
+#endif
+
+#if PG_VERSION_NUM < 120000
+#define table_open(relid, lockmode)		heap_open((relid), (lockmode))
+#define table_close(rel, lockmode)		heap_close((rel), (lockmode))
+#define pgfincore_class_oid(tuple)		HeapTupleGetOid(tuple)
+#else
+#define pgfincore_class_oid(tuple)		(((Form_pg_class) GETSTRUCT(tuple))->oid)
+#endif
+
+#if PG_VERSION_NUM < 100000
+#define pgfincore_wait_latch(timeout) \
+	WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, \
+			  (timeout))
+#elif PG_VERSION_NUM < 120000
+#define pgfincore_wait_latch(timeout) \
+	WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, \
+			  (timeout), PG_WAIT_EXTENSION)
+#else
+#define pgfincore_wait_latch(timeout) \
+	WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH, \
+			  (timeout), PG_WAIT_EXTENSION)
+#endif
+
+/*
+ * the buffer descriptors, of shared_buffers or of the local buffers
+ */
+#if PG_VERSION_NUM < 90500
+#define GetBufferDescriptor(id)			(&BufferDescriptors[(id)])
+#define GetLocalBufferDescriptor(id)	(&LocalBufferDescriptors[(id)])
+#endif
+
+#if PG_MAJOR_VERSION < 1600
+#define pgfincore_buftag_matches(tag, rel, forknum) \
+	(RelFileNodeEquals((tag).rnode, (rel)->rd_node) && \
+	 (tag).forkNum == (forknum))
+#else
+#define pgfincore_buftag_matches(tag, rel, forknum) \
+	(BufTagMatchesRelFileLocator(&(tag), &(rel)->rd_locator) && \
+	 BufTagGetForkNum(&(tag)) == (forknum))
+#endif
+
+#ifndef RELKIND_HAS_STORAGE
+#define RELKIND_HAS_STORAGE(relkind) \
+	((relkind) == RELKIND_RELATION || \
+	 (relkind) == RELKIND_INDEX || \
+	 (relkind) == RELKIND_SEQUENCE || \
+	 (relkind) == RELKIND_TOASTVALUE || \
+	 (relkind) == RELKIND_MATVIEW)
+#endif
+
+#if PG_VERSION_NUM < 150000
+#define pgfincore_relation_smgr(rel) \
+	(RelationOpenSmgr(rel), (rel)->rd_smgr)
+#else
+#define pgfincore_relation_smgr(rel)	RelationGetSmgr(rel)
+#endif
+
+/*
+ * Module load callback
+ */
+void
+_PG_init(void)
+{
+	DefineCustomBoolVariable("pgfincore.cachestat",
+							 "Use cachestat(2) when it is available.",
+							 "When no varbit is requested, pgfincore() gets its "
+							 "counters from cachestat(2) on Linux >= 6.5 instead "
+							 "of mincore(2), group_mem and group_dirty are then "
+							 "NULL.",
+							 &pgfincore_use_cachestat,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomEnumVariable("pgfincore.prefetch_engine",
+							 "Engine used to load pages: fadvise or io_uring.",
+							 "io_uring reads the pages asynchronously and reports "
+							 "their completion. It falls back to fadvise when "
+							 "pgfincore is built without liburing or io_uring is "
+							 "not available.",
+							 &pgfincore_prefetch_engine,
+							 PGF_ENGINE_FADVISE,
+							 pgfincore_engine_options,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("pgfincore.io_uring_queue_depth",
+							"Maximum number of reads in flight with the io_uring engine.",
+							NULL,
+							&pgfincore_io_uring_queue_depth,
+							32,
+							1,
+							4096,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+#if PG_VERSION_NUM >= 120000
+	DefineCustomStringVariable("pgfincore.databases",
+							   "Databases whose page cache is kept across restarts.",
+							   "A background worker is started for each database "
+							   "of the list when pgfincore is in "
+							   "shared_preload_libraries.",
+							   &pgfincore_databases,
+							   "",
+							   PGC_POSTMASTER,
+							   0,
+							   NULL,
+							   NULL,
+							   NULL);
+
+	DefineCustomIntVariable("pgfincore.snapshot_interval",
+							"Time between two snapshots of the page cache by the background worker.",
+							"0 takes a snapshot only when the server stops.",
+							&pgfincore_snapshot_interval,
+							300,
+							0,
+							INT_MAX / 1000,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pgfincore.restore_rate",
+							"Maximum rate, in MB/s, at which the background worker restores the page cache.",
+							"0 does not limit the rate.",
+							&pgfincore_restore_rate,
+							0,
+							0,
+							INT_MAX / 2048,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pgfincore.pin_interval",
+							"Time between two checks of the pinned relations by the background worker.",
+							"0 disables the refill of the pinned relations.",
+							&pgfincore_pin_interval,
+							10,
+							0,
+							INT_MAX / 1000,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pgfincore.max_pins",
+							"Maximum number of pinned relation forks with counters.",
+							NULL,
+							&pgfincore_max_pins,
+							1000,
+							1,
+							INT_MAX / 1024,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pgfincore.max_hard_segments",
+							"Maximum number of segments locked in memory by the hard pins.",
+							"A segment is locked only with a free slot in shared memory.",
+							&pgfincore_max_hard_segments,
+							10000,
+							1,
+							INT_MAX / 1024,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pgfincore.pin_budget",
+							"Memory the background workers may lock for the hard pins.",
+							"0 disables the hard pinning, the pins are soft.",
+							&pgfincore_pin_budget,
+							0,
+							0,
+							INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_MB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pgfincore.scan_prefetch_window",
+							"Size of the window loaded ahead of the sequential scans.",
+							"0 disables the scan-following prefetch.",
+							&pgfincore_scan_prefetch_window,
+							0,
+							0,
+							INT_MAX / 1024,
+							PGC_USERSET,
+							GUC_UNIT_MB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pgfincore.scan_prefetch_min_size",
+							"Minimum size of the relations whose sequential scans are prefetched.",
+							NULL,
+							&pgfincore_scan_prefetch_min_size,
+							1024,
+							0,
+							INT_MAX,
+							PGC_USERSET,
+							GUC_UNIT_MB,
+							NULL,
+							NULL,
+							NULL);
+#endif
+
+#if PG_VERSION_NUM >= 150000
+	MarkGUCPrefixReserved("pgfincore");
+#else
+	EmitWarningsOnPlaceholders("pgfincore");
+#endif
+
+#if PG_VERSION_NUM >= 120000
+	if (process_shared_preload_libraries_in_progress)
+	{
+		pgfincore_worker_register();
+
+		/* the counters of the pins */
+#if PG_VERSION_NUM >= 150000
+		prev_shmem_request_hook = shmem_request_hook;
+		shmem_request_hook = pgfincore_shmem_request;
+#else
+		pgfincore_shmem_request();
+#endif
+		prev_shmem_startup_hook = shmem_startup_hook;
+		shmem_startup_hook = pgfincore_shmem_startup;
+	}
 #endif
 
+	/* the access pattern policies of pgfincore_advice */
+	prev_ExecutorStart = ExecutorStart_hook;
+	ExecutorStart_hook = pgfincore_ExecutorStart;
+	CacheRegisterRelcacheCallback(pgfincore_advice_inval, (Datum) 0);
+}
+
 /*
  * pgsysconf
  * just output the actual system value for
@@ -192,12 +900,271 @@ pgsysconf(PG_FUNCTION_ARGS)
 	PG_RETURN_DATUM( HeapTupleGetDatum(tuple) );
 }
 
+#ifdef PGFINCORE_LIBURING
+/*
+ * io_uring prefetch engine
+ * The ranges are read into scratch buffers: the pages are in the page cache
+ * once a read completes, so unlike POSIX_FADV_WILLNEED we know how many
+ * pages have been loaded and when. Up to pgfincore.io_uring_queue_depth reads
+ * of PGF_URING_IO_SIZE are in flight.
+ */
+#define PGF_URING_IO_SIZE	(128 * 1024)
+
+typedef struct
+{
+	struct io_uring	ring;
+	int		depth;			/* entries of the ring, and buffers */
+	int		inflight;		/* reads queued or in flight */
+	int		pending;		/* reads queued, not submitted */
+	int		*freeslots;		/* stack of the free buffers */
+	int		nfree;
+	char	*buffers;
+	size_t	pageSize;
+	int64	pagesQueued;	/* pages requested */
+	int64	pagesCompleted;	/* pages read, at most pagesQueued */
+	int64	submits;		/* io_uring_submit calls */
+} pgfincore_uring;
+
+/*
+ * pgfincore_uring_init
+ * return false if io_uring can not be used, the caller falls back to
+ * posix_fadvise
+ */
+static bool
+pgfincore_uring_init(pgfincore_uring *u, size_t pageSize)
+{
+	int		ret;
+	int		i;
+
+	u->depth = pgfincore_io_uring_queue_depth;
+	ret = io_uring_queue_init(u->depth, &u->ring, 0);
+	if (ret < 0)
+	{
+		elog(DEBUG1, "pgfincore: io_uring is not available (%s), using posix_fadvise",
+			 strerror(-ret));
+		return false;
+	}
+
+	u->inflight			= 0;
+	u->pending			= 0;
+	u->pageSize			= pageSize;
+	u->pagesQueued		= 0;
+	u->pagesCompleted	= 0;
+	u->submits			= 0;
+	u->buffers	= (char *) palloc((Size) u->depth * PGF_URING_IO_SIZE);
+	u->freeslots = (int *) palloc(u->depth * sizeof(int));
+	for (i = 0; i < u->depth; i++)
+		u->freeslots[i] = i;
+	u->nfree = u->depth;
+
+	return true;
+}
+
+static void
+pgfincore_uring_submit(pgfincore_uring *u)
+{
+	int		ret;
+
+	if (u->pending == 0)
+		return;
+
+	do
+		ret = io_uring_submit(&u->ring);
+	while (ret == -EINTR);
+	if (ret < 0)
+		elog(ERROR, "pgfincore: io_uring_submit failed: %s", strerror(-ret));
+
+	u->pending = 0;
+	u->submits++;
+}
+
+/*
+ * pgfincore_uring_reap
+ * wait for a read to complete, then get the ones already completed
+ */
+static void
+pgfincore_uring_reap(pgfincore_uring *u)
+{
+	struct io_uring_cqe	*cqe;
+	bool	wait = true;
+	int		ret;
+
+	while (u->inflight > u->pending)
+	{
+		if (wait)
+			ret = io_uring_wait_cqe(&u->ring, &cqe);
+		else
+			ret = io_uring_peek_cqe(&u->ring, &cqe);
+		if (ret == -EINTR)
+			continue;
+		if (ret == -EAGAIN)
+			break;
+		if (ret < 0)
+			elog(ERROR, "pgfincore: io_uring_wait_cqe failed: %s", strerror(-ret));
+
+		if (cqe->res > 0)
+			u->pagesCompleted += (cqe->res + u->pageSize - 1) / u->pageSize;
+		else if (cqe->res < 0)
+			elog(DEBUG1, "pgfincore: io_uring read failed: %s",
+				 strerror(-cqe->res));
+		u->freeslots[u->nfree++] = (int) (intptr_t) io_uring_cqe_get_data(cqe);
+		io_uring_cqe_seen(&u->ring, cqe);
+		u->inflight--;
+		wait = false;
+	}
+}
+
+/*
+ * pgfincore_uring_read
+ * queue the reads of [offset, offset + len[ of fd
+ */
+static void
+pgfincore_uring_read(pgfincore_uring *u, int fd, off_t offset, off_t len)
+{
+	while (len > 0)
+	{
+		struct io_uring_sqe	*sqe;
+		size_t	n = Min(len, PGF_URING_IO_SIZE);
+		int		slot;
+
+		if (u->nfree == 0)
+		{
+			pgfincore_uring_submit(u);
+			pgfincore_uring_reap(u);
+		}
+		slot = u->freeslots[--u->nfree];
+
+		/* there are as many entries as buffers, one is free */
+		sqe = io_uring_get_sqe(&u->ring);
+		io_uring_prep_read(sqe, fd, u->buffers + (Size) slot * PGF_URING_IO_SIZE,
+						   n, offset);
+		io_uring_sqe_set_data(sqe, (void *) (intptr_t) slot);
+		u->inflight++;
+		u->pending++;
+		u->pagesQueued += (n + u->pageSize - 1) / u->pageSize;
+
+		offset	+= n;
+		len		-= n;
+	}
+	pgfincore_uring_submit(u);
+}
+
+/*
+ * pgfincore_uring_end
+ * wait for all the reads, they write in our buffers, then release the ring
+ */
+static void
+pgfincore_uring_end(pgfincore_uring *u)
+{
+	if (u->pending > 0)
+		(void) io_uring_submit(&u->ring);
+	u->pending = 0;
+	while (u->inflight > 0)
+		pgfincore_uring_reap(u);
+
+	io_uring_queue_exit(&u->ring);
+	pfree(u->buffers);
+	pfree(u->freeslots);
+
+	/* a read ending past the end of the file is rounded up to a page */
+	u->pagesCompleted = Min(u->pagesCompleted, u->pagesQueued);
+}
+
+/*
+ * pgfincore_uring_abort
+ * the cleanup of pgfincore_uring_end() on the error path, without raising
+ * another ERROR. The buffers are freed with the memory context.
+ */
+static void
+pgfincore_uring_abort(pgfincore_uring *u)
+{
+	struct io_uring_cqe	*cqe;
+	int		ret;
+
+	/* the reads not submitted are not in flight */
+	if (u->pending > 0)
+	{
+		ret = io_uring_submit(&u->ring);
+		u->inflight -= u->pending - Max(ret, 0);
+	}
+
+	/* the reads in flight still write in our buffers */
+	while (u->inflight > 0)
+	{
+		ret = io_uring_wait_cqe(&u->ring, &cqe);
+		if (ret == -EINTR)
+			continue;
+		if (ret < 0)
+			break;
+		io_uring_cqe_seen(&u->ring, cqe);
+		u->inflight--;
+	}
+
+	io_uring_queue_exit(&u->ring);
+}
+#endif							/* PGFINCORE_LIBURING */
+
+/*
+ * pgfincore_block_range
+ * read the optional block range, start_block and nblocks, from the
+ * arguments argno and argno + 1. endBlock is -1 without range.
+ */
+static void
+pgfincore_block_range(FunctionCallInfo fcinfo, int argno,
+					  int64 *startBlock, int64 *endBlock)
+{
+	*startBlock	= 0;
+	*endBlock	= -1;
+	if (PG_NARGS() <= argno + 1)
+		return;
+
+	if (PG_ARGISNULL(argno) || PG_ARGISNULL(argno + 1) ||
+		PG_GETARG_INT64(argno) < 0 || PG_GETARG_INT64(argno + 1) < 0)
+		elog(ERROR, "pgfincore: start_block and nblocks must not be negative");
+
+	*startBlock	= PG_GETARG_INT64(argno);
+	*endBlock	= *startBlock + Min(PG_GETARG_INT64(argno + 1),
+									PG_INT64_MAX - *startBlock);
+}
+
+/*
+ * pgfincore_segment_range
+ * the bytes of the segment segno within the block range
+ * [startBlock, endBlock[, mapped with RELSEG_SIZE and BLCKSZ.
+ * len is 0 for the whole segment, when endBlock is -1.
+ * Return false when the segment is past the range.
+ */
+static bool
+pgfincore_segment_range(int64 startBlock, int64 endBlock, unsigned int segno,
+						off_t *offset, off_t *len)
+{
+	int64	segStart = (int64) segno * RELSEG_SIZE;
+	int64	first;
+	int64	last;
+
+	*offset	= 0;
+	*len	= 0;
+	if (endBlock < 0)
+		return true;
+
+	first	= Max(startBlock, segStart);
+	last	= Min(endBlock, segStart + RELSEG_SIZE);
+	if (first >= last)
+		return false;
+
+	*offset	= (off_t) (first - segStart) * BLCKSZ;
+	*len	= (off_t) (last - first) * BLCKSZ;
+	return true;
+}
+
 #if defined(USE_POSIX_FADVISE)
 /*
  * pgfadvise_file
+ * advise len bytes from offset, or the whole file when len is 0
  */
 static int
-pgfadvise_file(char *filename, int advice, pgfadviseStruct *pgfdv)
+pgfadvise_file(char *filename, int advice, off_t offset, off_t len,
+			   pgfadviseStruct *pgfdv)
 {
 	/*
 	 * We use the AllocateFile(2) provided by PostgreSQL.  We're going to
@@ -208,6 +1175,12 @@ pgfadvise_file(char *filename, int advice, pgfadviseStruct *pgfdv)
 	int	fd;
 	struct stat st;
 	int	    adviceFlag;
+	TimestampTz	start;
+	off_t	rangeStart;
+	off_t	rangeEnd;
+#ifdef PGFINCORE_LIBURING
+	pgfincore_uring	uring;
+#endif
 
 	/*
 	 * OS Page size and Free pages
@@ -232,12 +1205,20 @@ pgfadvise_file(char *filename, int advice, pgfadviseStruct *pgfdv)
 	}
 
 	/*
-	 * the file size is used in the SRF to output the number of pages used by
-	 * the segment
+	 * the range to advise, rounded to OS pages and within the file
+	 */
+	rangeStart	= offset / pgfdv->pageSize * pgfdv->pageSize;
+	rangeEnd	= (len == 0) ? st.st_size : Min(offset + len, st.st_size);
+	if (rangeEnd < rangeStart)
+		rangeEnd = rangeStart;
+
+	/*
+	 * the size of the range is used in the SRF to output the number of pages
+	 * used by the segment
 	 */
-	pgfdv->filesize = st.st_size;
-	elog(DEBUG1, "pgfadvise: working on %s of %lld bytes",
-		 filename, (long long int) pgfdv->filesize);
+	pgfdv->filesize = rangeEnd - rangeStart;
+	elog(DEBUG1, "pgfadvise: working on %s, %lld bytes at offset %lld",
+		 filename, (long long int) pgfdv->filesize, (long long int) rangeStart);
 
 	/* FADVISE_WILLNEED */
 	if (advice == PGF_WILLNEED)
@@ -279,10 +1260,47 @@ pgfadvise_file(char *filename, int advice, pgfadviseStruct *pgfdv)
 		return 2;
 	}
 
+	pgfdv->engine			= "fadvise";
+	pgfdv->hasCompleted		= false;
+	pgfdv->pagesCompleted	= 0;
+	start = GetCurrentTimestamp();
+
+#ifdef PGFINCORE_LIBURING
+	/*
+	 * Read the file with io_uring if requested and available
+	 */
+	if (advice == PGF_WILLNEED &&
+		pgfincore_prefetch_engine == PGF_ENGINE_IO_URING &&
+		pgfincore_uring_init(&uring, pgfdv->pageSize))
+	{
+		PG_TRY();
+		{
+			pgfincore_uring_read(&uring, fd, rangeStart, rangeEnd - rangeStart);
+		}
+		PG_CATCH();
+		{
+			pgfincore_uring_abort(&uring);
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+		pgfincore_uring_end(&uring);
+
+		pgfdv->engine			= "io_uring";
+		pgfdv->hasCompleted		= true;
+		pgfdv->pagesCompleted	= uring.pagesCompleted;
+	}
+	else
+#endif
 	/*
-	 * Call posix_fadvise with the relevant advice on the file descriptor
+	 * Call posix_fadvise with the relevant advice on the file descriptor,
+	 * on the whole file (len 0) or on the range
 	 */
-	posix_fadvise(fd, 0, 0, adviceFlag);
+	if (len == 0)
+		posix_fadvise(fd, 0, 0, adviceFlag);
+	else if (rangeEnd > rangeStart)
+		posix_fadvise(fd, rangeStart, rangeEnd - rangeStart, adviceFlag);
+
+	pgfdv->elapsed = (double) (GetCurrentTimestamp() - start) / 1000.0;
 
 	/* close the file */
 	FreeFile(fp);
@@ -296,13 +1314,31 @@ pgfadvise_file(char *filename, int advice, pgfadviseStruct *pgfdv)
 }
 #else
 static int
-pgfadvise_file(char *filename, int advice, pgfadviseStruct	*pgfdv)
+pgfadvise_file(char *filename, int advice, off_t offset, off_t len,
+			   pgfadviseStruct *pgfdv)
 {
 	elog(ERROR, "POSIX_FADVISE UNSUPPORTED on your platform");
 	return 9;
 }
 #endif
 
+/*
+ * pgfadvise_values
+ * the PGFADVISE_COLS columns of a segment
+ */
+static void
+pgfadvise_values(const char *filename, pgfadviseStruct *pgfdv, Datum *values)
+{
+	/* Filename */
+	values[0] = CStringGetTextDatum( filename );
+	/* os page size */
+	values[1] = Int64GetDatum( (int64) pgfdv->pageSize );
+	/* number of pages used by segment */
+	values[2] = Int64GetDatum( (int64) ((pgfdv->filesize+pgfdv->pageSize-1)/pgfdv->pageSize) );
+	/* free page cache */
+	values[3] = Int64GetDatum( (int64) pgfdv->pagesFree );
+}
+
 /*
  * pgfadvise is a function that handle the process to have a sharelock
  * on the relation and to walk the segments.
@@ -312,6 +1348,35 @@ pgfadvise_file(char *filename, int advice, pgfadviseStruct	*pgfdv)
 PG_FUNCTION_INFO_V1(pgfadvise);
 Datum
 pgfadvise(PG_FUNCTION_ARGS)
+{
+	return pgfadvise_srf(fcinfo, false, false);
+}
+
+/*
+ * pgfadvise_nolock
+ * pgfadvise without any lock on the relation, see pgfincore_nolock_relpath
+ */
+PG_FUNCTION_INFO_V1(pgfadvise_nolock);
+Datum
+pgfadvise_nolock(PG_FUNCTION_ARGS)
+{
+	return pgfadvise_srf(fcinfo, false, true);
+}
+
+/*
+ * pgfadvise_prefetch
+ * pgfadvise WILLNEED with pgfincore.prefetch_engine, reporting the engine
+ * used, the pages read when the engine knows it and the time spent
+ */
+PG_FUNCTION_INFO_V1(pgfadvise_prefetch);
+Datum
+pgfadvise_prefetch(PG_FUNCTION_ARGS)
+{
+	return pgfadvise_srf(fcinfo, true, false);
+}
+
+static Datum
+pgfadvise_srf(FunctionCallInfo fcinfo, bool prefetch, bool nolock)
 {
 	/* SRF Stuff */
 	FuncCallContext *funcctx;
@@ -323,8 +1388,10 @@ pgfadvise(PG_FUNCTION_ARGS)
 	/* our return value, 0 for success */
 	int 			result;
 
-	/* The file we are working on */
+	/* The file we are working on, and its range */
 	char			filename[MAXPGPATH];
+	off_t			offset;
+	off_t			len;
 
 	/* stuff done only on the first call of the function */
 	if (SRF_IS_FIRSTCALL())
@@ -333,7 +1400,7 @@ pgfadvise(PG_FUNCTION_ARGS)
 
 		Oid			  relOid    = PG_GETARG_OID(0);
 		text		  *forkName = PG_GETARG_TEXT_P(1);
-		int			  advice	= PG_GETARG_INT32(2);
+		int			  advice	= prefetch ? PGF_WILLNEED : PG_GETARG_INT32(2);
 
 		/*
 		* Postgresql stuff to return a tuple
@@ -358,22 +1425,39 @@ pgfadvise(PG_FUNCTION_ARGS)
 		/* provide the tuple descriptor to the fonction structure */
         fctx->tupd = tupdesc;
 
-		/* open the current relation, accessShareLock */
-		// TODO use try_relation_open instead ?
-		fctx->rel = relation_open(relOid, AccessShareLock);
-
-		/* we get the common part of the filename of each segment of a relation */
-		fctx->relationpath = relpathpg(fctx->rel, forkName);
+		/*
+		 * open the current relation, accessShareLock, and get the common
+		 * part of the filename of each segment of a relation
+		 * Without lock, the path comes from the catalog
+		 */
+		if (nolock)
+		{
+			fctx->rel = NULL;
+			fctx->relationpath = pgfincore_nolock_relpath(relOid, forkName);
+		}
+		else
+		{
+			fctx->rel = relation_open(relOid, AccessShareLock);
+			fctx->relationpath = relpathpg(fctx->rel, forkName);
+		}
 
 		/* Here we keep track of current action in all calls */
 		fctx->advice = advice;
+		fctx->prefetch = prefetch;
 
-		/* segcount is used to get the next segment of the current relation */
-		fctx->segcount = 0;
+		/* the block range, if any */
+		pgfincore_block_range(fcinfo, 3, &fctx->startBlock, &fctx->endBlock);
+
+		/*
+		 * segcount is used to get the next segment of the current relation,
+		 * starting with the one of the first block
+		 */
+		fctx->segcount = fctx->startBlock / RELSEG_SIZE;
 
 		/* And finally we keep track of our initialization */
 		elog(DEBUG1, "pgfadvise: init done for %s, in fork %s",
-						fctx->relationpath, text_to_cstring(forkName));
+						fctx->relationpath ? fctx->relationpath : "(none)",
+						text_to_cstring(forkName));
 		funcctx->user_fctx = fctx;
 		MemoryContextSwitchTo(oldcontext);
 	}
@@ -386,7 +1470,9 @@ pgfadvise(PG_FUNCTION_ARGS)
 	 * If we are still looking the first segment
 	 * relationpath should not be suffixed
 	 */
-	if (fctx->segcount == 0)
+	if (fctx->relationpath == NULL)
+		filename[0] = '\0';
+	else if (fctx->segcount == 0)
 		snprintf(filename,
 		         MAXPGPATH,
 		         "%s",
@@ -403,9 +1489,177 @@ pgfadvise(PG_FUNCTION_ARGS)
 
 	/*
 	 * Call posix_fadvise with the advice, returning the structure
+	 * Past the block range, or without file, we are done
 	 */
 	pgfdv = (pgfadviseStruct *) palloc(sizeof(pgfadviseStruct));
-	result = pgfadvise_file(filename, fctx->advice, pgfdv);
+	if (fctx->relationpath != NULL &&
+		pgfincore_segment_range(fctx->startBlock, fctx->endBlock,
+								fctx->segcount, &offset, &len))
+		result = pgfadvise_file(filename, fctx->advice, offset, len, pgfdv);
+	else
+		result = 1;
+
+	/*
+	* When we have work with all segments of the current relation
+	* We exit from the SRF
+	* Else we build and return the tuple for this segment
+	*/
+	if (result)
+	{
+		elog(DEBUG1, "pgfadvise: closing %s", filename);
+		if (fctx->rel != NULL)
+			relation_close(fctx->rel, AccessShareLock);
+		pfree(fctx);
+		SRF_RETURN_DONE(funcctx);
+	}
+	else {
+		/*
+		* Postgresql stuff to return a tuple
+		*/
+		HeapTuple	tuple;
+		Datum		values[PGFADVISE_PREFETCH_COLS];
+		bool		nulls[PGFADVISE_PREFETCH_COLS];
+
+		/* initialize nulls array to build the tuple */
+		memset(nulls, 0, sizeof(nulls));
+
+		/* prepare the number of the next segment */
+		fctx->segcount++;
+
+		if (fctx->prefetch)
+		{
+			/* Filename */
+			values[0] = CStringGetTextDatum( filename );
+			/* engine used */
+			values[1] = CStringGetTextDatum( pgfdv->engine );
+			/* os page size */
+			values[2] = Int64GetDatum( (int64) pgfdv->pageSize );
+			/* number of pages used by segment */
+			values[3] = Int64GetDatum( (int64) ((pgfdv->filesize+pgfdv->pageSize-1)/pgfdv->pageSize) );
+			/* pages read, when the engine knows it */
+			values[4] = Int64GetDatum( pgfdv->pagesCompleted );
+			nulls[4] = !pgfdv->hasCompleted;
+			/* time spent */
+			values[5] = Float8GetDatum( pgfdv->elapsed );
+
+			tuple = heap_form_tuple(fctx->tupd, values, nulls);
+			SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+		}
+
+		pgfadvise_values(filename, pgfdv, values);
+
+		/* Build the result tuple. */
+		tuple = heap_form_tuple(fctx->tupd, values, nulls);
+
+		/* Ok, return results, and go for next call */
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+}
+
+/*
+ * pgfadvise_willneed_budget
+ * WILLNEED on all the segments of a relation within a budget: the
+ * submissions are paced to max_rate MB/s and stop once the free memory goes
+ * below min_free MB. The budget is shared by all the segments, the pages
+ * not loaded are reported as skipped.
+ */
+PG_FUNCTION_INFO_V1(pgfadvise_willneed_budget);
+Datum
+pgfadvise_willneed_budget(PG_FUNCTION_ARGS)
+{
+	/* SRF Stuff */
+	FuncCallContext			*funcctx;
+	pgfadvise_budget_fctx	*fctx;
+
+	/* our structure use to return values */
+	pgfloaderStruct	*pgfloader;
+
+	/* our return value, 0 for success */
+	int 			result;
+
+	/* The file we are working on */
+	char			filename[MAXPGPATH];
+
+	/* stuff done only on the first call of the function */
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+
+		Oid			  relOid    = PG_GETARG_OID(0);
+		text		  *forkName = PG_GETARG_TEXT_P(1);
+		int			  maxRate	= PG_GETARG_INT32(2);
+		int64		  minFree	= PG_GETARG_INT64(3);
+
+		/*
+		* Postgresql stuff to return a tuple
+		*/
+		TupleDesc	tupdesc;
+
+		if (maxRate < 0 || minFree < 0)
+			elog(ERROR, "pgfadvise_willneed: max_rate and min_free must not be negative");
+
+		/* create a function context for cross-call persistence */
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		/*
+		 * switch to memory context appropriate for multiple function calls
+		 */
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		/* allocate memory for user context */
+		fctx = (pgfadvise_budget_fctx *) palloc(sizeof(pgfadvise_budget_fctx));
+
+		/* Build a tuple descriptor for our result type */
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "pgfadvise_willneed: return type must be a row type");
+
+		/* provide the tuple descriptor to the fonction structure */
+		fctx->tupd = tupdesc;
+
+		/* open the current relation, accessShareLock */
+		fctx->rel = relation_open(relOid, AccessShareLock);
+
+		/* we get the common part of the filename of each segment of a relation */
+		fctx->relationpath = relpathpg(fctx->rel, forkName);
+
+		/* the budget is for the whole relation */
+		pgfincore_throttle_init(&fctx->throttle, maxRate, minFree);
+
+		/* segcount is used to get the next segment of the current relation */
+		fctx->segcount = 0;
+
+		elog(DEBUG1, "pgfadvise_willneed: init done for %s, in fork %s",
+						fctx->relationpath, text_to_cstring(forkName));
+		funcctx->user_fctx = fctx;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	/* After the first call, we recover our context */
+	funcctx = SRF_PERCALL_SETUP();
+	fctx = funcctx->user_fctx;
+
+	/*
+	 * If we are still looking the first segment
+	 * relationpath should not be suffixed
+	 */
+	if (fctx->segcount == 0)
+		snprintf(filename,
+		         MAXPGPATH,
+		         "%s",
+		         fctx->relationpath);
+	else
+		snprintf(filename,
+		         MAXPGPATH,
+		         "%s.%u",
+		         fctx->relationpath,
+		         fctx->segcount);
+
+	/*
+	 * Load the whole file within the budget, returning the structure
+	 */
+	pgfloader = (pgfloaderStruct *) palloc(sizeof(pgfloaderStruct));
+	result = pgfadvise_loader_file(filename, true, false, NULL,
+								   &fctx->throttle, pgfloader);
 
 	/*
 	* When we have work with all segments of the current relation
@@ -414,7 +1668,7 @@ pgfadvise(PG_FUNCTION_ARGS)
 	*/
 	if (result)
 	{
-		elog(DEBUG1, "pgfadvise: closing %s", fctx->relationpath);
+		elog(DEBUG1, "pgfadvise_willneed: closing %s", fctx->relationpath);
 		relation_close(fctx->rel, AccessShareLock);
 		pfree(fctx);
 		SRF_RETURN_DONE(funcctx);
@@ -424,8 +1678,8 @@ pgfadvise(PG_FUNCTION_ARGS)
 		* Postgresql stuff to return a tuple
 		*/
 		HeapTuple	tuple;
-		Datum		values[PGFADVISE_COLS];
-		bool		nulls[PGFADVISE_COLS];
+		Datum		values[PGFADVISE_BUDGET_COLS];
+		bool		nulls[PGFADVISE_BUDGET_COLS];
 
 		/* initialize nulls array to build the tuple */
 		memset(nulls, 0, sizeof(nulls));
@@ -436,11 +1690,15 @@ pgfadvise(PG_FUNCTION_ARGS)
 		/* Filename */
 		values[0] = CStringGetTextDatum( filename );
 		/* os page size */
-		values[1] = Int64GetDatum( (int64) pgfdv->pageSize );
+		values[1] = Int64GetDatum( (int64) pgfloader->pageSize );
 		/* number of pages used by segment */
-		values[2] = Int64GetDatum( (int64) ((pgfdv->filesize+pgfdv->pageSize-1)/pgfdv->pageSize) );
+		values[2] = Int64GetDatum( (int64) pgfloader->relPages );
 		/* free page cache */
-		values[3] = Int64GetDatum( (int64) pgfdv->pagesFree );
+		values[3] = Int64GetDatum( (int64) pgfloader->pagesFree );
+		/* pages loaded */
+		values[4] = Int64GetDatum( (int64) pgfloader->pagesLoaded );
+		/* pages not loaded, budget reached */
+		values[5] = Int64GetDatum( (int64) pgfloader->pagesSkipped );
 		/* Build the result tuple. */
 		tuple = heap_form_tuple(fctx->tupd, values, nulls);
 
@@ -449,19 +1707,331 @@ pgfadvise(PG_FUNCTION_ARGS)
 	}
 }
 
+/*
+ * pgfincore_bitmap_word
+ * read 8 bytes of a bit string as one word, first bit of the string in the
+ * highest bit of the word. Bytes past the end of the string are read as 0.
+ */
+static inline uint64
+pgfincore_bitmap_word(const bits8 *bits, int64 nbytes, int64 byteoff)
+{
+	uint64	w = 0;
+	int		i;
+
+	if (byteoff + 8 <= nbytes)
+	{
+		for (i = 0; i < 8; i++)
+			w = (w << BITS_PER_BYTE) | bits[byteoff + i];
+	}
+	else
+	{
+		for (i = 0; i < 8; i++)
+			w = (w << BITS_PER_BYTE) |
+				(byteoff + i < nbytes ? bits[byteoff + i] : 0);
+	}
+	return w;
+}
+
+/*
+ * pgfincore_clz64
+ * number of leading zero bits of a non zero word
+ */
+static inline int
+pgfincore_clz64(uint64 w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_clzll(w);
+#else
+	int		n = 0;
+
+	while (!(w & UINT64CONST(0x8000000000000000)))
+	{
+		w <<= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/*
+ * pgfincore_bitmap_next
+ * return the position of the first bit equal to 'value' at or after 'start',
+ * or bitlen if there is none. The bit string is walked a word at a time.
+ */
+static int64
+pgfincore_bitmap_next(const bits8 *bits, int64 bitlen, int64 start, bool value)
+{
+	int64	nbytes = (bitlen + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+	int64	pos = start;
+
+	while (pos < bitlen)
+	{
+		int		shift = pos % BITS_PER_BYTE;
+		uint64	w = pgfincore_bitmap_word(bits, nbytes, pos / BITS_PER_BYTE);
+
+		if (!value)
+			w = ~w;
+		/* forget the bits before pos */
+		w <<= shift;
+		if (w != 0)
+			return Min(pos + pgfincore_clz64(w), bitlen);
+		pos += 64 - shift;
+	}
+	return bitlen;
+}
+
+/*
+ * pgfincore_bitmap_set
+ * set the bits [start, end[ of a bit string
+ */
+static void
+pgfincore_bitmap_set(bits8 *bits, int64 start, int64 end)
+{
+	for (; start < end && start % BITS_PER_BYTE != 0; start++)
+		bits[start / BITS_PER_BYTE] |= HIGHBIT >> (start % BITS_PER_BYTE);
+	if (end - start >= BITS_PER_BYTE)
+	{
+		memset(bits + start / BITS_PER_BYTE, 0xff,
+			   (end - start) / BITS_PER_BYTE);
+		start += (end - start) / BITS_PER_BYTE * BITS_PER_BYTE;
+	}
+	for (; start < end; start++)
+		bits[start / BITS_PER_BYTE] |= HIGHBIT >> (start % BITS_PER_BYTE);
+}
+
+/*
+ * pgfincore_map_put
+ * append v as a varint, return the next position
+ */
+static inline uint8 *
+pgfincore_map_put(uint8 *p, uint64 v)
+{
+	while (v >= 0x80)
+	{
+		*p++ = (uint8) (v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (uint8) v;
+	return p;
+}
+
+/*
+ * pgfincore_map_get
+ * read a varint, return the next position or NULL if it is truncated
+ */
+static inline const uint8 *
+pgfincore_map_get(const uint8 *p, const uint8 *end, uint64 *v)
+{
+	uint64	r = 0;
+	int		shift;
+
+	for (shift = 0; p < end && shift < 64; shift += 7)
+	{
+		uint8	b = *p++;
+
+		r |= (uint64) (b & 0x7f) << shift;
+		if (!(b & 0x80))
+		{
+			*v = r;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * pgfincore_map_len
+ * bytes used by v as a varint
+ */
+static inline int
+pgfincore_map_len(uint64 v)
+{
+	int		len = 1;
+
+	while (v >= 0x80)
+	{
+		v >>= 7;
+		len++;
+	}
+	return len;
+}
+
+/*
+ * pgfincore_runs_bitmap
+ * iterate on the runs of a bit string. Without bit string, a single run of
+ * bitlen set bits is returned: all the pages.
+ */
+static void
+pgfincore_runs_bitmap(pgfincore_runs *runs, const bits8 *bits, int64 bitlen)
+{
+	runs->bitlen	= bitlen;
+	runs->pos		= 0;
+	runs->bits		= bits;
+	runs->p			= NULL;
+	runs->end		= NULL;
+	runs->set		= false;
+}
+
+static void
+pgfincore_runs_map(pgfincore_runs *runs, const PgfincoreMap *map)
+{
+	const uint8	*end = PGF_MAP_END(map);
+	const uint8	*p = map->data;
+	uint64		bitlen;
+	uint8		format;
+
+	if (p >= end)
+		elog(ERROR, "pgfincore_map: corrupted value");
+	format = *p++;
+	p = pgfincore_map_get(p, end, &bitlen);
+	if (p == NULL || bitlen > PG_INT64_MAX)
+		elog(ERROR, "pgfincore_map: corrupted value");
+
+	pgfincore_runs_bitmap(runs, NULL, (int64) bitlen);
+	if (format == PGF_MAP_BITMAP)
+	{
+		if (end - p < (bitlen + BITS_PER_BYTE - 1) / BITS_PER_BYTE)
+			elog(ERROR, "pgfincore_map: corrupted value");
+		runs->bits = p;
+	}
+	else if (format == PGF_MAP_RUNS)
+	{
+		runs->p		= p;
+		runs->end	= end;
+	}
+	else
+		elog(ERROR, "pgfincore_map: corrupted value");
+}
+
+/*
+ * pgfincore_runs_next
+ * get the next run: [start, end[ with all bits in state set.
+ * Return false once the whole bit string has been read.
+ */
+static bool
+pgfincore_runs_next(pgfincore_runs *runs, int64 *start, int64 *end, bool *set)
+{
+	if (runs->pos >= runs->bitlen)
+		return false;
+
+	*start = runs->pos;
+	if (runs->bits != NULL)
+	{
+		*set = IS_HIGHBIT_SET(runs->bits[runs->pos / BITS_PER_BYTE] <<
+							  (runs->pos % BITS_PER_BYTE));
+		*end = pgfincore_bitmap_next(runs->bits, runs->bitlen,
+									 runs->pos, !*set);
+	}
+	else if (runs->p == NULL)
+	{
+		/* no bit string nor runs: all the pages */
+		*set = true;
+		*end = runs->bitlen;
+	}
+	else
+	{
+		uint64	len;
+
+		/* the first run of unset bits may be empty */
+		do
+		{
+			runs->p = pgfincore_map_get(runs->p, runs->end, &len);
+			if (runs->p == NULL || len > runs->bitlen - runs->pos)
+				elog(ERROR, "pgfincore_map: corrupted value");
+			*set = runs->set;
+			runs->set = !runs->set;
+		} while (len == 0);
+		*end = runs->pos + len;
+	}
+	runs->pos = *end;
+	return true;
+}
+
+/*
+ * pgfincore_throttle_init
+ * rate in MB/s, 0 for no limit
+ * minFree in MB, 0 for no floor
+ */
+static void
+pgfincore_throttle_init(pgfincore_throttle *throttle, int rate, int64 minFree)
+{
+	throttle->rate		= (int64) rate * 1024 * 1024;
+	throttle->minFree	= Min(minFree, PG_INT64_MAX / (1024 * 1024)) * 1024 * 1024;
+	throttle->bytes		= 0;
+	throttle->start		= GetCurrentTimestamp();
+}
+
+/*
+ * pgfincore_throttle_wait
+ * called before advising bytes: sleep as long as the bytes already advised
+ * are ahead of the rate, then check the free memory and account bytes.
+ * Return false when the floor is reached or when the background worker is
+ * asked to stop, nothing more should be loaded.
+ */
+static bool
+pgfincore_throttle_wait(pgfincore_throttle *throttle, int64 bytes)
+{
+	if (throttle == NULL)
+		return !pgfincore_got_sigterm;
+
+	while (throttle->rate > 0 && !pgfincore_got_sigterm)
+	{
+		long	secs;
+		int		usecs;
+		int64	ahead;
+
+		TimestampDifference(throttle->start, GetCurrentTimestamp(),
+							&secs, &usecs);
+		ahead = throttle->bytes * 1000 / throttle->rate -
+			((int64) secs * 1000 + usecs / 1000);
+		if (ahead <= 0)
+			break;
+
+		(void) pgfincore_wait_latch(Min(ahead, 1000));
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+	}
+	if (pgfincore_got_sigterm)
+		return false;
+
+	if (throttle->minFree > 0 &&
+		(int64) sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE) < throttle->minFree)
+	{
+		elog(DEBUG1, "pgfincore: free memory below %lld bytes, stop loading",
+			 (long long int) throttle->minFree);
+		return false;
+	}
+
+	throttle->bytes += bytes;
+	return true;
+}
+
 #if defined(USE_POSIX_FADVISE)
 /*
- * pgfadvise_file
+ * pgfadvise_loader_file
+ * each run of contiguous bits in the same state is handled with a single
+ * posix_fadvise call covering the whole run. Without runs, the whole file
+ * is loaded.
+ * With a throttle, the runs to load are cut in chunks paced to its rate.
+ * Once its free memory floor is reached, the pages still to load are only
+ * counted as skipped.
  */
 static int
 pgfadvise_loader_file(char *filename,
-					  bool willneed, bool dontneed, VarBit *databit,
+					  bool willneed, bool dontneed,
+					  pgfincore_runs *runs,
+					  pgfincore_throttle *throttle,
 					  pgfloaderStruct *pgfloader)
 {
-	bits8	*sp;
-	int		bitlen;
-	bits8	x;
-	int		i, k;
+	int64	pos, end;
+	int64	chunk;
+	bool	set;
+	bool	stop = false;
+	pgfincore_runs	all;
+#ifdef PGFINCORE_LIBURING
+	pgfincore_uring	uring;
+	bool	use_uring = false;
+#endif
 
 	/*
 	 * We use the AllocateFile(2) provided by PostgreSQL.  We're going to
@@ -484,6 +2054,8 @@ pgfadvise_loader_file(char *filename,
 	 */
 	pgfloader->pagesLoaded		= 0;
 	pgfloader->pagesUnloaded	= 0;
+	pgfloader->pagesSkipped		= 0;
+	pgfloader->syscalls			= 0;
 
 	/*
 	 * Fopen and fstat file
@@ -504,68 +2076,97 @@ pgfadvise_loader_file(char *filename,
 
 	elog(DEBUG1, "pgfadvise_loader: working on %s", filename);
 
-	bitlen = VARBITLEN(databit);
-	sp = VARBITS(databit);
-	for (i = 0; i < bitlen - BITS_PER_BYTE; i += BITS_PER_BYTE, sp++)
+	pgfloader->relPages = (st.st_size + pgfloader->pageSize - 1) /
+		pgfloader->pageSize;
+	if (runs == NULL)
 	{
-		x = *sp;
-		/*  Is this bit set ? */
-		for (k = 0; k < BITS_PER_BYTE; k++)
+		pgfincore_runs_bitmap(&all, NULL, (int64) pgfloader->relPages);
+		runs = &all;
+	}
+
+	/*
+	 * when throttled, the runs to load are cut in about 100ms of I/O, with
+	 * only a floor they are cut by windows so the free memory is checked
+	 * often enough
+	 */
+	chunk = PG_INT64_MAX;
+	if (throttle != NULL && throttle->rate > 0)
+		chunk = Max(throttle->rate / 10 / pgfloader->pageSize, 1);
+	else if (throttle != NULL && throttle->minFree > 0)
+		chunk = PGF_WINDOW_SIZE / pgfloader->pageSize;
+
+#ifdef PGFINCORE_LIBURING
+	/* the pages to load are read with io_uring if requested and available */
+	if (willneed && pgfincore_prefetch_engine == PGF_ENGINE_IO_URING)
+		use_uring = pgfincore_uring_init(&uring, pgfloader->pageSize);
+
+	PG_TRY();
+	{
+#endif
+	while (pgfincore_runs_next(runs, &pos, &end, &set))
+	{
+		if (set && willneed)
 		{
-			if (IS_HIGHBIT_SET(x))
+			for (; pos < end; pos += Min(chunk, end - pos))
 			{
-				if (willneed)
+				int64	npages = Min(chunk, end - pos);
+
+				if (!stop)
+					stop = !pgfincore_throttle_wait(throttle,
+													npages * pgfloader->pageSize);
+				if (stop)
+				{
+					pgfloader->pagesSkipped += end - pos;
+					break;
+				}
+#ifdef PGFINCORE_LIBURING
+				if (use_uring)
+					pgfincore_uring_read(&uring, fd,
+										 (off_t) pos * pgfloader->pageSize,
+										 (off_t) npages * pgfloader->pageSize);
+				else
+#endif
 				{
 					(void) posix_fadvise(fd,
-					                     ((i+k) * pgfloader->pageSize),
-					                     pgfloader->pageSize,
+					                     (off_t) pos * pgfloader->pageSize,
+					                     (off_t) npages * pgfloader->pageSize,
 					                     POSIX_FADV_WILLNEED);
-					pgfloader->pagesLoaded++;
+					pgfloader->syscalls++;
 				}
+				pgfloader->pagesLoaded += npages;
 			}
-			else if (dontneed)
-			{
-				(void) posix_fadvise(fd,
-				                     ((i+k) * pgfloader->pageSize),
-				                     pgfloader->pageSize,
-				                     POSIX_FADV_DONTNEED);
-				pgfloader->pagesUnloaded++;
-			}
-
-			x <<= 1;
+		}
+		else if (!set && dontneed)
+		{
+			(void) posix_fadvise(fd,
+			                     (off_t) pos * pgfloader->pageSize,
+			                     (off_t) (end - pos) * pgfloader->pageSize,
+			                     POSIX_FADV_DONTNEED);
+			pgfloader->pagesUnloaded += end - pos;
+			pgfloader->syscalls++;
 		}
 	}
-	/*
-	 * XXX this copy/paste of code to finnish to walk the bits is not pretty
-	 */
-	if (i < bitlen)
+#ifdef PGFINCORE_LIBURING
+	}
+	PG_CATCH();
 	{
-		/* print the last partial byte */
-		x = *sp;
-		for (k = i; k < bitlen; k++)
-		{
-			if (IS_HIGHBIT_SET(x))
-			{
-				if (willneed)
-				{
-					(void) posix_fadvise(fd,
-					                     (k * pgfloader->pageSize),
-					                     pgfloader->pageSize,
-					                     POSIX_FADV_WILLNEED);
-					pgfloader->pagesLoaded++;
-				}
-			}
-			else if (dontneed)
-			{
-				(void) posix_fadvise(fd,
-				                     (k * pgfloader->pageSize),
-				                     pgfloader->pageSize,
-				                     POSIX_FADV_DONTNEED);
-				pgfloader->pagesUnloaded++;
-			}
-			x <<= 1;
-		}
+		if (use_uring)
+			pgfincore_uring_abort(&uring);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	/* the pages actually read, and the submissions */
+	if (use_uring)
+	{
+		pgfincore_uring_end(&uring);
+		pgfloader->pagesLoaded = uring.pagesCompleted;
+		pgfloader->syscalls += uring.submits;
 	}
+#endif
+	elog(DEBUG1, "pgfadvise_loader: %lld posix_fadvise calls on %s",
+	     (long long int) pgfloader->syscalls, filename);
+
 	FreeFile(fp);
 
 	/*
@@ -578,7 +2179,9 @@ pgfadvise_loader_file(char *filename,
 #else
 static int
 pgfadvise_loader_file(char *filename,
-					  bool willneed, bool dontneed, VarBit *databit,
+					  bool willneed, bool dontneed,
+					  pgfincore_runs *runs,
+					  pgfincore_throttle *throttle,
 					  pgfloaderStruct *pgfloader)
 {
 	elog(ERROR, "POSIX_FADVISE UNSUPPORTED on your platform");
@@ -595,17 +2198,54 @@ pgfadvise_loader_file(char *filename,
 PG_FUNCTION_INFO_V1(pgfadvise_loader);
 Datum
 pgfadvise_loader(PG_FUNCTION_ARGS)
+{
+	VarBit			*databit;
+	pgfincore_runs	runs;
+
+	if (PG_ARGISNULL(5))
+		elog(ERROR, "pgfadvise_loader: databit argument shouldn't be NULL");
+
+	databit = PG_GETARG_VARBIT_P(5);
+	pgfincore_runs_bitmap(&runs, VARBITS(databit), VARBITLEN(databit));
+
+	return pgfadvise_loader_runs(fcinfo, &runs, false);
+}
+
+/*
+ * pgfadvise_loader_map
+ * same as pgfadvise_loader with a pgfincore_map, the runs are read directly
+ */
+PG_FUNCTION_INFO_V1(pgfadvise_loader_map);
+Datum
+pgfadvise_loader_map(PG_FUNCTION_ARGS)
+{
+	pgfincore_runs	runs;
+
+	if (PG_ARGISNULL(5))
+		elog(ERROR, "pgfadvise_loader: map argument shouldn't be NULL");
+
+	pgfincore_runs_map(&runs, PG_GETARG_PGFINCORE_MAP_P(5));
+
+	return pgfadvise_loader_runs(fcinfo, &runs, false);
+}
+
+static Datum
+pgfadvise_loader_runs(FunctionCallInfo fcinfo, pgfincore_runs *runs,
+					  bool delta)
 {
 	Oid       relOid        = PG_GETARG_OID(0);
 	text      *forkName     = PG_GETARG_TEXT_P(1);
 	int       segmentNumber = PG_GETARG_INT32(2);
 	bool      willneed      = PG_GETARG_BOOL(3);
 	bool      dontneed      = PG_GETARG_BOOL(4);
-	VarBit    *databit;
 
 	/* our structure use to return values */
 	pgfloaderStruct	*pgfloader;
 
+	/* the budget, MB/s and free memory floor in MB, when provided */
+	pgfincore_throttle	throttle;
+	bool				throttled = PG_NARGS() > 7;
+
 	Relation  rel;
 	char      *relationpath;
 	char      filename[MAXPGPATH];
@@ -621,11 +2261,6 @@ pgfadvise_loader(PG_FUNCTION_ARGS)
 	Datum		values[PGFADVISE_LOADER_COLS];
 	bool		nulls[PGFADVISE_LOADER_COLS];
 
-	if (PG_ARGISNULL(5))
-		elog(ERROR, "pgfadvise_loader: databit argument shouldn't be NULL");
-
-        databit		= PG_GETARG_VARBIT_P(5);
-
 	/* initialize nulls array to build the tuple */
 	memset(nulls, 0, sizeof(nulls));
 
@@ -662,13 +2297,30 @@ pgfadvise_loader(PG_FUNCTION_ARGS)
 	 */
 	relation_close(rel, AccessShareLock);
 
+	if (throttled)
+	{
+		if (PG_ARGISNULL(6) || PG_ARGISNULL(7) ||
+			PG_GETARG_INT32(6) < 0 || PG_GETARG_INT64(7) < 0)
+			elog(ERROR, "pgfadvise_loader: max_rate and min_free must not be negative");
+		pgfincore_throttle_init(&throttle, PG_GETARG_INT32(6),
+								PG_GETARG_INT64(7));
+	}
+
 	/*
-	 * Call pgfadvise_loader with the varbit
+	 * Call pgfadvise_loader with the runs, or with the runs which differ
+	 * from the page cache
 	 */
 	pgfloader = (pgfloaderStruct *) palloc(sizeof(pgfloaderStruct));
-	result = pgfadvise_loader_file(filename,
-								   willneed, dontneed, databit,
-								   pgfloader);
+	if (delta)
+		result = pgfadvise_loader_delta_file(filename,
+											 willneed, dontneed, runs,
+											 throttled ? &throttle : NULL,
+											 pgfloader);
+	else
+		result = pgfadvise_loader_file(filename,
+									   willneed, dontneed, runs,
+									   throttled ? &throttle : NULL,
+									   pgfloader);
 	if (result != 0)
 		elog(ERROR, "Can't read file %s, fork(%s)",
 					filename, text_to_cstring(forkName));
@@ -682,6 +2334,10 @@ pgfadvise_loader(PG_FUNCTION_ARGS)
 	values[3] = Int64GetDatum( pgfloader->pagesLoaded );
 	/* pages unloaded  */
 	values[4] = Int64GetDatum( pgfloader->pagesUnloaded );
+	/* posix_fadvise calls */
+	values[5] = Int64GetDatum( pgfloader->syscalls );
+	/* pages not loaded, budget reached */
+	values[6] = Int64GetDatum( pgfloader->pagesSkipped );
 
 	/* Build and return the result tuple. */
 	tuple = heap_form_tuple(tupdesc, values, nulls);
@@ -689,428 +2345,5599 @@ pgfadvise_loader(PG_FUNCTION_ARGS)
 }
 
 /*
- * pgfincore_file handle the mmaping, mincore process (and access file, etc.)
+ * pgfincore_delta
+ * the pages to load and to unload for a segment to go from its live state to
+ * a snapshot: load has the pages of the snapshot out of cache, unload the
+ * pages in cache out of the snapshot. The pages past the end of the snapshot
+ * do not change. load and unload have the bit length of live.
  */
-static int
-pgfincore_file(char *filename, pgfincoreStruct *pgfncr)
+static void
+pgfincore_delta(pgfincore_runs *snapshot, const VarBit *live,
+				VarBit **load, VarBit **unload,
+				int64 *pagesLoad, int64 *pagesUnload)
 {
-	int		flag=1;
-	int		flag_dirty=1;
-
-	int		len, bitlen;
-	bits8	*r;
-	bits8	x = 0;
-	register int64 pageIndex;
-
+	int64	bitlen = VARBITLEN(live);
+	int64	covered = Min(snapshot->bitlen, bitlen);
+	int64	nbytes = (covered + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+	int64	start, end;
+	bool	set;
+	int64	i;
+	bits8	*s;
+	const bits8	*l;
+	bits8	*u;
+
+	*load = (VarBit *) palloc0(VARBITTOTALLEN(bitlen));
+	SET_VARSIZE(*load, VARBITTOTALLEN(bitlen));
+	VARBITLEN(*load) = bitlen;
+	*unload = (VarBit *) palloc0(VARBITTOTALLEN(bitlen));
+	SET_VARSIZE(*unload, VARBITTOTALLEN(bitlen));
+	VARBITLEN(*unload) = bitlen;
+	*pagesLoad = 0;
+	*pagesUnload = 0;
+
+	/* the snapshot, as a bit string, is built in load */
+	s = VARBITS(*load);
+	while (pgfincore_runs_next(snapshot, &start, &end, &set))
+	{
+		if (set)
+			pgfincore_bitmap_set(s, start, Min(end, covered));
+	}
 
-	/*
-	 * We use the AllocateFile(2) provided by PostgreSQL.  We're going to
-	 * close it ourselves even if PostgreSQL close it anyway at transaction
-	 * end.
-	 */
-	FILE	*fp;
-	int	fd;
-	struct stat st;
+	l = VARBITS(live);
+	u = VARBITS(*unload);
+	for (i = 0; i < nbytes; i++)
+	{
+		bits8	mask = 0xff;
 
-#ifndef HAVE_FINCORE
-	void 		  *pa  = (char *) 0;
-#endif
-	unsigned char *vec = (unsigned char *) 0;
+		if (i == nbytes - 1 && covered % BITS_PER_BYTE != 0)
+			mask = (bits8) (0xff << (BITS_PER_BYTE - covered % BITS_PER_BYTE));
 
-	/*
-	 * OS Page size
-	 */
-	pgfncr->pageSize  = sysconf(_SC_PAGESIZE);
+		u[i] = ~s[i] & l[i] & mask;
+		s[i] = s[i] & ~l[i] & mask;
+		*pagesLoad += pgfincore_pack_popcount64(s[i]);
+		*pagesUnload += pgfincore_pack_popcount64(u[i]);
+	}
+}
 
-	/*
-	 * Initialize counters
-	 */
-	pgfncr->pages_mem		= 0;
-	pgfncr->group_mem		= 0;
-	pgfncr->pages_dirty		= 0;
-	pgfncr->group_dirty		= 0;
-	pgfncr->rel_os_pages	= 0;
+/*
+ * pgfadvise_loader_delta_file
+ * same as pgfadvise_loader_file, with only the pages whose state differs
+ * from the snapshot in runs: the pages to load, then the pages to unload
+ */
+static int
+pgfadvise_loader_delta_file(char *filename,
+							bool willneed, bool dontneed,
+							pgfincore_runs *runs,
+							pgfincore_throttle *throttle,
+							pgfloaderStruct *pgfloader)
+{
+	pgfincoreStruct	pgfncr;
+	pgfloaderStruct	pass;
+	pgfincore_runs	delta;
+	VarBit			*load;
+	VarBit			*unload;
+	int64			pagesLoad;
+	int64			pagesUnload;
+	int64			i;
+	int				result;
+
+	result = pgfincore_file(filename, true, 0, 0, &pgfncr);
+	if (result != 0)
+		return result;
 
-	/*
-	 * Fopen and fstat file
-	 * fd will be provided to posix_fadvise
-	 * if there is no file, just return 1, it is expected to leave the SRF
-	 */
-	fp = AllocateFile(filename, "rb");
-	if (fp == NULL)
-                return 1;
+	memset(pgfloader, 0, sizeof(pgfloaderStruct));
+	pgfloader->pageSize		= pgfncr.pageSize;
+	pgfloader->pagesFree	= pgfncr.pagesFree;
+	pgfloader->relPages		= pgfncr.rel_os_pages;
+	if (pgfncr.databit == NULL)
+		return 0;
 
-	fd = fileno(fp);
+	pgfincore_delta(runs, pgfncr.databit, &load, &unload,
+					&pagesLoad, &pagesUnload);
+	elog(DEBUG1, "pgfadvise_loader: %lld pages to load and %lld to unload on %s",
+		 (long long int) pagesLoad, (long long int) pagesUnload, filename);
 
-	if (fstat(fd, &st) == -1)
+	if (willneed && pagesLoad > 0)
 	{
-		FreeFile(fp);
-		elog(ERROR, "Can not stat object file : %s",
-		     filename);
-		return 2;
+		pgfincore_runs_bitmap(&delta, VARBITS(load), VARBITLEN(load));
+		result = pgfadvise_loader_file(filename, true, false, &delta,
+									   throttle, &pass);
+		if (result != 0)
+			return result;
+		pgfloader->pagesLoaded	= pass.pagesLoaded;
+		pgfloader->pagesSkipped	= pass.pagesSkipped;
+		pgfloader->syscalls		= pass.syscalls;
+		pgfloader->pagesFree	= pass.pagesFree;
 	}
 
-	/*
-	* if file ok
-	* then process
-	*/
-	if (st.st_size != 0)
+	/* the loader unloads the unset bits: the pages to keep are set */
+	if (dontneed && pagesUnload > 0)
 	{
-		/* number of pages in the current file */
-		pgfncr->rel_os_pages = (st.st_size+pgfncr->pageSize-1)/pgfncr->pageSize;
+		for (i = 0; i < VARBITBYTES(unload); i++)
+			VARBITS(unload)[i] = ~VARBITS(unload)[i];
+		pgfincore_runs_bitmap(&delta, VARBITS(unload), VARBITLEN(unload));
+		result = pgfadvise_loader_file(filename, false, true, &delta,
+									   NULL, &pass);
+		if (result != 0)
+			return result;
+		pgfloader->pagesUnloaded	= pass.pagesUnloaded;
+		pgfloader->syscalls			+= pass.syscalls;
+		pgfloader->pagesFree		= pass.pagesFree;
+	}
 
-#ifndef HAVE_FINCORE
-		pa = mmap(NULL, st.st_size, PROT_NONE, MAP_SHARED, fd, 0);
-		if (pa == MAP_FAILED)
-		{
-			int	save_errno = errno;
-			FreeFile(fp);
-			elog(ERROR, "Can not mmap object file : %s, errno = %i,%s\nThis error can happen if there is not enought space in memory to do the projection. Please mail cedric@villemain.org with '[pgfincore] ENOMEM' as subject.",
-			     filename, save_errno, strerror(save_errno));
-			return 3;
-		}
-#endif
+	pfree(load);
+	pfree(unload);
+	pfree(pgfncr.databit);
 
-		/* Prepare our vector containing all blocks information */
-		vec = calloc(1, (st.st_size+pgfncr->pageSize-1)/pgfncr->pageSize);
-		if ((void *)0 == vec)
-		{
-#ifndef HAVE_FINCORE
-			munmap(pa, st.st_size);
-#endif
-			FreeFile(fp);
-			elog(ERROR, "Can not calloc object file : %s",
-			     filename);
-			return 4;
-		}
+	return 0;
+}
 
-#ifndef HAVE_FINCORE
-		/* Affect vec with mincore */
-		if (mincore(pa, st.st_size, vec) != 0)
-		{
-			int save_errno = errno;
-			munmap(pa, st.st_size);
-			elog(ERROR, "mincore(%p, %lld, %p): %s\n",
-			     pa, (long long int)st.st_size, vec, strerror(save_errno));
-#else
-		/* Affect vec with fincore */
-		if (fincore(fd, 0, st.st_size, vec) != 0)
-		{
-			int save_errno = errno;
-			elog(ERROR, "fincore(%u, 0, %lld, %p): %s\n",
-			     fd, (long long int)st.st_size, vec, strerror(save_errno));
-#endif
-			free(vec);
-			FreeFile(fp);
-			return 5;
-		}
+/*
+ * pgfadvise_loader_delta
+ * same as pgfadvise_loader, only the pages whose state differs from the
+ * snapshot are advised
+ */
+PG_FUNCTION_INFO_V1(pgfadvise_loader_delta);
+Datum
+pgfadvise_loader_delta(PG_FUNCTION_ARGS)
+{
+	VarBit			*databit;
+	pgfincore_runs	runs;
 
-		/*
-		 * prepare the bit string
-		 */
-		bitlen = FINCORE_BITS * ((st.st_size+pgfncr->pageSize-1)/pgfncr->pageSize);
-		len = VARBITTOTALLEN(bitlen);
-		/*
-		 * set to 0 so that *r is always initialised and string is zero-padded
-		 * XXX: do we need to free that ?
-		 */
-		pgfncr->databit = (VarBit *) palloc0(len);
-		SET_VARSIZE(pgfncr->databit, len);
-		VARBITLEN(pgfncr->databit) = bitlen;
+	if (PG_ARGISNULL(5))
+		elog(ERROR, "pgfadvise_loader: databit argument shouldn't be NULL");
 
-		r = VARBITS(pgfncr->databit);
-		x = HIGHBIT;
+	databit = PG_GETARG_VARBIT_P(5);
+	pgfincore_runs_bitmap(&runs, VARBITS(databit), VARBITLEN(databit));
 
-		/* handle the results */
-		for (pageIndex = 0; pageIndex < pgfncr->rel_os_pages; pageIndex++)
-		{
-			// block in memory
-			if (vec[pageIndex] & FINCORE_PRESENT)
-			{
-				pgfncr->pages_mem++;
-				*r |= x;
-				if (FINCORE_BITS > 1)
-				{
-					if (vec[pageIndex] & FINCORE_DIRTY)
-					{
-						pgfncr->pages_dirty++;
-						*r |= (x >> 1);
-						/* we flag to detect contigous blocks in the same state */
-						if (flag_dirty)
-							pgfncr->group_dirty++;
-						flag_dirty = 0;
-					}
-					else
-						flag_dirty = 1;
-				}
-				elog (DEBUG5, "in memory blocks : %lld / %lld",
-				      (long long int) pageIndex, (long long int) pgfncr->rel_os_pages);
+	return pgfadvise_loader_runs(fcinfo, &runs, true);
+}
 
-				/* we flag to detect contigous blocks in the same state */
-				if (flag)
-					pgfncr->group_mem++;
-				flag = 0;
-			}
-			else
-				flag=1;
+/*
+ * pgfadvise_loader_delta_map
+ * same as pgfadvise_loader_delta with a pgfincore_map
+ */
+PG_FUNCTION_INFO_V1(pgfadvise_loader_delta_map);
+Datum
+pgfadvise_loader_delta_map(PG_FUNCTION_ARGS)
+{
+	pgfincore_runs	runs;
 
+	if (PG_ARGISNULL(5))
+		elog(ERROR, "pgfadvise_loader: map argument shouldn't be NULL");
 
-			x >>= FINCORE_BITS;
-			if (x == 0)
-			{
-				x = HIGHBIT;
-				r++;
-			}
-		}
-	}
-	elog(DEBUG1, "pgfincore %s: %lld of %lld block in linux cache, %lld groups",
-	     filename, (long long int) pgfncr->pages_mem,  (long long int) pgfncr->rel_os_pages, (long long int) pgfncr->group_mem);
+	pgfincore_runs_map(&runs, PG_GETARG_PGFINCORE_MAP_P(5));
 
-	/*
-	 * free and close
-	 */
-	free(vec);
-#ifndef HAVE_FINCORE
-	munmap(pa, st.st_size);
-#endif
-	FreeFile(fp);
+	return pgfadvise_loader_runs(fcinfo, &runs, true);
+}
 
-	/*
-	 * OS things : Pages free
-	 */
-	pgfncr->pagesFree = sysconf(_SC_AVPHYS_PAGES);
+/*
+ * pgfincore_diff
+ * compare a snapshot of a segment with its live state, return the pages to
+ * load and to unload to restore the snapshot
+ */
+PG_FUNCTION_INFO_V1(pgfincore_diff);
+Datum
+pgfincore_diff(PG_FUNCTION_ARGS)
+{
+	VarBit			*databit;
+	pgfincore_runs	runs;
 
-	return 0;
+	if (PG_ARGISNULL(3))
+		elog(ERROR, "pgfincore_diff: snapshot argument shouldn't be NULL");
+
+	databit = PG_GETARG_VARBIT_P(3);
+	pgfincore_runs_bitmap(&runs, VARBITS(databit), VARBITLEN(databit));
+
+	return pgfincore_diff_runs(fcinfo, &runs);
 }
 
 /*
- * pgfincore is a function that handle the process to have a sharelock
- * on the relation and to walk the segments.
- * for each segment it call the appropriate function depending on 'action'
- * parameter
+ * pgfincore_diff_map
+ * same as pgfincore_diff with a pgfincore_map
  */
-PG_FUNCTION_INFO_V1(pgfincore);
+PG_FUNCTION_INFO_V1(pgfincore_diff_map);
 Datum
-pgfincore(PG_FUNCTION_ARGS)
+pgfincore_diff_map(PG_FUNCTION_ARGS)
 {
-	/* SRF Stuff */
-	FuncCallContext *funcctx;
-	pgfincore_fctx  *fctx;
+	pgfincore_runs	runs;
 
-	/* our structure use to return values */
-	pgfincoreStruct	*pgfncr;
+	if (PG_ARGISNULL(3))
+		elog(ERROR, "pgfincore_diff: snapshot argument shouldn't be NULL");
 
-	/* our return value, 0 for success */
-	int 			result;
+	pgfincore_runs_map(&runs, PG_GETARG_PGFINCORE_MAP_P(3));
 
-	/* The file we are working on */
+	return pgfincore_diff_runs(fcinfo, &runs);
+}
+
+static Datum
+pgfincore_diff_runs(FunctionCallInfo fcinfo, pgfincore_runs *runs)
+{
+	Oid				relOid			= PG_GETARG_OID(0);
+	text			*forkName		= PG_GETARG_TEXT_P(1);
+	int				segmentNumber	= PG_GETARG_INT32(2);
+	pgfincoreStruct	pgfncr;
+	Relation		rel;
+	char			*relationpath;
 	char			filename[MAXPGPATH];
+	VarBit			*load;
+	VarBit			*unload;
+	int64			pagesLoad;
+	int64			pagesUnload;
+	HeapTuple		tuple;
+	TupleDesc		tupdesc;
+	Datum			values[PGFINCORE_DIFF_COLS];
+	bool			nulls[PGFINCORE_DIFF_COLS];
+
+	if (segmentNumber < 0)
+		elog(ERROR, "pgfincore_diff: segment must not be negative");
 
-	/* stuff done only on the first call of the function */
-	if (SRF_IS_FIRSTCALL())
-	{
-		MemoryContext oldcontext;
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "pgfincore_diff: return type must be a row type");
 
-		Oid		relOid    = PG_GETARG_OID(0);
-		text	*forkName = PG_GETARG_TEXT_P(1);
-		bool	getvector = PG_GETARG_BOOL(2);
+	rel = relation_open(relOid, AccessShareLock);
+	relationpath = relpathpg(rel, forkName);
+	pgfincore_segment_path(filename, relationpath, segmentNumber);
+	relation_close(rel, AccessShareLock);
 
-		/*
-		* Postgresql stuff to return a tuple
-		*/
-		TupleDesc	tupdesc;
+	if (pgfincore_file(filename, true, 0, 0, &pgfncr) != 0)
+		elog(ERROR, "Can't read file %s, fork(%s)",
+			 filename, text_to_cstring(forkName));
 
-		/* create a function context for cross-call persistence */
-		funcctx = SRF_FIRSTCALL_INIT();
+	if (pgfncr.databit == NULL)
+	{
+		/* an empty segment */
+		pgfncr.databit = (VarBit *) palloc0(VARBITTOTALLEN(0));
+		SET_VARSIZE(pgfncr.databit, VARBITTOTALLEN(0));
+	}
+	pgfincore_delta(runs, pgfncr.databit, &load, &unload,
+					&pagesLoad, &pagesUnload);
 
-		/*
-		 * switch to memory context appropriate for multiple function calls
-		 */
-		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = CStringGetTextDatum(filename);
+	values[1] = Int64GetDatum(pgfncr.pageSize);
+	values[2] = Int64GetDatum(pgfncr.rel_os_pages);
+	values[3] = Int64GetDatum(pagesLoad);
+	values[4] = Int64GetDatum(pagesUnload);
+	values[5] = VarBitPGetDatum(load);
+	values[6] = VarBitPGetDatum(unload);
 
-		/* allocate memory for user context */
-		fctx = (pgfincore_fctx *) palloc(sizeof(pgfincore_fctx));
+	tuple = heap_form_tuple(tupdesc, values, nulls);
+	PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
+}
 
-        /* Build a tuple descriptor for our result type */
-        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
-            elog(ERROR, "pgfadvise: return type must be a row type");
+/*
+ * pgfincore heat
+ * a heat map counts, for each page of a segment, the snapshots in which the
+ * page was in cache. The counters are bit-sliced: the plane k holds the bit k
+ * of the counter of every page, so a snapshot is added with a ripple carry
+ * on words of 64 pages and a map of n snapshots takes log2(n + 1) bits per
+ * page.
+ *
+ * data: the planes, lowest bit first, each one a bit string of bitlen bits
+ * with the varbit layout padded to the byte
+ */
+#define PGF_HEAT_MAGIC		0x50474648	/* "PGFH" */
+#define PGF_HEAT_MAX_PLANES	32
 
-		/* provide the tuple descriptor to the fonction structure */
-        fctx->tupd = tupdesc;
+typedef struct
+{
+	int32	vl_len_;		/* varlena header (do not touch directly!) */
+	uint32	magic;
+	int32	snapshots;		/* bit strings added */
+	int32	planes;			/* bits per counter */
+	int32	bitlen;			/* pages */
+	bits8	data[FLEXIBLE_ARRAY_MEMBER];
+} PgfincoreHeat;
 
-		/* are we going to grab and output the varbit data (can be large) */
-        fctx->getvector = getvector;
+#define PGF_HEAT_HDRSZ	offsetof(PgfincoreHeat, data)
 
-		/* open the current relation, accessShareLock */
-		// TODO use try_relation_open instead ?
-		fctx->rel = relation_open(relOid, AccessShareLock);
+/*
+ * the state of pgfincore_heat_agg, the planes are words of 64 pages with the
+ * first page in the highest bit
+ */
+typedef struct
+{
+	int64	snapshots;
+	int64	bitlen;
+	int64	nwords;
+	int		planes;
+	uint64	*plane[PGF_HEAT_MAX_PLANES];
+	uint64	*carry;		/* the snapshot being added */
+} pgfincore_heat_state;
 
-		/* we get the common part of the filename of each segment of a relation */
-		fctx->relationpath = relpathpg(fctx->rel, forkName);
+/*
+ * pgfincore_heat_words
+ * fill nwords words with the bits of runs, zero past its end
+ */
+static void
+pgfincore_heat_words(pgfincore_runs *runs, uint64 *words, int64 nwords)
+{
+	int64	start, end;
+	bool	set;
+	int64	i;
 
-		/* segcount is used to get the next segment of the current relation */
-		fctx->segcount = 0;
+	if (runs->bits != NULL)
+	{
+		int64	nbytes = (runs->bitlen + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+
+		for (i = 0; i < nwords; i++)
+			words[i] = pgfincore_bitmap_word(runs->bits, nbytes,
+											 i * sizeof(uint64));
+		/* the padding bits of the last byte */
+		if (runs->bitlen % 64 != 0 && runs->bitlen / 64 < nwords)
+			words[runs->bitlen / 64] &= ~UINT64CONST(0) << (64 - runs->bitlen % 64);
+		return;
+	}
 
-		/* And finally we keep track of our initialization */
-		elog(DEBUG1, "pgfincore: init done for %s, in fork %s",
+	memset(words, 0, nwords * sizeof(uint64));
+	while (pgfincore_runs_next(runs, &start, &end, &set))
+	{
+		if (!set)
+			continue;
+		while (start < end)
+		{
+			int		shift = start % 64;
+			int		n = (int) Min(64 - shift, end - start);
+			uint64	mask = ~UINT64CONST(0);
+
+			if (n < 64)
+				mask = ((UINT64CONST(1) << n) - 1) << (64 - shift - n);
+			words[start / 64] |= mask;
+			start += n;
+		}
+	}
+}
+
+/*
+ * pgfincore_heat_add
+ * add the snapshot in carry to the counters, a plane is added when the
+ * carry goes out of the highest one
+ */
+static void
+pgfincore_heat_add(pgfincore_heat_state *state, MemoryContext aggcontext)
+{
+	uint64	*carry = state->carry;
+	int64	nwords = state->nwords;
+	int64	i;
+	int		k;
+
+	for (k = 0; k < state->planes; k++)
+	{
+		uint64	*p = state->plane[k];
+		uint64	any = 0;
+
+		for (i = 0; i < nwords; i++)
+		{
+			uint64	c = p[i] & carry[i];
+
+			p[i] ^= carry[i];
+			carry[i] = c;
+			any |= c;
+		}
+		if (any == 0)
+			return;
+	}
+
+	/* at most INT_MAX snapshots: 31 planes */
+	state->plane[k] = (uint64 *) MemoryContextAlloc(aggcontext,
+													nwords * sizeof(uint64));
+	memcpy(state->plane[k], carry, nwords * sizeof(uint64));
+	state->planes++;
+}
+
+/*
+ * pgfincore_heat_trans
+ * transition function of pgfincore_heat_agg(varbit)
+ */
+PG_FUNCTION_INFO_V1(pgfincore_heat_trans);
+Datum
+pgfincore_heat_trans(PG_FUNCTION_ARGS)
+{
+	VarBit			*databit;
+	pgfincore_runs	runs;
+
+	if (PG_ARGISNULL(1))
+		return pgfincore_heat_trans_runs(fcinfo, NULL);
+
+	databit = PG_GETARG_VARBIT_P(1);
+	pgfincore_runs_bitmap(&runs, VARBITS(databit), VARBITLEN(databit));
+
+	return pgfincore_heat_trans_runs(fcinfo, &runs);
+}
+
+/*
+ * pgfincore_heat_trans_map
+ * transition function of pgfincore_heat_agg(pgfincore_map)
+ */
+PG_FUNCTION_INFO_V1(pgfincore_heat_trans_map);
+Datum
+pgfincore_heat_trans_map(PG_FUNCTION_ARGS)
+{
+	pgfincore_runs	runs;
+
+	if (PG_ARGISNULL(1))
+		return pgfincore_heat_trans_runs(fcinfo, NULL);
+
+	pgfincore_runs_map(&runs, PG_GETARG_PGFINCORE_MAP_P(1));
+
+	return pgfincore_heat_trans_runs(fcinfo, &runs);
+}
+
+static Datum
+pgfincore_heat_trans_runs(FunctionCallInfo fcinfo, pgfincore_runs *runs)
+{
+	MemoryContext			aggcontext;
+	pgfincore_heat_state	*state;
+	int64					nwords;
+	int						k;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "pgfincore_heat_agg: called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		state = (pgfincore_heat_state *)
+			MemoryContextAllocZero(aggcontext, sizeof(pgfincore_heat_state));
+	else
+		state = (pgfincore_heat_state *) PG_GETARG_POINTER(0);
+
+	/* a NULL snapshot is ignored */
+	if (runs == NULL)
+		PG_RETURN_POINTER(state);
+
+	if (state->snapshots >= INT_MAX)
+		elog(ERROR, "pgfincore_heat_agg: too many snapshots");
+	if (runs->bitlen > INT_MAX)
+		elog(ERROR, "pgfincore_heat_agg: snapshot too long");
+
+	/* the segment may have grown since the first snapshots */
+	nwords = (runs->bitlen + 63) / 64;
+	if (state->carry == NULL || nwords > state->nwords)
+	{
+		for (k = 0; k < state->planes; k++)
+		{
+			state->plane[k] = (uint64 *) repalloc(state->plane[k],
+												  Max(nwords, 1) * sizeof(uint64));
+			memset(state->plane[k] + state->nwords, 0,
+				   (nwords - state->nwords) * sizeof(uint64));
+		}
+		if (state->carry != NULL)
+			pfree(state->carry);
+		state->carry = (uint64 *) MemoryContextAlloc(aggcontext,
+													 Max(nwords, 1) * sizeof(uint64));
+		state->nwords = nwords;
+	}
+	state->bitlen = Max(state->bitlen, runs->bitlen);
+
+	pgfincore_heat_words(runs, state->carry, state->nwords);
+	pgfincore_heat_add(state, aggcontext);
+	state->snapshots++;
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * pgfincore_heat_final
+ * final function of pgfincore_heat_agg, the planes are written with the
+ * varbit layout
+ */
+PG_FUNCTION_INFO_V1(pgfincore_heat_final);
+Datum
+pgfincore_heat_final(PG_FUNCTION_ARGS)
+{
+	pgfincore_heat_state	*state;
+	PgfincoreHeat			*heat;
+	int64					nbytes;
+	int64					i;
+	int						k;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+
+	state = (pgfincore_heat_state *) PG_GETARG_POINTER(0);
+	nbytes = (state->bitlen + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+
+	heat = (PgfincoreHeat *) palloc0(PGF_HEAT_HDRSZ + state->planes * nbytes);
+	SET_VARSIZE(heat, PGF_HEAT_HDRSZ + state->planes * nbytes);
+	heat->magic		= PGF_HEAT_MAGIC;
+	heat->snapshots	= (int32) state->snapshots;
+	heat->planes	= state->planes;
+	heat->bitlen	= (int32) state->bitlen;
+
+	for (k = 0; k < state->planes; k++)
+		for (i = 0; i < nbytes; i++)
+			heat->data[k * nbytes + i] = (bits8)
+				(state->plane[k][i / 8] >> (56 - (i % 8) * BITS_PER_BYTE));
+
+	PG_RETURN_BYTEA_P(heat);
+}
+
+/*
+ * pgfincore_heat_planes
+ * check a heat map and read its planes as words
+ */
+static PgfincoreHeat *
+pgfincore_heat_planes(Datum datum, uint64 **plane, int64 *nwords)
+{
+	PgfincoreHeat	*heat = (PgfincoreHeat *) PG_DETOAST_DATUM(datum);
+	int64			nbytes;
+	int64			i;
+	int				k;
+
+	if (VARSIZE(heat) < PGF_HEAT_HDRSZ ||
+		heat->magic != PGF_HEAT_MAGIC ||
+		heat->planes < 0 || heat->planes > PGF_HEAT_MAX_PLANES ||
+		heat->bitlen < 0 || heat->snapshots < 0)
+		elog(ERROR, "pgfincore_heat: corrupted value");
+
+	nbytes = ((int64) heat->bitlen + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+	if (VARSIZE(heat) != PGF_HEAT_HDRSZ + heat->planes * nbytes)
+		elog(ERROR, "pgfincore_heat: corrupted value");
+
+	*nwords = (heat->bitlen + 63) / 64;
+	for (k = 0; k < heat->planes; k++)
+	{
+		plane[k] = (uint64 *) palloc(Max(*nwords, 1) * sizeof(uint64));
+		for (i = 0; i < *nwords; i++)
+			plane[k][i] = pgfincore_bitmap_word(heat->data + k * nbytes, nbytes,
+												i * sizeof(uint64));
+	}
+	return heat;
+}
+
+/*
+ * pgfincore_heat_mask
+ * set in mask the pages whose counter is level, or at least level when ge,
+ * and return their number. level must be positive: the padding of the last
+ * word is never set.
+ */
+static int64
+pgfincore_heat_mask(uint64 **plane, int planes, int64 nwords,
+					int64 level, bool ge, uint64 *mask)
+{
+	int64	count = 0;
+	int64	i;
+	int		k;
+
+	/* higher than any counter */
+	if (planes < 63 && level >> planes != 0)
+	{
+		memset(mask, 0, nwords * sizeof(uint64));
+		return 0;
+	}
+
+	for (i = 0; i < nwords; i++)
+	{
+		uint64	gt = 0;
+		uint64	eq = ~UINT64CONST(0);
+
+		/* compare the counters with level from the highest bit */
+		for (k = planes - 1; k >= 0; k--)
+		{
+			if ((level >> k) & 1)
+				eq &= plane[k][i];
+			else
+			{
+				gt |= eq & plane[k][i];
+				eq &= ~plane[k][i];
+			}
+		}
+		mask[i] = ge ? gt | eq : eq;
+		count += pgfincore_pack_popcount64(mask[i]);
+	}
+	return count;
+}
+
+/*
+ * pgfincore_heat_bits
+ * write the words of mask as a bit string of nbytes
+ */
+static void
+pgfincore_heat_bits(const uint64 *mask, bits8 *bits, int64 nbytes)
+{
+	int64	i;
+
+	for (i = 0; i < nbytes; i++)
+		bits[i] = (bits8) (mask[i / 8] >> (56 - (i % 8) * BITS_PER_BYTE));
+}
+
+/*
+ * pgfincore_heat_databit
+ * the pages in cache in at least min_heat snapshots of the heat map
+ */
+PG_FUNCTION_INFO_V1(pgfincore_heat_databit);
+Datum
+pgfincore_heat_databit(PG_FUNCTION_ARGS)
+{
+	int32			minHeat = PG_GETARG_INT32(1);
+	PgfincoreHeat	*heat;
+	uint64			*plane[PGF_HEAT_MAX_PLANES];
+	uint64			*mask;
+	int64			nwords;
+	VarBit			*databit;
+
+	if (minHeat < 1)
+		elog(ERROR, "pgfincore_heat: min_heat must be positive");
+
+	heat = pgfincore_heat_planes(PG_GETARG_DATUM(0), plane, &nwords);
+
+	mask = (uint64 *) palloc(Max(nwords, 1) * sizeof(uint64));
+	(void) pgfincore_heat_mask(plane, heat->planes, nwords, minHeat, true, mask);
+
+	databit = (VarBit *) palloc0(VARBITTOTALLEN(heat->bitlen));
+	SET_VARSIZE(databit, VARBITTOTALLEN(heat->bitlen));
+	VARBITLEN(databit) = heat->bitlen;
+	pgfincore_heat_bits(mask, VARBITS(databit), VARBITBYTES(databit));
+
+	PG_RETURN_VARBIT_P(databit);
+}
+
+/*
+ * pgfadvise_loader_heat
+ * load the pages of a segment by decreasing heat until the budget in MB is
+ * spent, 0 for no limit. Within a heat the pages are taken in file order.
+ * With unload, the pages of the heat map out of the budget are unloaded.
+ */
+PG_FUNCTION_INFO_V1(pgfadvise_loader_heat);
+Datum
+pgfadvise_loader_heat(PG_FUNCTION_ARGS)
+{
+	Oid				relOid			= PG_GETARG_OID(0);
+	text			*forkName		= PG_GETARG_TEXT_P(1);
+	int				segmentNumber	= PG_GETARG_INT32(2);
+	bool			willneed		= PG_GETARG_BOOL(3);
+	bool			dontneed		= PG_GETARG_BOOL(4);
+	int64			budget;
+	PgfincoreHeat	*heat;
+	uint64			*plane[PGF_HEAT_MAX_PLANES];
+	uint64			*mask;
+	uint64			*selected;
+	bits8			*bits;
+	int64			nwords;
+	int64			nbytes;
+	int64			remaining;
+	int64			level;
+	int64			i;
+	pgfincore_runs	runs;
+	pgfloaderStruct	pgfloader;
+	pgfloaderStruct	pass;
+	Relation		rel;
+	char			*relationpath;
+	char			filename[MAXPGPATH];
+	struct stat		st;
+	HeapTuple		tuple;
+	TupleDesc		tupdesc;
+	Datum			values[PGFADVISE_LOADER_COLS];
+	bool			nulls[PGFADVISE_LOADER_COLS];
+
+	if (PG_ARGISNULL(5))
+		elog(ERROR, "pgfadvise_loader_heat: heat argument shouldn't be NULL");
+	if (PG_ARGISNULL(6) || PG_GETARG_INT64(6) < 0)
+		elog(ERROR, "pgfadvise_loader_heat: budget must not be negative");
+	if (segmentNumber < 0)
+		elog(ERROR, "pgfadvise_loader_heat: segment must not be negative");
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	rel = relation_open(relOid, AccessShareLock);
+	relationpath = relpathpg(rel, forkName);
+	pgfincore_segment_path(filename, relationpath, segmentNumber);
+	relation_close(rel, AccessShareLock);
+
+	if (stat(filename, &st) == -1)
+		elog(ERROR, "Can't read file %s, fork(%s)",
+			 filename, text_to_cstring(forkName));
+
+	heat = pgfincore_heat_planes(PG_GETARG_DATUM(5), plane, &nwords);
+	nbytes = ((int64) heat->bitlen + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+
+	memset(&pgfloader, 0, sizeof(pgfloaderStruct));
+	pgfloader.pageSize	= sysconf(_SC_PAGESIZE);
+	pgfloader.pagesFree	= sysconf(_SC_AVPHYS_PAGES);
+
+	budget = PG_GETARG_INT64(6);
+	if (budget == 0)
+		remaining = PG_INT64_MAX;
+	else
+		remaining = Min(budget, PG_INT64_MAX / (1024 * 1024)) * 1024 * 1024 /
+			pgfloader.pageSize;
+
+	mask		= (uint64 *) palloc(Max(nwords, 1) * sizeof(uint64));
+	selected	= (uint64 *) palloc0(Max(nwords, 1) * sizeof(uint64));
+	bits		= (bits8 *) palloc(Max(nbytes, 1));
+
+	/* the hottest pages first, no counter is above the number of snapshots */
+	level = heat->planes < 63 ? (INT64CONST(1) << heat->planes) - 1 : 0;
+	for (level = Min(level, heat->snapshots); level >= 1; level--)
+	{
+		int64	npages;
+		int64	take;
+
+		CHECK_FOR_INTERRUPTS();
+
+		npages = pgfincore_heat_mask(plane, heat->planes, nwords,
+									 level, false, mask);
+		if (npages == 0)
+			continue;
+
+		/* the pages out of the budget: the last ones of the segment */
+		take = Min(npages, remaining);
+		if (take < npages)
+		{
+			int64	kept = 0;
+
+			for (i = 0; i < nwords; i++)
+			{
+				while (mask[i] != 0 &&
+					   kept + pgfincore_pack_popcount64(mask[i]) > take)
+					mask[i] &= mask[i] - 1;
+				kept += pgfincore_pack_popcount64(mask[i]);
+			}
+			pgfloader.pagesSkipped += npages - take;
+		}
+		remaining -= take;
+		if (take == 0)
+			continue;
+
+		for (i = 0; i < nwords; i++)
+			selected[i] |= mask[i];
+
+		if (willneed)
+		{
+			pgfincore_heat_bits(mask, bits, nbytes);
+			pgfincore_runs_bitmap(&runs, bits, heat->bitlen);
+			if (pgfadvise_loader_file(filename, true, false, &runs,
+									  NULL, &pass) != 0)
+				elog(ERROR, "Can't read file %s, fork(%s)",
+					 filename, text_to_cstring(forkName));
+			pgfloader.pagesLoaded	+= pass.pagesLoaded;
+			pgfloader.syscalls		+= pass.syscalls;
+			pgfloader.pagesFree		= pass.pagesFree;
+		}
+	}
+
+	/* the loader unloads the unset bits: the pages of the budget are set */
+	if (dontneed && heat->bitlen > 0)
+	{
+		pgfincore_heat_bits(selected, bits, nbytes);
+		pgfincore_runs_bitmap(&runs, bits, heat->bitlen);
+		if (pgfadvise_loader_file(filename, false, true, &runs,
+								  NULL, &pass) != 0)
+			elog(ERROR, "Can't read file %s, fork(%s)",
+				 filename, text_to_cstring(forkName));
+		pgfloader.pagesUnloaded	= pass.pagesUnloaded;
+		pgfloader.syscalls		+= pass.syscalls;
+		pgfloader.pagesFree		= pass.pagesFree;
+	}
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = CStringGetTextDatum(filename);
+	values[1] = Int64GetDatum(pgfloader.pageSize);
+	values[2] = Int64GetDatum(pgfloader.pagesFree);
+	values[3] = Int64GetDatum(pgfloader.pagesLoaded);
+	values[4] = Int64GetDatum(pgfloader.pagesUnloaded);
+	values[5] = Int64GetDatum(pgfloader.syscalls);
+	values[6] = Int64GetDatum(pgfloader.pagesSkipped);
+
+	tuple = heap_form_tuple(tupdesc, values, nulls);
+	PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
+}
+
+/*
+ * pgfincore_cachestat_file
+ * fill the counters of pgfncr provided by cachestat(2) for the range of fd.
+ * Return false if cachestat is not used, not available or failed, the
+ * counters are then left untouched.
+ */
+static bool
+pgfincore_cachestat_file(int fd, off_t offset, size_t len,
+						 pgfincoreStruct *pgfncr)
+{
+#ifdef HAVE_CACHESTAT
+	/* -1 until the first call tells us if the kernel has cachestat */
+	static int	cachestat_available = -1;
+	pgfincore_cachestat_range range;
+	pgfincore_cachestat cs;
+
+	if (!pgfincore_use_cachestat || cachestat_available == 0)
+		return false;
+
+	range.off = offset;
+	range.len = len;
+	if (syscall(__NR_cachestat, fd, &range, &cs, 0) != 0)
+	{
+		int	save_errno = errno;
+
+		/* the kernel does not know cachestat, or a seccomp filter hides it */
+		if (save_errno == ENOSYS || save_errno == EPERM)
+			cachestat_available = 0;
+		elog(DEBUG1, "pgfincore: cachestat not used: %s", strerror(save_errno));
+		return false;
+	}
+	cachestat_available = 1;
+
+	pgfncr->pages_dirty				= cs.nr_dirty;
+	pgfncr->pages_writeback			= cs.nr_writeback;
+	pgfncr->pages_evicted			= cs.nr_evicted;
+	pgfncr->pages_recently_evicted	= cs.nr_recently_evicted;
+	pgfncr->pages_mem				= cs.nr_cache;
+	pgfncr->has_cachestat			= true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * pgfincore_file handle the mmaping, mincore process (and access file, etc.)
+ * The file is processed by windows of PGF_WINDOW_SIZE bytes: only one window
+ * is mmaped at a time and the same small vector is reused for each of them.
+ * The varbit is built only if getvector is true, else only the counters are
+ * computed and nothing is allocated per page.
+ * Only rangeLen bytes from rangeOffset are inspected, the whole file when
+ * rangeLen is 0.
+ */
+static int
+pgfincore_file(char *filename, bool getvector,
+			   off_t rangeOffset, off_t rangeLen,
+			   pgfincoreStruct *pgfncr)
+{
+	return pgfincore_file_ranges(filename, getvector, rangeOffset, rangeLen,
+								 pgfncr, NULL);
+}
+
+/*
+ * pgfincore_ranges_flush
+ * write the current run of pages in cache, if any
+ */
+static void
+pgfincore_ranges_flush(pgfincore_range_writer *ranges)
+{
+	Datum	values[PGFINCORE_RANGES_COLS];
+	bool	nulls[PGFINCORE_RANGES_COLS];
+
+	if (ranges->start < 0)
+		return;
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Int32GetDatum(ranges->segno);
+	values[1] = Int64GetDatum(ranges->segno * ranges->segPages + ranges->start);
+	values[2] = Int64GetDatum(ranges->end - ranges->start);
+	values[3] = BoolGetDatum(ranges->dirty);
+	tuplestore_putvalues(ranges->tupstore, ranges->tupdesc, values, nulls);
+
+	ranges->start = -1;
+}
+
+/*
+ * pgfincore_ranges_add
+ * the pages [start, end[ of the segment are in cache: extend the current run
+ * if they follow it in the same state, else start a new one
+ */
+static inline void
+pgfincore_ranges_add(pgfincore_range_writer *ranges, int64 start, int64 end,
+					 bool dirty)
+{
+	if (ranges->start >= 0 && ranges->end == start && ranges->dirty == dirty)
+	{
+		ranges->end = end;
+		return;
+	}
+	pgfincore_ranges_flush(ranges);
+	ranges->start	= start;
+	ranges->end		= end;
+	ranges->dirty	= dirty;
+}
+
+/*
+ * pgfincore_file_ranges
+ * same as pgfincore_file, with ranges the runs of pages in cache are also
+ * written as they are found
+ */
+static int
+pgfincore_file_ranges(char *filename, bool getvector,
+					  off_t rangeOffset, off_t rangeLen,
+					  pgfincoreStruct *pgfncr,
+					  pgfincore_range_writer *ranges)
+{
+	int		len, bitlen;
+	bits8	*r;
+#ifndef HAVE_FINCORE
+	pgfincore_pack_state pack;
+	bits8	*w = NULL;	/* the bits of a window, for the ranges only */
+	bits8	*wr;
+	pgfincore_runs	runs;
+	int64	start, end;
+	bool	set;
+#else
+	int		flag=1;
+	int		flag_dirty=1;
+	bits8	x = 0;
+	int64	winIndex;
+#endif
+
+	/* the range, rounded to OS pages and within the file */
+	off_t	rangeStart;
+	off_t	rangeEnd;
+
+	/* current window */
+	off_t	offset;
+	size_t	window;
+	size_t	winPages;
+	size_t	npages;
+
+	/*
+	 * We use the AllocateFile(2) provided by PostgreSQL.  We're going to
+	 * close it ourselves even if PostgreSQL close it anyway at transaction
+	 * end.
+	 */
+	FILE	*fp;
+	int	fd;
+	struct stat st;
+
+#ifndef HAVE_FINCORE
+	void 		  *pa  = (char *) 0;
+#endif
+	unsigned char *vec = (unsigned char *) 0;
+
+	/*
+	 * OS Page size
+	 */
+	pgfncr->pageSize  = sysconf(_SC_PAGESIZE);
+
+	/*
+	 * Initialize counters
+	 */
+	pgfncr->pages_mem		= 0;
+	pgfncr->group_mem		= 0;
+	pgfncr->pages_dirty		= 0;
+	pgfncr->group_dirty		= 0;
+	pgfncr->rel_os_pages	= 0;
+	pgfncr->pages_writeback	= 0;
+	pgfncr->pages_evicted	= 0;
+	pgfncr->pages_recently_evicted = 0;
+	pgfncr->has_group_mem	= true;
+	pgfncr->has_cachestat	= false;
+	pgfncr->databit			= NULL;
+	pgfncr->pinned			= false;
+
+	/*
+	 * Fopen and fstat file
+	 * fd will be provided to posix_fadvise
+	 * if there is no file, just return 1, it is expected to leave the SRF
+	 */
+	fp = AllocateFile(filename, "rb");
+	if (fp == NULL)
+                return 1;
+
+	fd = fileno(fp);
+
+	if (fstat(fd, &st) == -1)
+	{
+		FreeFile(fp);
+		elog(ERROR, "Can not stat object file : %s",
+		     filename);
+		return 2;
+	}
+	pgfncr->pinned = pgfincore_hard_pinned(st.st_dev, st.st_ino);
+
+	rangeStart	= rangeOffset / pgfncr->pageSize * pgfncr->pageSize;
+	rangeEnd	= (rangeLen == 0) ? st.st_size :
+		Min(rangeOffset + rangeLen, st.st_size);
+	pgfncr->rangeEnd = Max(rangeEnd, rangeStart);
+
+	/*
+	* if file ok
+	* then process
+	*/
+	if (rangeEnd > rangeStart)
+	{
+		/* number of pages in the current range */
+		pgfncr->rel_os_pages = (rangeEnd - rangeStart + pgfncr->pageSize - 1) /
+			pgfncr->pageSize;
+
+		/*
+		 * cachestat provides all the counters but group_mem and group_dirty,
+		 * mincore is still required to build the varbit (and then overwrite
+		 * pages_mem).
+		 */
+		if (pgfincore_cachestat_file(fd, rangeStart, rangeEnd - rangeStart, pgfncr) &&
+			!getvector && ranges == NULL)
+		{
+			elog(DEBUG1, "pgfincore %s: %lld of %lld block in linux cache (cachestat)",
+			     filename, (long long int) pgfncr->pages_mem,
+			     (long long int) pgfncr->rel_os_pages);
+			pgfncr->has_group_mem = false;
+			FreeFile(fp);
+			pgfncr->pagesFree = sysconf(_SC_AVPHYS_PAGES);
+			return 0;
+		}
+
+		/*
+		 * Prepare our vector containing the blocks information of one window,
+		 * it is reused for all the windows of the file
+		 */
+		winPages = Min(PGF_WINDOW_SIZE / pgfncr->pageSize, pgfncr->rel_os_pages);
+		vec = palloc(winPages);
+
+		/*
+		 * prepare the bit string, if requested
+		 */
+		r = NULL;
+		if (getvector)
+		{
+			bitlen = FINCORE_BITS * pgfncr->rel_os_pages;
+			len = VARBITTOTALLEN(bitlen);
+			/*
+			 * set to 0 so that *r is always initialised and string is zero-padded
+			 * XXX: do we need to free that ?
+			 */
+			pgfncr->databit = (VarBit *) palloc0(len);
+			SET_VARSIZE(pgfncr->databit, len);
+			VARBITLEN(pgfncr->databit) = bitlen;
+
+			r = VARBITS(pgfncr->databit);
+		}
+#ifndef HAVE_FINCORE
+		memset(&pack, 0, sizeof(pack));
+		if (ranges != NULL && r == NULL)
+			w = palloc(winPages / BITS_PER_BYTE + 1);
+#else
+		x = HIGHBIT;
+#endif
+
+		for (offset = rangeStart; offset < rangeEnd; offset += window)
+		{
+			window = Min((size_t) (rangeEnd - offset),
+						 winPages * pgfncr->pageSize);
+			npages = (window + pgfncr->pageSize - 1) / pgfncr->pageSize;
+
+#ifndef HAVE_FINCORE
+			pa = mmap(NULL, window, PROT_NONE, MAP_SHARED, fd, offset);
+			if (pa == MAP_FAILED)
+			{
+				int	save_errno = errno;
+				FreeFile(fp);
+				elog(ERROR, "Can not mmap object file : %s, errno = %i,%s",
+				     filename, save_errno, strerror(save_errno));
+				return 3;
+			}
+
+			/* Affect vec with mincore */
+			if (mincore(pa, window, vec) != 0)
+			{
+				int save_errno = errno;
+				munmap(pa, window);
+				FreeFile(fp);
+				elog(ERROR, "mincore(%p, %lld, %p): %s\n",
+				     pa, (long long int) window, vec, strerror(save_errno));
+				return 5;
+			}
+			munmap(pa, window);
+
+			/*
+			 * handle the results of this window: pack the vector into the bit
+			 * string and count the pages and groups of pages in memory.
+			 * Windows are a multiple of 8 pages, r stays byte aligned.
+			 */
+			wr = (r != NULL) ? r : w;
+			pgfincore_pack(vec, npages, wr, &pack);
+			if (r != NULL)
+				r += npages / BITS_PER_BYTE;
+
+			/* the runs of the window, they may continue the previous one */
+			if (ranges != NULL)
+			{
+				pgfincore_runs_bitmap(&runs, wr, npages);
+				while (pgfincore_runs_next(&runs, &start, &end, &set))
+					if (set)
+						pgfincore_ranges_add(ranges,
+											 offset / pgfncr->pageSize + start,
+											 offset / pgfncr->pageSize + end,
+											 false);
+			}
+			pgfncr->pages_mem = pack.pages_mem;
+			pgfncr->group_mem = pack.group_mem;
+#else
+			/* Affect vec with fincore */
+			if (fincore(fd, offset, window, vec) != 0)
+			{
+				int save_errno = errno;
+				FreeFile(fp);
+				elog(ERROR, "fincore(%u, %lld, %lld, %p): %s\n",
+				     fd, (long long int) offset, (long long int) window,
+				     vec, strerror(save_errno));
+				return 5;
+			}
+
+			/* handle the results of this window */
+			for (winIndex = 0; winIndex < npages; winIndex++)
+			{
+				// block in memory
+				if (vec[winIndex] & FINCORE_PRESENT)
+				{
+					pgfncr->pages_mem++;
+					if (r != NULL)
+						*r |= x;
+					if (ranges != NULL)
+						pgfincore_ranges_add(ranges,
+											 offset / pgfncr->pageSize + winIndex,
+											 offset / pgfncr->pageSize + winIndex + 1,
+											 (vec[winIndex] & FINCORE_DIRTY) != 0);
+					if (vec[winIndex] & FINCORE_DIRTY)
+					{
+						pgfncr->pages_dirty++;
+						if (r != NULL)
+							*r |= (x >> 1);
+						/* we flag to detect contigous blocks in the same state */
+						if (flag_dirty)
+							pgfncr->group_dirty++;
+						flag_dirty = 0;
+					}
+					else
+						flag_dirty = 1;
+
+					/* we flag to detect contigous blocks in the same state */
+					if (flag)
+						pgfncr->group_mem++;
+					flag = 0;
+				}
+				else
+					flag=1;
+
+
+				x >>= FINCORE_BITS;
+				if (x == 0)
+				{
+					x = HIGHBIT;
+					if (r != NULL)
+						r++;
+				}
+			}
+#endif
+			elog(DEBUG5, "pgfincore %s: %lld bytes at offset %lld, %lld blocks in memory so far",
+			     filename, (long long int) window, (long long int) offset,
+			     (long long int) pgfncr->pages_mem);
+		}
+		pfree(vec);
+#ifndef HAVE_FINCORE
+		if (w != NULL)
+			pfree(w);
+#endif
+	}
+	if (ranges != NULL)
+		pgfincore_ranges_flush(ranges);
+	elog(DEBUG1, "pgfincore %s: %lld of %lld block in linux cache, %lld groups",
+	     filename, (long long int) pgfncr->pages_mem,  (long long int) pgfncr->rel_os_pages, (long long int) pgfncr->group_mem);
+
+	/*
+	 * close
+	 */
+	FreeFile(fp);
+
+	/*
+	 * OS things : Pages free
+	 */
+	pgfncr->pagesFree = sysconf(_SC_AVPHYS_PAGES);
+
+	return 0;
+}
+
+/*
+ * pgfincore_values
+ * the PGFINCORE_COLS columns of a segment, nulls must be initialized
+ */
+static void
+pgfincore_values(const char *filename, unsigned int segno,
+				 pgfincoreStruct *pgfncr, Datum *values, bool *nulls)
+{
+	/* Filename */
+	values[0] = CStringGetTextDatum(filename);
+	/* Segment Number */
+	values[1] = Int32GetDatum(segno);
+	/* os page size */
+	values[2] = Int64GetDatum(pgfncr->pageSize);
+	/* number of pages used by segment */
+	values[3] = Int64GetDatum(pgfncr->rel_os_pages);
+	/* number of pages in OS cache */
+	values[4] = Int64GetDatum(pgfncr->pages_mem);
+	/* number of group of contigous page in os cache */
+	if (pgfncr->has_group_mem)
+		values[5] = Int64GetDatum(pgfncr->group_mem);
+	else
+		nulls[5] = true;
+	/* free page cache */
+	values[6] = Int64GetDatum(pgfncr->pagesFree);
+	/* the map of the file with bit set for in os cache page */
+	if (pgfncr->databit != NULL)
+	{
+		values[7] = VarBitPGetDatum(pgfncr->databit);
+	}
+	else
+	{
+		nulls[7]  = true;
+		values[7] = (Datum) NULL;
+	}
+	/* number of pages dirty in OS cache */
+	values[8] = Int64GetDatum(pgfncr->pages_dirty);
+	/*
+	 * number of group of contigous dirty pages in os cache, cachestat
+	 * counts dirty pages but can not tell if they are contigous
+	 */
+	if (pgfncr->has_cachestat)
+		nulls[9] = true;
+	else
+		values[9] = Int64GetDatum(pgfncr->group_dirty);
+	/* pages under writeback, evicted, recently evicted (cachestat) */
+	if (pgfncr->has_cachestat)
+	{
+		values[10] = Int64GetDatum(pgfncr->pages_writeback);
+		values[11] = Int64GetDatum(pgfncr->pages_evicted);
+		values[12] = Int64GetDatum(pgfncr->pages_recently_evicted);
+	}
+	else
+	{
+		nulls[10] = true;
+		nulls[11] = true;
+		nulls[12] = true;
+	}
+	/* locked in memory by the worker (hard pinning) */
+	values[13] = BoolGetDatum(pgfncr->pinned);
+}
+
+/*
+ * pgfincore is a function that handle the process to have a sharelock
+ * on the relation and to walk the segments.
+ * for each segment it call the appropriate function depending on 'action'
+ * parameter
+ */
+PG_FUNCTION_INFO_V1(pgfincore);
+Datum
+pgfincore(PG_FUNCTION_ARGS)
+{
+	return pgfincore_srf(fcinfo, false);
+}
+
+/*
+ * pgfincore_nolock
+ * pgfincore without any lock on the relation, see pgfincore_nolock_relpath
+ */
+PG_FUNCTION_INFO_V1(pgfincore_nolock);
+Datum
+pgfincore_nolock(PG_FUNCTION_ARGS)
+{
+	return pgfincore_srf(fcinfo, true);
+}
+
+static Datum
+pgfincore_srf(FunctionCallInfo fcinfo, bool nolock)
+{
+	/* SRF Stuff */
+	FuncCallContext *funcctx;
+	pgfincore_fctx  *fctx;
+
+	/* our structure use to return values */
+	pgfincoreStruct	*pgfncr;
+
+	/* our return value, 0 for success */
+	int 			result;
+
+	/* The file we are working on, and its range */
+	char			filename[MAXPGPATH];
+	off_t			offset;
+	off_t			len;
+
+	/* stuff done only on the first call of the function */
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+
+		Oid		relOid    = PG_GETARG_OID(0);
+		text	*forkName = PG_GETARG_TEXT_P(1);
+		bool	getvector = PG_GETARG_BOOL(2);
+
+		/*
+		* Postgresql stuff to return a tuple
+		*/
+		TupleDesc	tupdesc;
+
+		/* create a function context for cross-call persistence */
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		/*
+		 * switch to memory context appropriate for multiple function calls
+		 */
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		/* allocate memory for user context */
+		fctx = (pgfincore_fctx *) palloc(sizeof(pgfincore_fctx));
+
+        /* Build a tuple descriptor for our result type */
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+            elog(ERROR, "pgfadvise: return type must be a row type");
+
+		/* provide the tuple descriptor to the fonction structure */
+        fctx->tupd = tupdesc;
+
+		/* are we going to grab and output the varbit data (can be large) */
+        fctx->getvector = getvector;
+
+		/*
+		 * open the current relation, accessShareLock, and get the common
+		 * part of the filename of each segment of a relation
+		 * Without lock, the path comes from the catalog
+		 */
+		if (nolock)
+		{
+			fctx->rel = NULL;
+			fctx->relationpath = pgfincore_nolock_relpath(relOid, forkName);
+		}
+		else
+		{
+			fctx->rel = relation_open(relOid, AccessShareLock);
+			fctx->relationpath = relpathpg(fctx->rel, forkName);
+		}
+
+		/* the block range, if any */
+		pgfincore_block_range(fcinfo, 3, &fctx->startBlock, &fctx->endBlock);
+
+		/*
+		 * segcount is used to get the next segment of the current relation,
+		 * starting with the one of the first block
+		 */
+		fctx->segcount = fctx->startBlock / RELSEG_SIZE;
+
+		/* And finally we keep track of our initialization */
+		elog(DEBUG1, "pgfincore: init done for %s, in fork %s",
+					fctx->relationpath ? fctx->relationpath : "(none)",
+					text_to_cstring(forkName));
+		funcctx->user_fctx = fctx;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	/* After the first call, we recover our context */
+	funcctx = SRF_PERCALL_SETUP();
+	fctx = funcctx->user_fctx;
+
+	/*
+	 * If we are still looking the first segment
+	 * relationpath should not be suffixed
+	 */
+	if (fctx->relationpath == NULL)
+		filename[0] = '\0';
+	else if (fctx->segcount == 0)
+		snprintf(filename,
+		         MAXPGPATH,
+		         "%s",
+		         fctx->relationpath);
+	else
+		snprintf(filename,
+		         MAXPGPATH,
+		         "%s.%u",
+		         fctx->relationpath,
+		         fctx->segcount);
+
+	elog(DEBUG1, "pgfincore: about to work with %s", filename);
+
+	/*
+	 * Call pgfincore with the advice, returning the structure
+	 * Past the block range, or without file, we are done
+	 */
+	pgfncr = (pgfincoreStruct *) palloc(sizeof(pgfincoreStruct));
+	if (fctx->relationpath != NULL &&
+		pgfincore_segment_range(fctx->startBlock, fctx->endBlock,
+								fctx->segcount, &offset, &len))
+		result = pgfincore_file(filename, fctx->getvector, offset, len, pgfncr);
+	else
+		result = 1;
+
+	/*
+	* When we have work with all segment of the current relation, test success
+	* We exit from the SRF
+	*/
+	if (result)
+	{
+		elog(DEBUG1, "pgfincore: closing %s", filename);
+		if (fctx->rel != NULL)
+			relation_close(fctx->rel, AccessShareLock);
+		pfree(fctx);
+		SRF_RETURN_DONE(funcctx);
+	}
+	else
+	{
+		/*
+		* Postgresql stuff to return a tuple
+		*/
+		HeapTuple	tuple;
+		Datum		values[PGFINCORE_COLS];
+		bool		nulls[PGFINCORE_COLS];
+
+		/* initialize nulls array to build the tuple */
+		memset(nulls, 0, sizeof(nulls));
+		pgfincore_values(filename, fctx->segcount, pgfncr, values, nulls);
+
+		/* Build the result tuple. */
+		tuple = heap_form_tuple(fctx->tupd, values, nulls);
+
+        /* prepare the number of the next segment */
+        fctx->segcount++;
+
+		/* Ok, return results, and go for next call */
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+}
+
+/*
+ * pgfincore_materialize
+ * set up the tuplestore of a materialized SRF, which returns all its rows in
+ * one call
+ */
+static Tuplestorestate *
+pgfincore_materialize(FunctionCallInfo fcinfo, TupleDesc *tupdesc)
+{
+	ReturnSetInfo	*rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate	*tupstore;
+	MemoryContext	oldcontext;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	/* the tuplestore and its descriptor must live until the end of the query */
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	if (get_call_result_type(fcinfo, NULL, tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "pgfincore: return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = *tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return tupstore;
+}
+
+/*
+ * pgfincore_relation_list
+ * the relations of a regclass[], without duplicates. With dependents, each
+ * relation comes with all its partitions or children, and for each of them
+ * its indexes, its TOAST table and the index of the TOAST table.
+ */
+static List *
+pgfincore_relation_list(ArrayType *relids, bool dependents)
+{
+	List	*relations = NIL;
+	Datum	*elems;
+	bool	*elemnulls;
+	int		nelems;
+	int		i;
+
+	deconstruct_array(relids, REGCLASSOID, sizeof(Oid), true, 'i',
+					  &elems, &elemnulls, &nelems);
+
+	for (i = 0; i < nelems; i++)
+	{
+		List		*children;
+		ListCell	*lc;
+
+		if (elemnulls[i])
+			continue;
+
+		if (!dependents)
+		{
+			relations = list_append_unique_oid(relations,
+												DatumGetObjectId(elems[i]));
+			continue;
+		}
+
+		/* the relation itself comes first, then its children */
+		children = find_all_inheritors(DatumGetObjectId(elems[i]),
+									   AccessShareLock, NULL);
+		foreach(lc, children)
+		{
+			Oid			childOid = lfirst_oid(lc);
+			Oid			toastOid;
+			Relation	rel;
+			List		*indexes;
+
+			relations = list_append_unique_oid(relations, childOid);
+
+			rel = relation_open(childOid, AccessShareLock);
+			indexes = RelationGetIndexList(rel);
+			toastOid = rel->rd_rel->reltoastrelid;
+			relation_close(rel, AccessShareLock);
+
+			if (OidIsValid(toastOid))
+			{
+				relations = list_append_unique_oid(relations, toastOid);
+
+				rel = relation_open(toastOid, AccessShareLock);
+				relations = list_concat_unique_oid(relations,
+												   RelationGetIndexList(rel));
+				relation_close(rel, AccessShareLock);
+			}
+			relations = list_concat_unique_oid(relations, indexes);
+		}
+	}
+
+	return relations;
+}
+
+/*
+ * pgfincore_fork_range
+ * the forks to work on: the one named by the argument, or all of them when
+ * it is NULL
+ */
+static void
+pgfincore_fork_range(FunctionCallInfo fcinfo, int argno,
+					 ForkNumber *firstFork, ForkNumber *lastFork)
+{
+	if (PG_ARGISNULL(argno))
+	{
+		*firstFork = MAIN_FORKNUM;
+		*lastFork = MAX_FORKNUM;
+	}
+	else
+	{
+		*firstFork = forkname_to_number(text_to_cstring(PG_GETARG_TEXT_P(argno)));
+		*lastFork = *firstFork;
+	}
+}
+
+/*
+ * pgfincore_batch
+ * pgfincore on the segments of a list of relations, optionally with their
+ * partitions, indexes and TOAST, of one fork or of all the forks when the fork
+ * is NULL (the entire object). All the rows are returned at once in a
+ * tuplestore, the relations without storage (partitioned tables, views...)
+ * are skipped.
+ */
+PG_FUNCTION_INFO_V1(pgfincore_batch);
+Datum
+pgfincore_batch(PG_FUNCTION_ARGS)
+{
+	ArrayType		*relids		= PG_GETARG_ARRAYTYPE_P(0);
+	bool			getvector	= PG_GETARG_BOOL(2);
+	bool			dependents	= PG_GETARG_BOOL(3);
+	ForkNumber		firstFork;
+	ForkNumber		lastFork;
+	TupleDesc		tupdesc;
+	Tuplestorestate	*tupstore;
+	MemoryContext	tmpcontext;
+	List			*relations;
+	ListCell		*lc;
+
+	pgfincore_fork_range(fcinfo, 1, &firstFork, &lastFork);
+	tupstore = pgfincore_materialize(fcinfo, &tupdesc);
+	relations = pgfincore_relation_list(relids, dependents);
+
+	/* the memory used by a relation is released once it is done */
+	tmpcontext = AllocSetContextCreate(CurrentMemoryContext,
+									   "pgfincore batch",
+									   ALLOCSET_DEFAULT_SIZES);
+
+	foreach(lc, relations)
+	{
+		Oid				relOid = lfirst_oid(lc);
+		Relation		rel;
+		ForkNumber		forknum;
+		MemoryContext	oldcontext;
+
+		CHECK_FOR_INTERRUPTS();
+		oldcontext = MemoryContextSwitchTo(tmpcontext);
+
+		rel = relation_open(relOid, AccessShareLock);
+		for (forknum = firstFork;
+			 forknum <= lastFork && RELKIND_HAS_STORAGE(rel->rd_rel->relkind);
+			 forknum++)
+		{
+			char			*relationpath = relpathpg_forknum(rel, forknum);
+			char			filename[MAXPGPATH];
+			unsigned int	segno;
+
+			/* a missing fork has no first segment, thus no row */
+			elog(DEBUG1, "pgfincore: batch working on %s", relationpath);
+			for (segno = 0;; segno++)
+			{
+				pgfincoreStruct	pgfncr;
+				Datum			values[PGFINCORE_COLS + 2];
+				bool			nulls[PGFINCORE_COLS + 2];
+
+				pgfincore_segment_path(filename, relationpath, segno);
+				if (pgfincore_file(filename, getvector, 0, 0, &pgfncr))
+					break;
+
+				memset(nulls, 0, sizeof(nulls));
+				/* relation and fork, then the columns of pgfincore */
+				values[0] = ObjectIdGetDatum(relOid);
+				values[1] = CStringGetTextDatum(forkNames[forknum]);
+				pgfincore_values(filename, segno, &pgfncr,
+								 values + 2, nulls + 2);
+				tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+			}
+		}
+		relation_close(rel, AccessShareLock);
+
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(tmpcontext);
+	}
+
+	MemoryContextDelete(tmpcontext);
+
+	return (Datum) 0;
+}
+
+/*
+ * pgfadvise_batch
+ * pgfadvise on the segments of a list of relations, see pgfincore_batch
+ */
+PG_FUNCTION_INFO_V1(pgfadvise_batch);
+Datum
+pgfadvise_batch(PG_FUNCTION_ARGS)
+{
+	ArrayType		*relids		= PG_GETARG_ARRAYTYPE_P(0);
+	int				advice		= PG_GETARG_INT32(2);
+	bool			dependents	= PG_GETARG_BOOL(3);
+	ForkNumber		firstFork;
+	ForkNumber		lastFork;
+	TupleDesc		tupdesc;
+	Tuplestorestate	*tupstore;
+	MemoryContext	tmpcontext;
+	List			*relations;
+	ListCell		*lc;
+
+	pgfincore_fork_range(fcinfo, 1, &firstFork, &lastFork);
+	tupstore = pgfincore_materialize(fcinfo, &tupdesc);
+	relations = pgfincore_relation_list(relids, dependents);
+
+	/* the memory used by a relation is released once it is done */
+	tmpcontext = AllocSetContextCreate(CurrentMemoryContext,
+									   "pgfadvise batch",
+									   ALLOCSET_DEFAULT_SIZES);
+
+	foreach(lc, relations)
+	{
+		Oid				relOid = lfirst_oid(lc);
+		Relation		rel;
+		ForkNumber		forknum;
+		MemoryContext	oldcontext;
+
+		CHECK_FOR_INTERRUPTS();
+		oldcontext = MemoryContextSwitchTo(tmpcontext);
+
+		rel = relation_open(relOid, AccessShareLock);
+		for (forknum = firstFork;
+			 forknum <= lastFork && RELKIND_HAS_STORAGE(rel->rd_rel->relkind);
+			 forknum++)
+		{
+			char			*relationpath = relpathpg_forknum(rel, forknum);
+			char			filename[MAXPGPATH];
+			unsigned int	segno;
+
+			/* a missing fork has no first segment, thus no row */
+			elog(DEBUG1, "pgfadvise: batch working on %s, advice : %d",
+				 relationpath, advice);
+			for (segno = 0;; segno++)
+			{
+				pgfadviseStruct	pgfdv;
+				Datum			values[PGFADVISE_COLS + 2];
+				bool			nulls[PGFADVISE_COLS + 2];
+
+				pgfincore_segment_path(filename, relationpath, segno);
+				if (pgfadvise_file(filename, advice, 0, 0, &pgfdv))
+					break;
+
+				memset(nulls, 0, sizeof(nulls));
+				/* relation and fork, then the columns of pgfadvise */
+				values[0] = ObjectIdGetDatum(relOid);
+				values[1] = CStringGetTextDatum(forkNames[forknum]);
+				pgfadvise_values(filename, &pgfdv, values + 2);
+				tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+			}
+		}
+		relation_close(rel, AccessShareLock);
+
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(tmpcontext);
+	}
+
+	MemoryContextDelete(tmpcontext);
+
+	return (Datum) 0;
+}
+
+/*
+ * pgfincore_estimate
+ * estimate the pages in cache of a fork of a relation from a random sample
+ * of windows of window_pages os pages, taken in all its segments. Only the
+ * sampled windows are inspected, the cost is proportional to the sample.
+ * The estimate comes with a 95% confidence interval: the windows are
+ * clusters of pages and pages_mem is a ratio estimator of them.
+ */
+PG_FUNCTION_INFO_V1(pgfincore_estimate);
+Datum
+pgfincore_estimate(PG_FUNCTION_ARGS)
+{
+	Oid			relOid		= PG_GETARG_OID(0);
+	text		*forkName	= PG_GETARG_TEXT_P(1);
+	int			sample		= PG_GETARG_INT32(2);
+	int			windowPages	= PG_GETARG_INT32(3);
+	Relation	rel;
+	char		*relationpath;
+	char		filename[MAXPGPATH];
+	int64		pageSize = sysconf(_SC_PAGESIZE);
+	int64		*segPages;
+	int			nsegs = 0;
+	int			maxsegs = 16;
+	int64		relPages = 0;
+	int64		nwindows = 0;
+	BlockSamplerData bs;
+	int			segno = 0;
+	int64		segFirst = 0;	/* first window of segno */
+	int64		sampledPages = 0;
+	int64		sampledMem = 0;
+	double		*windowMem;
+	double		*windowPagesList;
+	int			n = 0;
+	double		estimate = 0;
+	double		low = 0;
+	double		high = 0;
+
+	/*
+	 * Postgresql stuff to return a tuple
+	 */
+	HeapTuple	tuple;
+	TupleDesc	tupdesc;
+	Datum		values[PGFINCORE_ESTIMATE_COLS];
+	bool		nulls[PGFINCORE_ESTIMATE_COLS];
+
+	if (sample <= 0 || windowPages <= 0)
+		elog(ERROR, "pgfincore_estimate: sample and window_pages must be positive");
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "pgfincore_estimate: return type must be a row type");
+
+	rel = relation_open(relOid, AccessShareLock);
+	relationpath = relpathpg(rel, forkName);
+
+	/* the size of each segment, to number the windows of the relation */
+	segPages = (int64 *) palloc(maxsegs * sizeof(int64));
+	for (;;)
+	{
+		struct stat	st;
+
+		pgfincore_segment_path(filename, relationpath, nsegs);
+		if (stat(filename, &st) != 0)
+			break;
+
+		if (nsegs == maxsegs)
+		{
+			maxsegs *= 2;
+			segPages = (int64 *) repalloc(segPages, maxsegs * sizeof(int64));
+		}
+		segPages[nsegs] = (st.st_size + pageSize - 1) / pageSize;
+		relPages += segPages[nsegs];
+		nwindows += (segPages[nsegs] + windowPages - 1) / windowPages;
+		nsegs++;
+	}
+
+	/*
+	 * Sample the windows, they come in order: walk the segments along. A
+	 * segment removed in the meantime ends the walk.
+	 */
+	nwindows = Min(nwindows, (int64) MaxBlockNumber);
+	BlockSampler_Init(&bs, (BlockNumber) nwindows, sample, random());
+	windowMem = (double *) palloc(Min(sample, nwindows + 1) * sizeof(double));
+	windowPagesList = (double *) palloc(Min(sample, nwindows + 1) * sizeof(double));
+	while (BlockSampler_HasMore(&bs))
+	{
+		int64			window = BlockSampler_Next(&bs);
+		pgfincoreStruct	pgfncr;
+
+		CHECK_FOR_INTERRUPTS();
+
+		while (window >= segFirst + (segPages[segno] + windowPages - 1) / windowPages)
+		{
+			segFirst += (segPages[segno] + windowPages - 1) / windowPages;
+			segno++;
+		}
+
+		pgfincore_segment_path(filename, relationpath, segno);
+		if (pgfincore_file(filename, false,
+						   (off_t) ((window - segFirst) * windowPages * pageSize),
+						   (off_t) windowPages * pageSize, &pgfncr))
+			break;
+
+		windowMem[n] = pgfncr.pages_mem;
+		windowPagesList[n] = pgfncr.rel_os_pages;
+		sampledPages += pgfncr.rel_os_pages;
+		sampledMem += pgfncr.pages_mem;
+		n++;
+	}
+	relation_close(rel, AccessShareLock);
+
+	if (sampledPages > 0)
+	{
+		double	ratio = (double) sampledMem / sampledPages;
+		double	meanPages = (double) sampledPages / n;
+		double	variance = 0;
+		double	margin;
+		int		i;
+
+		/*
+		 * variance of the ratio estimator, with the finite population
+		 * correction: it is 0 when all the windows are sampled. A single
+		 * window tells nothing about the others.
+		 */
+		for (i = 0; i < n; i++)
+			variance += (windowMem[i] - ratio * windowPagesList[i]) *
+						(windowMem[i] - ratio * windowPagesList[i]);
+		if (n >= nwindows)
+			margin = 0;
+		else if (n > 1)
+		{
+			variance = variance / (n - 1) / n / (meanPages * meanPages) *
+					   (1.0 - (double) n / nwindows);
+			margin = 1.96 * sqrt(variance);
+		}
+		else
+			margin = 1.0;
+
+		estimate = ratio * relPages;
+		low = Max(ratio - margin, 0.0) * relPages;
+		high = Min(ratio + margin, 1.0) * relPages;
+
+		/* what has been seen is known */
+		low = Max(low, (double) sampledMem);
+		high = Min(high, (double) (relPages - (sampledPages - sampledMem)));
+	}
+
+	/* initialize nulls array to build the tuple */
+	memset(nulls, 0, sizeof(nulls));
+
+	/* relation path */
+	values[0] = CStringGetTextDatum(relationpath);
+	/* os page size */
+	values[1] = Int64GetDatum(pageSize);
+	/* os pages of the relation */
+	values[2] = Int64GetDatum(relPages);
+	/* os pages inspected, and in cache */
+	values[3] = Int64GetDatum(sampledPages);
+	values[4] = Int64GetDatum(sampledMem);
+	/* the estimate and its confidence interval */
+	values[5] = Int64GetDatum((int64) rint(estimate));
+	values[6] = Int64GetDatum((int64) floor(low));
+	values[7] = Int64GetDatum((int64) ceil(high));
+
+	/* Build and return the result tuple. */
+	tuple = heap_form_tuple(tupdesc, values, nulls);
+	PG_RETURN_DATUM( HeapTupleGetDatum(tuple) );
+}
+
+/*
+ * pgfincore_blocks
+ * one row per PostgreSQL block, with the OS pages of the block in the page
+ * cache: full, partial or absent. The block numbers are global across
+ * segments, as relblocknumber in pg_buffercache.
+ */
+PG_FUNCTION_INFO_V1(pgfincore_blocks);
+Datum
+pgfincore_blocks(PG_FUNCTION_ARGS)
+{
+	/* SRF Stuff */
+	FuncCallContext			*funcctx;
+	pgfincore_blocks_fctx	*fctx;
+
+	/*
+	 * Postgresql stuff to return a tuple
+	 */
+	HeapTuple	tuple;
+	Datum		values[PGFINCORE_BLOCKS_COLS];
+	bool		nulls[PGFINCORE_BLOCKS_COLS];
+
+	/* pages of the current block */
+	int64		firstPage;
+	int64		lastPage;
+	int64		page;
+	int			pagesMem = 0;
+	int64		nbPages;
+	bits8		*bits;
+
+	/* stuff done only on the first call of the function */
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+
+		Oid		relOid    = PG_GETARG_OID(0);
+		text	*forkName = PG_GETARG_TEXT_P(1);
+
+		TupleDesc	tupdesc;
+
+		/* create a function context for cross-call persistence */
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		/*
+		 * switch to memory context appropriate for multiple function calls
+		 */
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		/* allocate memory for user context */
+		fctx = (pgfincore_blocks_fctx *) palloc0(sizeof(pgfincore_blocks_fctx));
+
+		/* Build a tuple descriptor for our result type */
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "pgfincore_blocks: return type must be a row type");
+
+		/* provide the tuple descriptor to the fonction structure */
+		fctx->tupd = tupdesc;
+
+		/* open the current relation, accessShareLock */
+		fctx->rel = relation_open(relOid, AccessShareLock);
+
+		/* we get the common part of the filename of each segment of a relation */
+		fctx->relationpath = relpathpg(fctx->rel, forkName);
+
+		/* the block range, if any */
+		pgfincore_block_range(fcinfo, 2, &fctx->startBlock, &fctx->endBlock);
+
+		/* we start with the segment of the first block */
+		fctx->segcount = fctx->startBlock / RELSEG_SIZE;
+
+		elog(DEBUG1, "pgfincore_blocks: init done for %s, in fork %s",
 					fctx->relationpath, text_to_cstring(forkName));
 		funcctx->user_fctx = fctx;
 		MemoryContextSwitchTo(oldcontext);
 	}
 
-	/* After the first call, we recover our context */
-	funcctx = SRF_PERCALL_SETUP();
-	fctx = funcctx->user_fctx;
+	/* After the first call, we recover our context */
+	funcctx = SRF_PERCALL_SETUP();
+	fctx = funcctx->user_fctx;
+
+	/*
+	 * Once all the blocks of a segment are returned, get the map of the
+	 * next one
+	 */
+	while (fctx->block >= fctx->lastBlock)
+	{
+		MemoryContext	oldcontext;
+		pgfincoreStruct	pgfncr;
+		char			filename[MAXPGPATH];
+		off_t			offset;
+		off_t			len;
+		int				result = 1;
+
+		if (fctx->started)
+			fctx->segcount++;
+		fctx->started = true;
+		if (fctx->databit != NULL)
+			pfree(fctx->databit);
+		fctx->databit = NULL;
+
+		pgfincore_segment_path(filename, fctx->relationpath, fctx->segcount);
+
+		/* the map must survive the call */
+		if (pgfincore_segment_range(fctx->startBlock, fctx->endBlock,
+									fctx->segcount, &offset, &len))
+		{
+			oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+			result = pgfincore_file(filename, true, offset, len, &pgfncr);
+			MemoryContextSwitchTo(oldcontext);
+		}
+
+		/* past the range or the last segment, we are done */
+		if (result)
+		{
+			elog(DEBUG1, "pgfincore_blocks: closing %s", fctx->relationpath);
+			relation_close(fctx->rel, AccessShareLock);
+			pfree(fctx);
+			SRF_RETURN_DONE(funcctx);
+		}
+
+		fctx->databit	= pgfncr.databit;
+		fctx->pageSize	= pgfncr.pageSize;
+		fctx->bitBase	= offset / pgfncr.pageSize * pgfncr.pageSize;
+		fctx->block		= offset / BLCKSZ;
+		fctx->lastBlock	= (pgfncr.rangeEnd + BLCKSZ - 1) / BLCKSZ;
+	}
+
+	/*
+	 * the OS pages covering the block, some may be past the end of the map
+	 * on a truncated block
+	 */
+	nbPages		= fctx->databit ? VARBITLEN(fctx->databit) / FINCORE_BITS : 0;
+	firstPage	= ((off_t) fctx->block * BLCKSZ - fctx->bitBase) / fctx->pageSize;
+	lastPage	= ((off_t) (fctx->block + 1) * BLCKSZ - 1 - fctx->bitBase) /
+		fctx->pageSize;
+	lastPage	= Min(lastPage, nbPages - 1);
+	bits		= fctx->databit ? VARBITS(fctx->databit) : NULL;
+	for (page = firstPage; page <= lastPage; page++)
+	{
+		int64	bit = page * FINCORE_BITS;
+
+		if (bits[bit / BITS_PER_BYTE] & (HIGHBIT >> (bit % BITS_PER_BYTE)))
+			pagesMem++;
+	}
+
+	/* initialize nulls array to build the tuple */
+	memset(nulls, 0, sizeof(nulls));
+
+	/* block number in the relation */
+	values[0] = Int64GetDatum((int64) fctx->segcount * RELSEG_SIZE + fctx->block);
+	/* Segment Number */
+	values[1] = Int32GetDatum(fctx->segcount);
+	/* os pages of the block */
+	values[2] = Int32GetDatum((int32) Max(lastPage - firstPage + 1, 0));
+	/* os pages of the block in os cache */
+	values[3] = Int32GetDatum(pagesMem);
+	/* state of the block */
+	if (pagesMem == 0)
+		values[4] = CStringGetTextDatum("absent");
+	else if (pagesMem == lastPage - firstPage + 1)
+		values[4] = CStringGetTextDatum("full");
+	else
+		values[4] = CStringGetTextDatum("partial");
+
+	/* Build the result tuple. */
+	tuple = heap_form_tuple(fctx->tupd, values, nulls);
+
+	/* prepare the next block */
+	fctx->block++;
+
+	/* Ok, return results, and go for next call */
+	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+}
+
+/*
+ * pgfincore_ranges
+ * the runs of contiguous pages in cache of a relation fork, one row per run:
+ * its first OS page in the relation, its number of pages, and if they are
+ * dirty (only with fincore). A run does not cross a segment.
+ */
+PG_FUNCTION_INFO_V1(pgfincore_ranges);
+Datum
+pgfincore_ranges(PG_FUNCTION_ARGS)
+{
+	Oid						relOid		= PG_GETARG_OID(0);
+	text					*forkName	= PG_GETARG_TEXT_P(1);
+	pgfincore_range_writer	ranges;
+	pgfincoreStruct			pgfncr;
+	TupleDesc				tupdesc;
+	Relation				rel;
+	char					*relationpath;
+	char					filename[MAXPGPATH];
+	unsigned int			segno;
+
+	memset(&ranges, 0, sizeof(ranges));
+	ranges.tupstore	= pgfincore_materialize(fcinfo, &tupdesc);
+	ranges.tupdesc	= tupdesc;
+	ranges.segPages	= (int64) RELSEG_SIZE * BLCKSZ / sysconf(_SC_PAGESIZE);
+	ranges.start	= -1;
+
+	rel = relation_open(relOid, AccessShareLock);
+	relationpath = relpathpg(rel, forkName);
+
+	/* up to the last segment */
+	for (segno = 0;; segno++)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		pgfincore_segment_path(filename, relationpath, segno);
+		ranges.segno = segno;
+		if (pgfincore_file_ranges(filename, false, 0, 0, &pgfncr, &ranges))
+			break;
+	}
+
+	relation_close(rel, AccessShareLock);
+
+	return (Datum) 0;
+}
+
+static int
+pgfincore_range_cmp(const void *a, const void *b)
+{
+	const pgfincore_range *ra = (const pgfincore_range *) a;
+	const pgfincore_range *rb = (const pgfincore_range *) b;
+
+	if (ra->start != rb->start)
+		return ra->start < rb->start ? -1 : 1;
+	return 0;
+}
+
+/*
+ * pgfadvise_loader_ranges
+ * load the ranges of OS pages of a relation fork, given by their first page
+ * and their number of pages as returned by pgfincore_ranges. The ranges are
+ * sorted and merged, then each run is loaded with a single WILLNEED call.
+ * One row per segment with pages to load.
+ */
+PG_FUNCTION_INFO_V1(pgfadvise_loader_ranges);
+Datum
+pgfadvise_loader_ranges(PG_FUNCTION_ARGS)
+{
+	Oid				relOid		= PG_GETARG_OID(0);
+	text			*forkName	= PG_GETARG_TEXT_P(1);
+	Datum			*starts;
+	Datum			*lengths;
+	bool			*startNulls;
+	bool			*lengthNulls;
+	int				nstarts;
+	int				nlengths;
+	pgfincore_range	*range;
+	int				nranges = 0;
+	int				i;
+	int64			segPages;
+	bits8			*bits;
+	Tuplestorestate	*tupstore;
+	TupleDesc		tupdesc;
+	Relation		rel;
+	char			*relationpath;
+
+	if (PG_ARGISNULL(2) || PG_ARGISNULL(3))
+		elog(ERROR, "pgfadvise_loader_ranges: starts and lengths shouldn't be NULL");
+
+	deconstruct_array(PG_GETARG_ARRAYTYPE_P(2), INT8OID, sizeof(int64),
+					  FLOAT8PASSBYVAL, 'd', &starts, &startNulls, &nstarts);
+	deconstruct_array(PG_GETARG_ARRAYTYPE_P(3), INT8OID, sizeof(int64),
+					  FLOAT8PASSBYVAL, 'd', &lengths, &lengthNulls, &nlengths);
+	if (nstarts != nlengths)
+		elog(ERROR, "pgfadvise_loader_ranges: starts and lengths must have the same number of elements");
+
+	range = (pgfincore_range *) palloc(Max(nstarts, 1) * sizeof(pgfincore_range));
+	for (i = 0; i < nstarts; i++)
+	{
+		int64	start;
+		int64	len;
+
+		if (startNulls[i] || lengthNulls[i])
+			elog(ERROR, "pgfadvise_loader_ranges: starts and lengths must not contain NULL");
+		start	= DatumGetInt64(starts[i]);
+		len		= DatumGetInt64(lengths[i]);
+		if (start < 0 || len < 0 || len > PG_INT64_MAX - start)
+			elog(ERROR, "pgfadvise_loader_ranges: invalid range %lld, %lld",
+				 (long long int) start, (long long int) len);
+		if (len == 0)
+			continue;
+		range[nranges].start	= start;
+		range[nranges].end		= start + len;
+		nranges++;
+	}
+
+	/* sorted and merged: the ranges are disjoint and their ends sorted too */
+	qsort(range, nranges, sizeof(pgfincore_range), pgfincore_range_cmp);
+	if (nranges > 0)
+	{
+		int		n = 0;
+
+		for (i = 1; i < nranges; i++)
+		{
+			if (range[i].start <= range[n].end)
+				range[n].end = Max(range[n].end, range[i].end);
+			else
+				range[++n] = range[i];
+		}
+		nranges = n + 1;
+	}
+
+	tupstore	= pgfincore_materialize(fcinfo, &tupdesc);
+	segPages	= (int64) RELSEG_SIZE * BLCKSZ / sysconf(_SC_PAGESIZE);
+	bits		= (bits8 *) palloc((segPages + BITS_PER_BYTE - 1) / BITS_PER_BYTE);
+
+	rel = relation_open(relOid, AccessShareLock);
+	relationpath = relpathpg(rel, forkName);
+
+	i = 0;
+	while (i < nranges)
+	{
+		int64			segno = range[i].start / segPages;
+		int64			segStart = segno * segPages;
+		int64			segEnd = segStart + segPages;
+		int64			bitlen = 0;
+		pgfincore_runs	runs;
+		pgfloaderStruct	pgfloader;
+		char			filename[MAXPGPATH];
+		Datum			values[PGFADVISE_LOADER_COLS];
+		bool			nulls[PGFADVISE_LOADER_COLS];
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (segno > INT_MAX)
+			break;
+
+		/* the ranges in the segment, the last one may go on in the next */
+		memset(bits, 0, (segPages + BITS_PER_BYTE - 1) / BITS_PER_BYTE);
+		for (; i < nranges && range[i].start < segEnd; i++)
+		{
+			bitlen = Min(range[i].end, segEnd) - segStart;
+			pgfincore_bitmap_set(bits, Max(range[i].start, segStart) - segStart,
+								 bitlen);
+			if (range[i].end > segEnd)
+			{
+				range[i].start = segEnd;
+				break;
+			}
+		}
+
+		pgfincore_segment_path(filename, relationpath, (unsigned int) segno);
+		pgfincore_runs_bitmap(&runs, bits, bitlen);
+
+		/* past the last segment, we are done */
+		if (pgfadvise_loader_file(filename, true, false, &runs, NULL,
+								  &pgfloader) != 0)
+			break;
+
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = CStringGetTextDatum(filename);
+		values[1] = Int64GetDatum(pgfloader.pageSize);
+		values[2] = Int64GetDatum(pgfloader.pagesFree);
+		values[3] = Int64GetDatum(pgfloader.pagesLoaded);
+		values[4] = Int64GetDatum(pgfloader.pagesUnloaded);
+		values[5] = Int64GetDatum(pgfloader.syscalls);
+		values[6] = Int64GetDatum(pgfloader.pagesSkipped);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	relation_close(rel, AccessShareLock);
+
+	return (Datum) 0;
+}
+
+static int
+pgfincore_block_cmp(const void *a, const void *b)
+{
+	BlockNumber	ba = *(const BlockNumber *) a;
+	BlockNumber	bb = *(const BlockNumber *) b;
+
+	return (ba > bb) - (ba < bb);
+}
+
+/*
+ * pgfincore_shared_blocks
+ * walk the buffer descriptors and return the blocks of a fork of the
+ * relation which are valid in shared_buffers, or in the local buffers for a
+ * temporary relation. The blocks are sorted.
+ */
+static BlockNumber *
+pgfincore_shared_blocks(Relation rel, ForkNumber forknum, int *nblocks)
+{
+	bool		local = RelationUsesLocalBuffers(rel);
+	int			nbuffers = local ? NLocBuffer : NBuffers;
+	int			size = 1024;
+	BlockNumber	*blocks = palloc(size * sizeof(BlockNumber));
+	int			i;
+
+	*nblocks = 0;
+	for (i = 0; i < nbuffers; i++)
+	{
+		BufferDesc	*bufHdr;
+		BufferTag	tag;
+		bool		valid;
+#if PG_VERSION_NUM >= 90600
+		uint32		buf_state;
+#endif
+
+		/*
+		 * As pg_buffercache, the header is locked to read a consistent tag,
+		 * the local buffers are only used by this backend
+		 */
+		if (local)
+		{
+			bufHdr = GetLocalBufferDescriptor(i);
+#if PG_VERSION_NUM >= 90600
+			buf_state = pg_atomic_read_u32(&bufHdr->state);
+			valid = (buf_state & BM_VALID) != 0;
+#else
+			valid = (bufHdr->flags & BM_VALID) != 0;
+#endif
+			tag = bufHdr->tag;
+		}
+		else
+		{
+			bufHdr = GetBufferDescriptor(i);
+#if PG_VERSION_NUM >= 90600
+			buf_state = LockBufHdr(bufHdr);
+			tag = bufHdr->tag;
+			valid = (buf_state & BM_VALID) != 0;
+			UnlockBufHdr(bufHdr, buf_state);
+#else
+			LockBufHdr(bufHdr);
+			tag = bufHdr->tag;
+			valid = (bufHdr->flags & BM_VALID) != 0;
+			UnlockBufHdr(bufHdr);
+#endif
+		}
+
+		if (!valid || !pgfincore_buftag_matches(tag, rel, forknum))
+			continue;
+
+		if (*nblocks == size)
+		{
+			size *= 2;
+			blocks = repalloc(blocks, size * sizeof(BlockNumber));
+		}
+		blocks[(*nblocks)++] = tag.blockNum;
+	}
+
+	qsort(blocks, *nblocks, sizeof(BlockNumber), pgfincore_block_cmp);
+	return blocks;
+}
+
+#if defined(USE_POSIX_FADVISE)
+/*
+ * pgfincore_double_evict
+ * DONTNEED on a run of pages also in shared_buffers, unless cachestat tells
+ * some of them are dirty or under writeback: the run is kept then.
+ */
+static void
+pgfincore_double_evict(int fd, size_t pageSize, int64 runStart, int64 runEnd,
+					   int64 *pagesEvicted)
+{
+	pgfincoreStruct	cs;
+	off_t			offset = (off_t) runStart * pageSize;
+	off_t			len = (off_t) (runEnd - runStart) * pageSize;
+
+	if (runEnd <= runStart)
+		return;
+
+	memset(&cs, 0, sizeof(cs));
+	if (pgfincore_cachestat_file(fd, offset, len, &cs) &&
+		cs.pages_dirty + cs.pages_writeback > 0)
+		return;
+
+	(void) posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+	*pagesEvicted += runEnd - runStart;
+}
+#endif
+
+/*
+ * pgfincore_double_file
+ * count the OS pages in cache of the blocks of a segment which are also in
+ * shared_buffers, the blocks are relative to the segment and sorted.
+ * With evict, the clean ones are removed from the OS cache. An OS page
+ * larger than a block may hold blocks not in shared_buffers, it is never
+ * removed.
+ */
+static int
+pgfincore_double_file(char *filename, const BlockNumber *blocks, int nblocks,
+					  bool evict, int64 *pagesDouble, int64 *pagesEvicted)
+{
+	pgfincoreStruct	pgfncr;
+	off_t		offset = (off_t) blocks[0] * BLCKSZ;
+	off_t		len = (off_t) (blocks[nblocks - 1] + 1 - blocks[0]) * BLCKSZ;
+	off_t		bitBase;
+	int64		nbPages;
+	int64		runStart = 0;
+	int64		runEnd = 0;
+	bits8		*bits;
+	FILE		*fp = NULL;
+	int			result;
+	int			i;
+
+	*pagesDouble	= 0;
+	*pagesEvicted	= 0;
+
+	/* only the range from the first to the last block is inspected */
+	result = pgfincore_file(filename, true, offset, len, &pgfncr);
+	if (result != 0 || pgfncr.databit == NULL)
+		return result;
+
+	bitBase	= offset / pgfncr.pageSize * pgfncr.pageSize;
+	nbPages	= VARBITLEN(pgfncr.databit) / FINCORE_BITS;
+	bits	= VARBITS(pgfncr.databit);
+
+	if (evict && pgfncr.pageSize <= BLCKSZ)
+	{
+#if defined(USE_POSIX_FADVISE)
+		fp = AllocateFile(filename, "rb");
+#else
+		elog(ERROR, "POSIX_FADVISE UNSUPPORTED on your platform");
+#endif
+	}
+
+	for (i = 0; i < nblocks; i++)
+	{
+		int64	firstPage;
+		int64	lastPage;
+		int64	page;
+
+		firstPage	= ((off_t) blocks[i] * BLCKSZ - bitBase) / pgfncr.pageSize;
+		lastPage	= ((off_t) (blocks[i] + 1) * BLCKSZ - 1 - bitBase) /
+			pgfncr.pageSize;
+		lastPage	= Min(lastPage, nbPages - 1);
+
+		/* a large OS page is counted once for all its blocks */
+		if (i > 0 && blocks[i - 1] * (off_t) BLCKSZ / pgfncr.pageSize ==
+			blocks[i] * (off_t) BLCKSZ / pgfncr.pageSize)
+			firstPage++;
+
+		for (page = firstPage; page <= lastPage; page++)
+		{
+			int64	bit = page * FINCORE_BITS;
+
+			if (!(bits[bit / BITS_PER_BYTE] & (HIGHBIT >> (bit % BITS_PER_BYTE))))
+				continue;
+			(*pagesDouble)++;
+#ifdef HAVE_FINCORE
+			/* the second bit of the page tells it is dirty */
+			bit++;
+			if (bits[bit / BITS_PER_BYTE] & (HIGHBIT >> (bit % BITS_PER_BYTE)))
+				continue;
+#endif
+#if defined(USE_POSIX_FADVISE)
+			if (fp == NULL)
+				continue;
+
+			/* the contiguous pages are removed with a single call */
+			if (bitBase / (off_t) pgfncr.pageSize + page != runEnd)
+			{
+				pgfincore_double_evict(fileno(fp), pgfncr.pageSize,
+									   runStart, runEnd, pagesEvicted);
+				runStart = bitBase / pgfncr.pageSize + page;
+			}
+			runEnd = bitBase / pgfncr.pageSize + page + 1;
+#endif
+		}
+	}
+
+#if defined(USE_POSIX_FADVISE)
+	if (fp != NULL)
+	{
+		pgfincore_double_evict(fileno(fp), pgfncr.pageSize,
+							   runStart, runEnd, pagesEvicted);
+		FreeFile(fp);
+	}
+#endif
+	pfree(pgfncr.databit);
+
+	return 0;
+}
+
+/*
+ * pgfincore_double_done
+ * close the relation and release the memory of the call
+ */
+static void
+pgfincore_double_done(pgfincore_double_fctx *fctx)
+{
+	elog(DEBUG1, "pgfincore_double_buffered: closing %s", fctx->relationpath);
+	relation_close(fctx->rel, AccessShareLock);
+	pfree(fctx->blocks);
+	pfree(fctx->relationpath);
+	pfree(fctx);
+}
+
+/*
+ * pgfincore_double_buffered
+ * one row per segment with the blocks of the relation in shared_buffers,
+ * and how many of their OS pages are in the page cache too: they are cached
+ * twice. With evict, the clean ones are removed from the page cache.
+ */
+PG_FUNCTION_INFO_V1(pgfincore_double_buffered);
+Datum
+pgfincore_double_buffered(PG_FUNCTION_ARGS)
+{
+	/* SRF Stuff */
+	FuncCallContext			*funcctx;
+	pgfincore_double_fctx	*fctx;
+
+	/* The file we are working on */
+	char			filename[MAXPGPATH];
+	struct stat		st;
+
+	/* the blocks of the current segment */
+	BlockNumber		*segBlocks;
+	int				nsegBlocks = 0;
+	int64			pagesDouble = 0;
+	int64			pagesEvicted = 0;
+	int				i;
+
+	/*
+	 * Postgresql stuff to return a tuple
+	 */
+	HeapTuple	tuple;
+	Datum		values[PGFINCORE_DOUBLE_COLS];
+	bool		nulls[PGFINCORE_DOUBLE_COLS];
+
+	/* stuff done only on the first call of the function */
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+
+		Oid		relOid    = PG_GETARG_OID(0);
+		text	*forkName = PG_GETARG_TEXT_P(1);
+		bool	evict     = PG_GETARG_BOOL(2);
+		ForkNumber	forknum = forkname_to_number(text_to_cstring(forkName));
+
+		TupleDesc	tupdesc;
+
+		/* create a function context for cross-call persistence */
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		/*
+		 * switch to memory context appropriate for multiple function calls
+		 */
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		/* allocate memory for user context */
+		fctx = (pgfincore_double_fctx *) palloc(sizeof(pgfincore_double_fctx));
+
+		/* Build a tuple descriptor for our result type */
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "pgfincore_double_buffered: return type must be a row type");
+
+		/* provide the tuple descriptor to the fonction structure */
+		fctx->tupd = tupdesc;
+
+		/* open the current relation, accessShareLock */
+		fctx->rel = relation_open(relOid, AccessShareLock);
+
+		/* we get the common part of the filename of each segment of a relation */
+		fctx->relationpath = relpathpg(fctx->rel, forkName);
+
+		/* segcount is used to get the next segment of the current relation */
+		fctx->segcount = 0;
+
+		/* the blocks in shared_buffers, sorted */
+		fctx->blocks = pgfincore_shared_blocks(fctx->rel, forknum,
+											   &fctx->nblocks);
+		fctx->next = 0;
+		fctx->evict = evict;
+
+		elog(DEBUG1, "pgfincore_double_buffered: init done for %s, in fork %s, %d blocks in shared_buffers",
+			 fctx->relationpath, text_to_cstring(forkName), fctx->nblocks);
+		funcctx->user_fctx = fctx;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	/* After the first call, we recover our context */
+	funcctx = SRF_PERCALL_SETUP();
+	fctx = funcctx->user_fctx;
+
+	/*
+	 * When we have work with all segments of the current relation
+	 * We exit from the SRF
+	 */
+	pgfincore_segment_path(filename, fctx->relationpath, fctx->segcount);
+	if (stat(filename, &st) != 0)
+	{
+		pgfincore_double_done(fctx);
+		SRF_RETURN_DONE(funcctx);
+	}
+
+	/* the blocks of this segment, relative to it */
+	segBlocks = palloc(Max(fctx->nblocks - fctx->next, 1) * sizeof(BlockNumber));
+	for (i = fctx->next;
+		 i < fctx->nblocks && fctx->blocks[i] / RELSEG_SIZE == fctx->segcount;
+		 i++)
+		segBlocks[nsegBlocks++] = fctx->blocks[i] % RELSEG_SIZE;
+	fctx->next = i;
+
+	/* the segment may have been removed meanwhile */
+	if (nsegBlocks > 0 &&
+		pgfincore_double_file(filename, segBlocks, nsegBlocks, fctx->evict,
+							  &pagesDouble, &pagesEvicted) != 0)
+	{
+		pfree(segBlocks);
+		pgfincore_double_done(fctx);
+		SRF_RETURN_DONE(funcctx);
+	}
+	pfree(segBlocks);
+
+	/* initialize nulls array to build the tuple */
+	memset(nulls, 0, sizeof(nulls));
+
+	/* Filename */
+	values[0] = CStringGetTextDatum(filename);
+	/* Segment Number */
+	values[1] = Int32GetDatum(fctx->segcount);
+	/* blocks in shared_buffers */
+	values[2] = Int64GetDatum((int64) nsegBlocks);
+	/* their pages in the OS cache */
+	values[3] = Int64GetDatum(pagesDouble);
+	/* and the pages removed from it */
+	values[4] = Int64GetDatum(pagesEvicted);
+
+	/* Build the result tuple. */
+	tuple = heap_form_tuple(fctx->tupd, values, nulls);
+
+	/* prepare the number of the next segment */
+	fctx->segcount++;
+
+	/* Ok, return results, and go for next call */
+	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+}
+
+/*
+ * pgfincore_drawer A very naive renderer. (for testing)
+ */
+PG_FUNCTION_INFO_V1(pgfincore_drawer);
+Datum
+pgfincore_drawer(PG_FUNCTION_ARGS)
+{
+        char *result,
+             *r;
+	int  len,i,k;
+	VarBit *databit;
+	bits8 *sp;
+	bits8 x;
+
+	if (PG_ARGISNULL(0))
+		elog(ERROR, "pgfincore_drawer: databit argument shouldn't be NULL");
+
+        databit	= PG_GETARG_VARBIT_P(0);
+
+	len =  VARBITLEN(databit);
+	result = (char *) palloc((len/FINCORE_BITS) + 1);
+	sp = VARBITS(databit);
+	r = result;
+
+	for (i = 0; i <= len - BITS_PER_BYTE; i += BITS_PER_BYTE, sp++)
+	{
+		x = *sp;
+		/*  Is this bit set ? */
+		for (k = 0; k < (BITS_PER_BYTE/FINCORE_BITS); k++)
+		{
+		  char out = ' ';
+			if (IS_HIGHBIT_SET(x))
+			  out = '.' ;
+			x <<= 1;
+			if (FINCORE_BITS > 1)
+			{
+				if (IS_HIGHBIT_SET(x))
+					out = '*';
+				x <<= 1;
+			}
+			*r++ = out;
+		}
+	}
+	if (i < len)
+	{
+		/* print the last partial byte */
+		x = *sp;
+		for (k = i; k < (len/FINCORE_BITS); k++)
+		{
+		        char out = ' ';
+			if (IS_HIGHBIT_SET(x))
+			  out = '.' ;
+			x <<= 1;
+			if (FINCORE_BITS > 1)
+			{
+				if (IS_HIGHBIT_SET(x))
+					out = '*';
+				x <<= 1;
+			}
+			*r++ = out;
+		}
+	}
+
+	*r = '\0';
+	PG_RETURN_CSTRING(result);
+}
+
+/*
+ * pgfincore_drawer_map
+ * same as pgfincore_drawer with a pgfincore_map, drawn run by run
+ */
+PG_FUNCTION_INFO_V1(pgfincore_drawer_map);
+Datum
+pgfincore_drawer_map(PG_FUNCTION_ARGS)
+{
+	char			*result;
+	pgfincore_runs	runs;
+	int64			start, end, i;
+	bool			set;
+
+	if (PG_ARGISNULL(0))
+		elog(ERROR, "pgfincore_drawer: map argument shouldn't be NULL");
+
+	pgfincore_runs_map(&runs, PG_GETARG_PGFINCORE_MAP_P(0));
+
+	result = (char *) palloc((runs.bitlen / FINCORE_BITS) + 1);
+	while (pgfincore_runs_next(&runs, &start, &end, &set))
+	{
+		if (FINCORE_BITS == 1)
+		{
+			memset(result + start, set ? '.' : ' ', end - start);
+			continue;
+		}
+		/* the first bit of a page is in memory, the second one dirty */
+		for (i = start; i < end; i++)
+		{
+			if (i % FINCORE_BITS == 0)
+				result[i / FINCORE_BITS] = set ? '.' : ' ';
+			else if (set)
+				result[i / FINCORE_BITS] = '*';
+		}
+	}
+	result[runs.bitlen / FINCORE_BITS] = '\0';
+	PG_RETURN_CSTRING(result);
+}
+
+/*
+ * pgfincore_map_build
+ * build a pgfincore_map from nruns runs, first one of unset bits. runs is
+ * NULL when the bit string bits is the source. The runs are stored unless
+ * the bit string is smaller.
+ */
+static PgfincoreMap *
+pgfincore_map_build(const bits8 *bits, int64 bitlen,
+					const int64 *runlens, int64 nruns)
+{
+	PgfincoreMap	*map;
+	pgfincore_runs	runs;
+	int64			nbytes = (bitlen + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+	int64			start, end, i;
+	int64			size = 0;
+	bool			set;
+	uint8			*p;
+
+	/* the map must be castable to varbit */
+	if (bitlen > VARBITMAXLEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("pgfincore_map length exceeds the maximum allowed (%d)",
+						VARBITMAXLEN)));
+
+	/* size of the runs, the first one of unset bits */
+	if (runlens != NULL)
+	{
+		for (i = 0; i < nruns && size <= nbytes; i++)
+			size += pgfincore_map_len(runlens[i]);
+	}
+	else
+	{
+		pgfincore_runs_bitmap(&runs, bits, bitlen);
+		while (size <= nbytes && pgfincore_runs_next(&runs, &start, &end, &set))
+		{
+			if (start == 0 && set)
+				size++;
+			size += pgfincore_map_len(end - start);
+		}
+	}
+
+	map = (PgfincoreMap *) palloc0(VARHDRSZ + 1 + 10 + Min(size, nbytes));
+	p = map->data;
+	if (size <= nbytes)
+	{
+		*p++ = PGF_MAP_RUNS;
+		p = pgfincore_map_put(p, bitlen);
+		if (runlens != NULL)
+		{
+			for (i = 0; i < nruns; i++)
+				p = pgfincore_map_put(p, runlens[i]);
+		}
+		else
+		{
+			pgfincore_runs_bitmap(&runs, bits, bitlen);
+			while (pgfincore_runs_next(&runs, &start, &end, &set))
+			{
+				if (start == 0 && set)
+					p = pgfincore_map_put(p, 0);
+				p = pgfincore_map_put(p, end - start);
+			}
+		}
+	}
+	else
+	{
+		*p++ = PGF_MAP_BITMAP;
+		p = pgfincore_map_put(p, bitlen);
+		if (runlens != NULL)
+		{
+			/* p is zeroed, set the runs of set bits */
+			for (i = 1, start = runlens[0]; i < nruns; i += 2)
+			{
+				for (end = start + runlens[i]; start < end; start++)
+					p[start / BITS_PER_BYTE] |= 0x80 >> (start % BITS_PER_BYTE);
+				if (i + 1 < nruns)
+					start += runlens[i + 1];
+			}
+		}
+		else
+			memcpy(p, bits, nbytes);
+		p += nbytes;
+	}
+	SET_VARSIZE(map, p - (uint8 *) map);
+	return map;
+}
+
+/*
+ * pgfincore_map_in
+ * the text representation is the list of the lengths of the runs, the first
+ * one of unset bits: '0,3,3,1' is B'1110001'
+ */
+PG_FUNCTION_INFO_V1(pgfincore_map_in);
+Datum
+pgfincore_map_in(PG_FUNCTION_ARGS)
+{
+	char	*str = PG_GETARG_CSTRING(0);
+	char	*s = str;
+	int64	*runlens;
+	int64	nruns = 0;
+	int64	maxruns = 16;
+	int64	bitlen = 0;
+
+	runlens = (int64 *) palloc(maxruns * sizeof(int64));
+	for (;;)
+	{
+		char	*endptr;
+		long long int	len;
+
+		errno = 0;
+		len = strtoll(s, &endptr, 10);
+		if (endptr == s || errno != 0 || len < 0 || *s == '-' ||
+			len > PG_INT64_MAX - bitlen ||
+			(len == 0 && nruns > 0))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					 errmsg("invalid input syntax for type %s: \"%s\"",
+							"pgfincore_map", str)));
+		if (nruns == maxruns)
+		{
+			maxruns *= 2;
+			runlens = (int64 *) repalloc(runlens, maxruns * sizeof(int64));
+		}
+		runlens[nruns++] = len;
+		bitlen += len;
+
+		s = endptr;
+		if (*s == '\0')
+			break;
+		if (*s != ',')
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					 errmsg("invalid input syntax for type %s: \"%s\"",
+							"pgfincore_map", str)));
+		s++;
+	}
+	/* '0' is the empty bit string, it has no run */
+	if (bitlen == 0)
+		nruns = 0;
+
+	PG_RETURN_POINTER(pgfincore_map_build(NULL, bitlen, runlens, nruns));
+}
+
+PG_FUNCTION_INFO_V1(pgfincore_map_out);
+Datum
+pgfincore_map_out(PG_FUNCTION_ARGS)
+{
+	pgfincore_runs	runs;
+	StringInfoData	buf;
+	int64			start, end;
+	bool			set;
+
+	pgfincore_runs_map(&runs, PG_GETARG_PGFINCORE_MAP_P(0));
+
+	initStringInfo(&buf);
+	while (pgfincore_runs_next(&runs, &start, &end, &set))
+	{
+		if (start == 0 && set)
+			appendStringInfoString(&buf, "0,");
+		else if (start > 0)
+			appendStringInfoChar(&buf, ',');
+		appendStringInfo(&buf, INT64_FORMAT, end - start);
+	}
+	if (runs.bitlen == 0)
+		appendStringInfoChar(&buf, '0');
+
+	PG_RETURN_CSTRING(buf.data);
+}
+
+/*
+ * pgfincore_map_from_varbit
+ * cast varbit to pgfincore_map
+ */
+PG_FUNCTION_INFO_V1(pgfincore_map_from_varbit);
+Datum
+pgfincore_map_from_varbit(PG_FUNCTION_ARGS)
+{
+	VarBit	*databit = PG_GETARG_VARBIT_P(0);
+
+	PG_RETURN_POINTER(pgfincore_map_build(VARBITS(databit),
+										  VARBITLEN(databit), NULL, 0));
+}
+
+/*
+ * pgfincore_map_to_varbit
+ * cast pgfincore_map to varbit
+ */
+PG_FUNCTION_INFO_V1(pgfincore_map_to_varbit);
+Datum
+pgfincore_map_to_varbit(PG_FUNCTION_ARGS)
+{
+	pgfincore_runs	runs;
+	VarBit			*databit;
+	bits8			*r;
+	int64			start, end;
+	bool			set;
+
+	pgfincore_runs_map(&runs, PG_GETARG_PGFINCORE_MAP_P(0));
+	if (runs.bitlen > VARBITMAXLEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("bit string length exceeds the maximum allowed (%d)",
+						VARBITMAXLEN)));
+
+	databit = (VarBit *) palloc0(VARBITTOTALLEN(runs.bitlen));
+	SET_VARSIZE(databit, VARBITTOTALLEN(runs.bitlen));
+	VARBITLEN(databit) = runs.bitlen;
+	r = VARBITS(databit);
+
+	if (runs.bits != NULL)
+		memcpy(r, runs.bits, VARBITBYTES(databit));
+	else
+		while (pgfincore_runs_next(&runs, &start, &end, &set))
+		{
+			if (!set)
+				continue;
+			/* head and tail bits, full bytes in between */
+			for (; start < end && start % BITS_PER_BYTE != 0; start++)
+				r[start / BITS_PER_BYTE] |= 0x80 >> (start % BITS_PER_BYTE);
+			if (end - start >= BITS_PER_BYTE)
+			{
+				memset(r + start / BITS_PER_BYTE, 0xff,
+					   (end - start) / BITS_PER_BYTE);
+				start += (end - start) / BITS_PER_BYTE * BITS_PER_BYTE;
+			}
+			for (; start < end; start++)
+				r[start / BITS_PER_BYTE] |= 0x80 >> (start % BITS_PER_BYTE);
+		}
+
+	PG_RETURN_VARBIT_P(databit);
+}
+
+/*
+ * pgfincore_segment_path
+ * the file of a segment: relationpath for the first one, suffixed by the
+ * segment number for the others
+ */
+static void
+pgfincore_segment_path(char *filename, const char *relationpath,
+					   unsigned int segno)
+{
+	if (segno == 0)
+		snprintf(filename, MAXPGPATH, "%s", relationpath);
+	else
+		snprintf(filename, MAXPGPATH, "%s.%u", relationpath, segno);
+}
+
+/*
+ * pgfincore_class_file
+ * the tablespace, database and relfilenode of a relation from its pg_class
+ * entry, without opening (and locking) the relation.
+ * false is returned for relations without storage and temporary relations.
+ */
+static bool
+pgfincore_class_file(Oid relid, Form_pg_class classForm,
+					 Oid *spcOid, Oid *dbOid, Oid *relfilenode)
+{
+	if (!RELKIND_HAS_STORAGE(classForm->relkind) ||
+		classForm->relpersistence == RELPERSISTENCE_TEMP)
+		return false;
+
+	/* mapped catalogs have no relfilenode in pg_class */
+	*relfilenode = classForm->relfilenode;
+	if (!OidIsValid(*relfilenode))
+		*relfilenode = RelationMapOidToFilenode(relid, classForm->relisshared);
+	if (!OidIsValid(*relfilenode))
+		return false;
+
+	if (classForm->relisshared)
+	{
+		*spcOid	= GLOBALTABLESPACE_OID;
+		*dbOid	= InvalidOid;
+	}
+	else
+	{
+		*spcOid	= OidIsValid(classForm->reltablespace) ?
+					classForm->reltablespace : MyDatabaseTableSpace;
+		*dbOid	= MyDatabaseId;
+	}
+
+	return true;
+}
+
+/*
+ * pgfincore_class_relpath
+ * return the path of a fork of a relation from its pg_class entry, without
+ * opening (and locking) the relation. The relfilenode is returned too.
+ * NULL is returned for relations without storage and temporary relations.
+ */
+static char *
+pgfincore_class_relpath(Oid relid, Form_pg_class classForm,
+						ForkNumber forknum, Oid *relfilenode)
+{
+	Oid		spcOid;
+	Oid		dbOid;
+
+	if (!pgfincore_class_file(relid, classForm, &spcOid, &dbOid, relfilenode))
+		return NULL;
+
+	return pgfincore_relpath(dbOid, spcOid, *relfilenode, forknum);
+}
+
+/*
+ * pgfincore_nolock_relpath
+ * the path of a fork of a relation from the catalog, the relation is not
+ * opened thus not locked. The file may be removed or replaced in the
+ * meantime, it then has no segment left to walk: not finding a file ends the
+ * walk as usual. NULL is returned when the relation does not exist anymore,
+ * has no storage or is temporary.
+ */
+static char *
+pgfincore_nolock_relpath(Oid relid, text *forkName)
+{
+	ForkNumber	forknum = forkname_to_number(text_to_cstring(forkName));
+	HeapTuple	tuple;
+	char		*relationpath;
+	Oid			relfilenode;
+
+	tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+	if (!HeapTupleIsValid(tuple))
+		return NULL;
+
+	relationpath = pgfincore_class_relpath(relid,
+										   (Form_pg_class) GETSTRUCT(tuple),
+										   forknum, &relfilenode);
+	ReleaseSysCache(tuple);
+
+	return relationpath;
+}
+
+/*
+ * a fork of pgfincore_database, its path copied from pg_class
+ */
+typedef struct
+{
+	Oid			relid;
+	int			forknum;
+	char		*relationpath;
+} pgfincore_database_fork;
+
+/*
+ * pgfincore_database
+ * pgfincore on all the forks of all the relations of the current database,
+ * without any lock on them: the paths are copied from pg_class, which is
+ * released before the files are probed, and a relation removed in the
+ * meantime just has no file anymore. The rows are tagged with the relation
+ * and the fork, and returned in a tuplestore.
+ */
+PG_FUNCTION_INFO_V1(pgfincore_database);
+Datum
+pgfincore_database(PG_FUNCTION_ARGS)
+{
+	bool			getvector = PG_GETARG_BOOL(0);
+	TupleDesc		tupdesc;
+	Tuplestorestate	*tupstore;
+	Relation		classRel;
+	SysScanDesc		scan;
+	HeapTuple		classTuple;
+	List			*forks = NIL;
+	ListCell		*lc;
+	MemoryContext	tmpcontext;
+	MemoryContext	oldcontext;
+
+	tupstore = pgfincore_materialize(fcinfo, &tupdesc);
+
+	classRel = table_open(RelationRelationId, AccessShareLock);
+	scan = systable_beginscan(classRel, InvalidOid, false, NULL, 0, NULL);
+	while (HeapTupleIsValid(classTuple = systable_getnext(scan)))
+	{
+		Form_pg_class	classForm = (Form_pg_class) GETSTRUCT(classTuple);
+		Oid				relid = pgfincore_class_oid(classTuple);
+		Oid				relfilenode;
+		int				forknum;
+
+		CHECK_FOR_INTERRUPTS();
+
+		for (forknum = 0; forknum <= MAX_FORKNUM; forknum++)
+		{
+			pgfincore_database_fork	*fork;
+			char					*relationpath;
+
+			relationpath = pgfincore_class_relpath(relid, classForm,
+												   (ForkNumber) forknum,
+												   &relfilenode);
+			if (relationpath == NULL)
+				break;
+
+			fork = (pgfincore_database_fork *)
+				palloc(sizeof(pgfincore_database_fork));
+			fork->relid			= relid;
+			fork->forknum		= forknum;
+			fork->relationpath	= relationpath;
+			forks = lappend(forks, fork);
+		}
+	}
+	systable_endscan(scan);
+	table_close(classRel, AccessShareLock);
+
+	/* the memory used by a fork is released once it is done */
+	tmpcontext = AllocSetContextCreate(CurrentMemoryContext,
+									   "pgfincore database",
+									   ALLOCSET_DEFAULT_SIZES);
+
+	foreach(lc, forks)
+	{
+		pgfincore_database_fork	*fork = (pgfincore_database_fork *) lfirst(lc);
+		unsigned int			segno;
+
+		CHECK_FOR_INTERRUPTS();
+
+		oldcontext = MemoryContextSwitchTo(tmpcontext);
+		for (segno = 0; ; segno++)
+		{
+			pgfincoreStruct	pgfncr;
+			char			filename[MAXPGPATH];
+			Datum			values[PGFINCORE_COLS + 2];
+			bool			nulls[PGFINCORE_COLS + 2];
+
+			pgfincore_segment_path(filename, fork->relationpath, segno);
+			if (pgfincore_file(filename, getvector, 0, 0, &pgfncr) != 0)
+				break;
+
+			memset(nulls, 0, sizeof(nulls));
+			/* relation and fork, then the columns of pgfincore */
+			values[0] = ObjectIdGetDatum(fork->relid);
+			values[1] = CStringGetTextDatum(forkNames[fork->forknum]);
+			pgfincore_values(filename, segno, &pgfncr,
+							 values + 2, nulls + 2);
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(tmpcontext);
+	}
+
+	MemoryContextDelete(tmpcontext);
+	list_free_deep(forks);
+
+	return (Datum) 0;
+}
+
+/*
+ * Access pattern policy
+ *
+ * The readahead state set by POSIX_FADV_SEQUENTIAL and POSIX_FADV_RANDOM
+ * belongs to the open file, the advice of pgfadvise() is lost once its file
+ * is closed. The relations of the table pgfincore_advice get their advice on
+ * the file descriptors of the backend itself: at ExecutorStart, for each
+ * relation of the range table with a policy, the segments are opened by
+ * smgrnblocks() and the descriptors of the backend on these files, found in
+ * /proc/self/fd (Linux), are advised.
+ * The descriptors found are kept: the next queries advise them again, the
+ * VFD cache may have closed and reopened a segment since, without scanning
+ * /proc again. It is scanned again when a descriptor kept is not on its
+ * segment anymore, when the relation has a new segment, or after a relcache
+ * invalidation of the relation (a new relfilenode, a vacuum...).
+ * The policies are cached in each backend, and reloaded when the table is
+ * modified: its trigger sends a relcache invalidation.
+ */
+typedef struct
+{
+	int		fd;
+	dev_t	dev;
+	ino_t	ino;
+} pgfincore_advice_fd;
+
+typedef struct
+{
+	Oid		relid;
+	int		advice;			/* POSIX_FADV_NORMAL, _SEQUENTIAL or _RANDOM */
+	bool	scanned;		/* fds found in /proc/self/fd */
+	int		nsegs;			/* segments when scanned */
+	int		nfds;
+	pgfincore_advice_fd	*fds;	/* in TopMemoryContext */
+} pgfincore_advice_entry;
+
+static pgfincore_advice_entry *pgfincore_advices = NULL;
+static int		pgfincore_nadvices = 0;
+static int		pgfincore_maxadvices = 0;
+static bool		pgfincore_advices_valid = false;
+static Oid		pgfincore_advice_relid = InvalidOid;
+
+static int
+pgfincore_advice_cmp(const void *a, const void *b)
+{
+	Oid		ra = ((const pgfincore_advice_entry *) a)->relid;
+	Oid		rb = ((const pgfincore_advice_entry *) b)->relid;
+
+	if (ra == rb)
+		return 0;
+	return ra < rb ? -1 : 1;
+}
+
+/*
+ * pgfincore_advice_inval
+ * the policies are reloaded when pgfincore_advice changes, or on a reset of
+ * the whole relcache. The absence of the extension is cached too: the
+ * scripts of the extension truncate the table once created, its trigger
+ * then invalidates the whole relcache of the database.
+ * A relation with a policy is advised again after its own invalidation.
+ */
+static void
+pgfincore_advice_inval(Datum arg, Oid relid)
+{
+	pgfincore_advice_entry	key;
+	pgfincore_advice_entry	*entry;
+
+	if (!OidIsValid(relid) || relid == pgfincore_advice_relid)
+	{
+		pgfincore_advices_valid = false;
+		return;
+	}
+	if (!OidIsValid(pgfincore_advice_relid))
+	{
+#if PG_VERSION_NUM < 100000
+		/* no invalidation of the whole relcache, the table is looked for again */
+		pgfincore_advices_valid = false;
+#endif
+		return;
+	}
+
+	key.relid = relid;
+	entry = bsearch(&key, pgfincore_advices, pgfincore_nadvices,
+					sizeof(pgfincore_advice_entry), pgfincore_advice_cmp);
+	if (entry != NULL)
+		entry->scanned = false;
+}
+
+/*
+ * pgfincore_extension_table
+ * a table of the extension, in its schema.
+ * InvalidOid when the extension is not installed in the database.
+ */
+static Oid
+pgfincore_extension_table(const char *relname)
+{
+	Oid			extOid;
+	Oid			nspOid = InvalidOid;
+	Relation	rel;
+	SysScanDesc	scan;
+	ScanKeyData	key;
+	HeapTuple	tuple;
+
+	extOid = get_extension_oid("pgfincore", true);
+	if (!OidIsValid(extOid))
+		return InvalidOid;
+
+	rel = table_open(ExtensionRelationId, AccessShareLock);
+	ScanKeyInit(&key, Anum_pg_extension_oid, BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(extOid));
+	scan = systable_beginscan(rel, ExtensionOidIndexId, true, NULL, 1, &key);
+	if (HeapTupleIsValid(tuple = systable_getnext(scan)))
+		nspOid = ((Form_pg_extension) GETSTRUCT(tuple))->extnamespace;
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	if (!OidIsValid(nspOid))
+		return InvalidOid;
+	return get_relname_relid(relname, nspOid);
+}
+
+/*
+ * pgfincore_advice_load
+ * read the policies from pgfincore_advice, in the schema of the extension
+ */
+static void
+pgfincore_advice_load(void)
+{
+	Relation	rel;
+	SysScanDesc	scan;
+	HeapTuple	tuple;
+	int			i;
+
+	for (i = 0; i < pgfincore_nadvices; i++)
+	{
+		if (pgfincore_advices[i].fds != NULL)
+			pfree(pgfincore_advices[i].fds);
+	}
+	pgfincore_nadvices = 0;
+	pgfincore_advices_valid = true;
+
+	pgfincore_advice_relid = pgfincore_extension_table("pgfincore_advice");
+	if (!OidIsValid(pgfincore_advice_relid))
+		return;
+
+	if (pgfincore_advices == NULL)
+	{
+		pgfincore_maxadvices = 16;
+		pgfincore_advices = (pgfincore_advice_entry *)
+			MemoryContextAlloc(TopMemoryContext,
+							   pgfincore_maxadvices * sizeof(pgfincore_advice_entry));
+	}
+
+	rel = table_open(pgfincore_advice_relid, AccessShareLock);
+	scan = systable_beginscan(rel, InvalidOid, false, NULL, 0, NULL);
+	while (HeapTupleIsValid(tuple = systable_getnext(scan)))
+	{
+		bool	isnull;
+		Datum	relid = heap_getattr(tuple, 1, RelationGetDescr(rel), &isnull);
+		Datum	advice;
+		char	*name;
+
+		if (isnull)
+			continue;
+		advice = heap_getattr(tuple, 2, RelationGetDescr(rel), &isnull);
+		if (isnull)
+			continue;
+
+		if (pgfincore_nadvices == pgfincore_maxadvices)
+		{
+			pgfincore_maxadvices *= 2;
+			pgfincore_advices = (pgfincore_advice_entry *)
+				repalloc(pgfincore_advices,
+						 pgfincore_maxadvices * sizeof(pgfincore_advice_entry));
+		}
+
+		name = TextDatumGetCString(advice);
+		pgfincore_advices[pgfincore_nadvices].relid = DatumGetObjectId(relid);
+		pgfincore_advices[pgfincore_nadvices].scanned = false;
+		pgfincore_advices[pgfincore_nadvices].nsegs = 0;
+		pgfincore_advices[pgfincore_nadvices].nfds = 0;
+		pgfincore_advices[pgfincore_nadvices].fds = NULL;
+		if (strcmp(name, "sequential") == 0)
+			pgfincore_advices[pgfincore_nadvices].advice = POSIX_FADV_SEQUENTIAL;
+		else if (strcmp(name, "random") == 0)
+			pgfincore_advices[pgfincore_nadvices].advice = POSIX_FADV_RANDOM;
+		else
+			pgfincore_advices[pgfincore_nadvices].advice = POSIX_FADV_NORMAL;
+		pfree(name);
+		pgfincore_nadvices++;
+	}
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	qsort(pgfincore_advices, pgfincore_nadvices,
+		  sizeof(pgfincore_advice_entry), pgfincore_advice_cmp);
+	elog(DEBUG1, "pgfincore: %d access pattern policies loaded",
+		 pgfincore_nadvices);
+}
+
+/*
+ * pgfincore_advice_fds
+ * advise the file descriptors of the backend on the segments of a fork,
+ * they are found by their device and inode, and kept in the entry
+ */
+static void
+pgfincore_advice_fds(const char *relationpath, pgfincore_advice_entry *entry)
+{
+	struct stat		*segs;
+	int				nsegs = 0;
+	int				maxsegs = 16;
+	int				maxfds = 16;
+	DIR				*dir;
+	struct dirent	*de;
+
+	if (entry->fds != NULL)
+		pfree(entry->fds);
+	entry->nfds = 0;
+	entry->fds = (pgfincore_advice_fd *)
+		MemoryContextAlloc(TopMemoryContext,
+						   maxfds * sizeof(pgfincore_advice_fd));
+
+	segs = (struct stat *) palloc(maxsegs * sizeof(struct stat));
+	for (;;)
+	{
+		char	filename[MAXPGPATH];
+
+		if (nsegs == maxsegs)
+		{
+			maxsegs *= 2;
+			segs = (struct stat *) repalloc(segs, maxsegs * sizeof(struct stat));
+		}
+		pgfincore_segment_path(filename, relationpath, nsegs);
+		if (stat(filename, &segs[nsegs]) != 0)
+			break;
+		nsegs++;
+	}
+
+	dir = AllocateDir("/proc/self/fd");
+	if (dir == NULL)
+	{
+		pfree(segs);
+		return;
+	}
+	while ((de = ReadDir(dir, "/proc/self/fd")) != NULL)
+	{
+		struct stat	st;
+		int			fd;
+		int			i;
+
+		if (de->d_name[0] < '0' || de->d_name[0] > '9')
+			continue;
+		fd = atoi(de->d_name);
+		if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		for (i = 0; i < nsegs; i++)
+		{
+			if (st.st_dev != segs[i].st_dev || st.st_ino != segs[i].st_ino)
+				continue;
+			if (posix_fadvise(fd, 0, 0, entry->advice) != 0)
+				elog(DEBUG1, "pgfincore: posix_fadvise on %s.%d failed: %m",
+					 relationpath, i);
+
+			if (entry->nfds == maxfds)
+			{
+				maxfds *= 2;
+				entry->fds = (pgfincore_advice_fd *)
+					repalloc(entry->fds, maxfds * sizeof(pgfincore_advice_fd));
+			}
+			entry->fds[entry->nfds].fd	= fd;
+			entry->fds[entry->nfds].dev	= st.st_dev;
+			entry->fds[entry->nfds].ino	= st.st_ino;
+			entry->nfds++;
+			break;
+		}
+	}
+	FreeDir(dir);
+	pfree(segs);
+}
+
+/*
+ * pgfincore_advice_again
+ * advise again the file descriptors kept, false when one of them is not on
+ * its segment anymore
+ */
+static bool
+pgfincore_advice_again(pgfincore_advice_entry *entry)
+{
+	int		i;
+
+	for (i = 0; i < entry->nfds; i++)
+	{
+		struct stat	st;
+
+		if (fstat(entry->fds[i].fd, &st) != 0 ||
+			st.st_dev != entry->fds[i].dev || st.st_ino != entry->fds[i].ino)
+			return false;
+		(void) posix_fadvise(entry->fds[i].fd, 0, 0, entry->advice);
+	}
+	return true;
+}
+
+/*
+ * pgfincore_advice_apply
+ * open the segments of a relation with a policy, then advise them
+ */
+static void
+pgfincore_advice_apply(pgfincore_advice_entry *entry)
+{
+	Relation	rel;
+
+	/* the executor holds a lock on the relation already */
+	rel = try_relation_open(entry->relid, AccessShareLock);
+	if (rel == NULL)
+		return;
+
+	if (RELKIND_HAS_STORAGE(rel->rd_rel->relkind))
+	{
+		BlockNumber	nblocks;
+		int			nsegs;
+
+		nblocks = smgrnblocks(pgfincore_relation_smgr(rel), MAIN_FORKNUM);
+		nsegs = nblocks / RELSEG_SIZE + 1;
+		if (!entry->scanned || entry->nsegs != nsegs ||
+			!pgfincore_advice_again(entry))
+		{
+			char	*relationpath = relpathpg_forknum(rel, MAIN_FORKNUM);
+
+			pgfincore_advice_fds(relationpath, entry);
+			entry->scanned	= true;
+			entry->nsegs	= nsegs;
+			pfree(relationpath);
+		}
+	}
+	relation_close(rel, AccessShareLock);
+}
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * Scan-following prefetch
+ *
+ * The readahead of the kernel is small compared with the latency of some
+ * storages, and pgfadvise_willneed() loads the whole relation. For a SeqScan
+ * on a heap larger than pgfincore.scan_prefetch_min_size, the os pages of the
+ * pgfincore.scan_prefetch_window blocks ahead of the current block of the
+ * scan are loaded with POSIX_FADV_WILLNEED, the window moving by a quarter of
+ * its size. The ExecProcNode of the SeqScan is wrapped to follow the scan,
+ * its state is found by the node in a hash table.
+ * The positions are counted from the start block of the scan, which is not 0
+ * with synchronized scans, and wrap around at the end of the relation.
+ * Each process of a parallel scan follows its own blocks, with its own state.
+ */
+typedef struct
+{
+	SeqScanState	*node;			/* the SeqScan followed */
+	ExecProcNodeMtd	execProcNode;	/* its ExecProcNode, wrapped */
+	char			*relationpath;	/* the path of the main fork */
+	int64			window;			/* blocks prefetched ahead of the scan */
+	int64			step;			/* blocks between two prefetches */
+	BlockNumber		lastBlock;		/* current block at the last call */
+	int64			position;		/* blocks scanned since the start block */
+	int64			prefetched;		/* blocks prefetched since the start block */
+	MemoryContextCallback callback;	/* unregister at the end of the query */
+} pgfincore_scan_prefetch;
+
+/* an entry of the hash table of the SeqScans followed, by node */
+typedef struct
+{
+	PlanState				*node;	/* hash key */
+	pgfincore_scan_prefetch	*sp;	/* in the memory context of the query */
+} pgfincore_scan_prefetch_entry;
+
+static HTAB *pgfincore_scan_prefetches = NULL;
+
+/*
+ * pgfincore_scan_prefetch_range
+ * POSIX_FADV_WILLNEED on the blocks [startBlock, endBlock[ of a fork
+ */
+static void
+pgfincore_scan_prefetch_range(const char *relationpath,
+							  int64 startBlock, int64 endBlock)
+{
+	unsigned int	segno;
+
+	for (segno = startBlock / RELSEG_SIZE;; segno++)
+	{
+		char	filename[MAXPGPATH];
+		off_t	offset;
+		off_t	len;
+		int		fd;
+
+		if (!pgfincore_segment_range(startBlock, endBlock, segno,
+									 &offset, &len))
+			break;
+
+		pgfincore_segment_path(filename, relationpath, segno);
+		fd = OpenTransientFile(filename, O_RDONLY | PG_BINARY);
+		if (fd < 0)
+			break;
+		(void) posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+		CloseTransientFile(fd);
+	}
+}
+
+/*
+ * pgfincore_scan_prefetch_advance
+ * move the window when the scan has gone past a step
+ */
+static void
+pgfincore_scan_prefetch_advance(pgfincore_scan_prefetch *sp, HeapScanDesc scan)
+{
+	int64	startBlock = scan->rs_startblock;
+	int64	nblocks = scan->rs_nblocks;
+	int64	position;
+	int64	first;
+	int64	end;
+	int64	count;
+
+	if (scan->rs_base.rs_parallel != NULL)
+	{
+		ParallelBlockTableScanDesc	pbscan;
+
+		pbscan = (ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
+		startBlock	= pbscan->phs_startblock;
+		nblocks		= pbscan->phs_nblocks;
+	}
+	if (nblocks == 0 || scan->rs_cblock >= nblocks)
+		return;
+
+	position = ((int64) scan->rs_cblock - startBlock + nblocks) % nblocks;
+
+	/* a rescan starts again */
+	if (position < sp->position)
+		sp->prefetched = position;
+	sp->position = position;
+
+	if (sp->prefetched >= nblocks ||
+		sp->prefetched - position > sp->window - sp->step)
+		return;
+
+	first	= Max(sp->prefetched, position);
+	end		= Min(position + sp->window, nblocks);
+	sp->prefetched = end;
+	if (end <= first)
+		return;
+
+	/* from the positions to the blocks, in one or two ranges */
+	count	= end - first;
+	first	= (startBlock + first) % nblocks;
+	if (first + count <= nblocks)
+		pgfincore_scan_prefetch_range(sp->relationpath, first, first + count);
+	else
+	{
+		pgfincore_scan_prefetch_range(sp->relationpath, first, nblocks);
+		pgfincore_scan_prefetch_range(sp->relationpath, 0,
+									  first + count - nblocks);
+	}
+}
+
+/*
+ * pgfincore_scan_prefetch_exec
+ * the ExecProcNode of the SeqScans followed
+ */
+static TupleTableSlot *
+pgfincore_scan_prefetch_exec(PlanState *pstate)
+{
+	pgfincore_scan_prefetch_entry	*entry;
+	pgfincore_scan_prefetch	*sp;
+	TupleTableSlot			*slot;
+	HeapScanDesc			scan;
+
+	entry = (pgfincore_scan_prefetch_entry *)
+		hash_search(pgfincore_scan_prefetches, &pstate, HASH_FIND, NULL);
+	if (entry == NULL)
+		elog(ERROR, "pgfincore: scan prefetch state not found");
+	sp = entry->sp;
+
+	slot = sp->execProcNode(pstate);
+
+	/* the scan descriptor is created by the first call */
+	scan = (HeapScanDesc) sp->node->ss.ss_currentScanDesc;
+	if (scan != NULL && scan->rs_cblock != InvalidBlockNumber &&
+		scan->rs_cblock != sp->lastBlock)
+	{
+		sp->lastBlock = scan->rs_cblock;
+		pgfincore_scan_prefetch_advance(sp, scan);
+	}
+
+	return slot;
+}
+
+/*
+ * pgfincore_scan_prefetch_release
+ * the query is done, its memory context is reset
+ */
+static void
+pgfincore_scan_prefetch_release(void *arg)
+{
+	PlanState	*node = &((pgfincore_scan_prefetch *) arg)->node->ss.ps;
+
+	(void) hash_search(pgfincore_scan_prefetches, &node, HASH_REMOVE, NULL);
+}
+
+/*
+ * pgfincore_scan_prefetch_install
+ * follow a SeqScan on a heap larger than pgfincore.scan_prefetch_min_size
+ */
+static void
+pgfincore_scan_prefetch_install(SeqScanState *node, EState *estate)
+{
+	Relation				rel = node->ss.ss_currentRelation;
+	PlanState				*key = &node->ss.ps;
+	pgfincore_scan_prefetch_entry	*entry;
+	pgfincore_scan_prefetch	*sp;
+	MemoryContext			oldcontext;
+
+	if (rel == NULL || rel->rd_tableam != GetHeapamTableAmRoutine())
+		return;
+	if ((int64) RelationGetNumberOfBlocks(rel) * BLCKSZ <
+		(int64) pgfincore_scan_prefetch_min_size * 1024 * 1024)
+		return;
+
+	sp = (pgfincore_scan_prefetch *)
+		MemoryContextAllocZero(estate->es_query_cxt,
+							   sizeof(pgfincore_scan_prefetch));
+	sp->node			= node;
+	sp->execProcNode	= node->ss.ps.ExecProcNodeReal;
+	sp->window			= (int64) pgfincore_scan_prefetch_window * 1024 * 1024 /
+		BLCKSZ;
+	sp->step			= Max(sp->window / 4, 1);
+	sp->lastBlock		= InvalidBlockNumber;
+
+	oldcontext = MemoryContextSwitchTo(estate->es_query_cxt);
+	sp->relationpath	= relpathpg_forknum(rel, MAIN_FORKNUM);
+	MemoryContextSwitchTo(oldcontext);
+
+	if (pgfincore_scan_prefetches == NULL)
+	{
+		HASHCTL		ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize		= sizeof(PlanState *);
+		ctl.entrysize	= sizeof(pgfincore_scan_prefetch_entry);
+		ctl.hcxt		= TopMemoryContext;
+		pgfincore_scan_prefetches = hash_create("pgfincore scan prefetch", 16,
+												&ctl, HASH_ELEM | HASH_BLOBS |
+												HASH_CONTEXT);
+	}
+	entry = (pgfincore_scan_prefetch_entry *)
+		hash_search(pgfincore_scan_prefetches, &key, HASH_ENTER, NULL);
+	entry->sp = sp;
+
+	sp->callback.func	= pgfincore_scan_prefetch_release;
+	sp->callback.arg	= sp;
+	MemoryContextRegisterResetCallback(estate->es_query_cxt, &sp->callback);
+
+	node->ss.ps.ExecProcNodeReal = pgfincore_scan_prefetch_exec;
+	elog(DEBUG1, "pgfincore: prefetch %lld blocks ahead of the scan of %s",
+		 (long long int) sp->window, sp->relationpath);
+}
+
+/*
+ * pgfincore_scan_prefetch_walker
+ * find the SeqScans of the plan
+ */
+static bool
+pgfincore_scan_prefetch_walker(PlanState *planstate, void *context)
+{
+	if (planstate == NULL)
+		return false;
+
+	if (IsA(planstate, SeqScanState))
+		pgfincore_scan_prefetch_install((SeqScanState *) planstate,
+										(EState *) context);
+
+	return planstate_tree_walker(planstate, pgfincore_scan_prefetch_walker,
+								 context);
+}
+#endif							/* PG_VERSION_NUM >= 120000 */
+
+/*
+ * pgfincore_ExecutorStart
+ * apply the policies of the relations of the range table, and follow the
+ * large SeqScans
+ */
+static void
+pgfincore_ExecutorStart(QueryDesc *queryDesc, int eflags)
+{
+	ListCell	*lc;
+
+	if (prev_ExecutorStart)
+		prev_ExecutorStart(queryDesc, eflags);
+	else
+		standard_ExecutorStart(queryDesc, eflags);
+
+	if (!pgfincore_advices_valid)
+		pgfincore_advice_load();
+
+	if (pgfincore_nadvices > 0)
+	{
+		foreach(lc, queryDesc->plannedstmt->rtable)
+		{
+			RangeTblEntry			*rte = (RangeTblEntry *) lfirst(lc);
+			pgfincore_advice_entry	key;
+			pgfincore_advice_entry	*entry;
+
+			if (rte->rtekind != RTE_RELATION)
+				continue;
+
+			key.relid = rte->relid;
+			entry = bsearch(&key, pgfincore_advices, pgfincore_nadvices,
+							sizeof(pgfincore_advice_entry),
+							pgfincore_advice_cmp);
+			if (entry != NULL)
+				pgfincore_advice_apply(entry);
+		}
+	}
+
+#if PG_VERSION_NUM >= 120000
+	if (pgfincore_scan_prefetch_window > 0 &&
+		queryDesc->planstate != NULL &&
+		(eflags & EXEC_FLAG_EXPLAIN_ONLY) == 0)
+		(void) pgfincore_scan_prefetch_walker(queryDesc->planstate,
+											  queryDesc->estate);
+#endif
+}
+
+/*
+ * pgfincore_advice_invalidate
+ * trigger of pgfincore_advice: the backends reload the policies. A TRUNCATE
+ * reaches also the backends which did not find the table, as done by the
+ * scripts of the extension.
+ */
+PG_FUNCTION_INFO_V1(pgfincore_advice_invalidate);
+Datum
+pgfincore_advice_invalidate(PG_FUNCTION_ARGS)
+{
+	TriggerData	*trigdata = (TriggerData *) fcinfo->context;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		elog(ERROR, "pgfincore_advice_invalidate: not called by trigger manager");
+
+#if PG_VERSION_NUM >= 100000
+	if (TRIGGER_FIRED_BY_TRUNCATE(trigdata->tg_event))
+		CacheInvalidateRelcacheAll();
+	else
+#endif
+		CacheInvalidateRelcache(trigdata->tg_relation);
+
+	return PointerGetDatum(NULL);
+}
+
+/*
+ * Parallel sweep
+ *
+ * pgfincore_database_parallel() builds the list of the forks of the
+ * relations of the current database from pg_class, as pgfincore_database()
+ * does, in a dynamic shared memory segment. It then starts dynamic
+ * background workers which share the segments of these forks with the
+ * backend: the next fork and the next segment of each fork are claimed with
+ * atomic counters, and the counters of a fork are summed by the processes
+ * which scanned its segments. The workers do not connect to a database, they
+ * only need the paths.
+ */
+#if PG_VERSION_NUM >= 120000
+typedef struct
+{
+	Oid					relid;
+	Oid					spcOid;
+	Oid					dbOid;
+	Oid					relfilenode;
+	int32				forknum;
+	pg_atomic_uint32	nextseg;		/* next segment to scan */
+	pg_atomic_uint64	segments;
+	pg_atomic_uint64	rel_os_pages;
+	pg_atomic_uint64	pages_mem;
+} pgfincore_sweep_entry;
+
+typedef struct
+{
+	pg_atomic_uint32	next;			/* fork being scanned */
+	pg_atomic_uint32	started;		/* workers attached */
+	pg_atomic_uint32	finished;		/* workers done with the sweep */
+	uint32				nentries;
+	bool				use_cachestat;	/* pgfincore.cachestat of the backend */
+	pgfincore_sweep_entry entries[FLEXIBLE_ARRAY_MEMBER];
+} pgfincore_sweep_shared;
+
+PGDLLEXPORT void pgfincore_sweep_main(Datum main_arg);
+
+/*
+ * pgfincore_sweep_run
+ * claim and scan segments until all the forks are done, in the backend and
+ * in the workers
+ */
+static void
+pgfincore_sweep_run(pgfincore_sweep_shared *shared, MemoryContext tmpcontext)
+{
+	for (;;)
+	{
+		uint32					current = pg_atomic_read_u32(&shared->next);
+		pgfincore_sweep_entry	*entry;
+		pgfincoreStruct			pgfncr;
+		char					*relationpath;
+		char					filename[MAXPGPATH];
+		MemoryContext			oldcontext;
+		uint32					segno;
+		int						result;
+
+		if (current >= shared->nentries)
+			break;
+
+		CHECK_FOR_INTERRUPTS();
+
+		entry = &shared->entries[current];
+		segno = pg_atomic_fetch_add_u32(&entry->nextseg, 1);
+
+		oldcontext = MemoryContextSwitchTo(tmpcontext);
+		relationpath = pgfincore_relpath(entry->dbOid, entry->spcOid,
+										 entry->relfilenode,
+										 (ForkNumber) entry->forknum);
+		pgfincore_segment_path(filename, relationpath, segno);
+		result = pgfincore_file(filename, false, 0, 0, &pgfncr);
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(tmpcontext);
+
+		/*
+		 * Past the last segment, go to the next fork. The segments before
+		 * have been claimed by someone, who adds them when scanned.
+		 */
+		if (result)
+		{
+			(void) pg_atomic_compare_exchange_u32(&shared->next, &current,
+												  current + 1);
+			continue;
+		}
+
+		pg_atomic_fetch_add_u64(&entry->segments, 1);
+		pg_atomic_fetch_add_u64(&entry->rel_os_pages, pgfncr.rel_os_pages);
+		pg_atomic_fetch_add_u64(&entry->pages_mem, pgfncr.pages_mem);
+	}
+}
+
+/*
+ * pgfincore_sweep_main
+ * entry point of the workers of the sweep, main_arg is the handle of the
+ * shared memory segment
+ */
+void
+pgfincore_sweep_main(Datum main_arg)
+{
+	dsm_segment				*seg;
+	pgfincore_sweep_shared	*shared;
+	MemoryContext			tmpcontext;
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "pgfincore sweep");
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		elog(ERROR, "pgfincore sweep: could not map dynamic shared memory segment");
+	shared = (pgfincore_sweep_shared *) dsm_segment_address(seg);
+
+	pg_atomic_fetch_add_u32(&shared->started, 1);
+
+	/* count the pages as the backend does */
+	pgfincore_use_cachestat = shared->use_cachestat;
+
+	tmpcontext = AllocSetContextCreate(TopMemoryContext,
+									   "pgfincore sweep",
+									   ALLOCSET_DEFAULT_SIZES);
+	pgfincore_sweep_run(shared, tmpcontext);
+	pg_atomic_fetch_add_u32(&shared->finished, 1);
+
+	dsm_detach(seg);
+	proc_exit(0);
+}
+#endif							/* PG_VERSION_NUM >= 120000 */
+
+/*
+ * pgfincore_database_parallel
+ * pgfincore on all the forks of all the relations of the current database,
+ * the segments are shared with up to 'workers' dynamic background workers.
+ * One row per fork, with its counters.
+ */
+PG_FUNCTION_INFO_V1(pgfincore_database_parallel);
+Datum
+pgfincore_database_parallel(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	int						workers = PG_GETARG_INT32(0);
+	TupleDesc				tupdesc;
+	Tuplestorestate			*tupstore;
+	Relation				classRel;
+	SysScanDesc				scan;
+	HeapTuple				classTuple;
+	MemoryContext			tmpcontext;
+	pgfincore_sweep_entry	*entries;
+	int						nentries = 0;
+	int						maxentries = 1024;
+	dsm_segment				*seg;
+	pgfincore_sweep_shared	*shared;
+	BackgroundWorkerHandle	**handles;
+	int						nlaunched = 0;
+	int						i;
+
+	if (workers < 0 || workers > PGF_SWEEP_MAX_WORKERS)
+		elog(ERROR, "pgfincore_database_parallel: workers must be between 0 and %d",
+			 PGF_SWEEP_MAX_WORKERS);
+
+	tupstore = pgfincore_materialize(fcinfo, &tupdesc);
+
+	/*
+	 * The forks of the relations, from pg_class as pgfincore_database(): the
+	 * relations are not locked
+	 */
+	entries = (pgfincore_sweep_entry *)
+		palloc(maxentries * sizeof(pgfincore_sweep_entry));
+	classRel = table_open(RelationRelationId, AccessShareLock);
+	scan = systable_beginscan(classRel, InvalidOid, false, NULL, 0, NULL);
+	while (HeapTupleIsValid(classTuple = systable_getnext(scan)))
+	{
+		Form_pg_class	classForm = (Form_pg_class) GETSTRUCT(classTuple);
+		Oid				relid = pgfincore_class_oid(classTuple);
+		Oid				spcOid;
+		Oid				dbOid;
+		Oid				relfilenode;
+		int				forknum;
+
+		if (!pgfincore_class_file(relid, classForm, &spcOid, &dbOid,
+								  &relfilenode))
+			continue;
+
+		for (forknum = 0; forknum <= MAX_FORKNUM; forknum++)
+		{
+			pgfincore_sweep_entry	*entry;
+
+			if (nentries == maxentries)
+			{
+				maxentries *= 2;
+				entries = (pgfincore_sweep_entry *)
+					repalloc_huge(entries, maxentries * sizeof(pgfincore_sweep_entry));
+			}
+			entry = &entries[nentries++];
+			entry->relid		= relid;
+			entry->spcOid		= spcOid;
+			entry->dbOid		= dbOid;
+			entry->relfilenode	= relfilenode;
+			entry->forknum		= forknum;
+		}
+	}
+	systable_endscan(scan);
+	table_close(classRel, AccessShareLock);
+
+	/* the shared list of forks */
+	seg = dsm_create(offsetof(pgfincore_sweep_shared, entries) +
+					 nentries * sizeof(pgfincore_sweep_entry), 0);
+	shared = (pgfincore_sweep_shared *) dsm_segment_address(seg);
+	pg_atomic_init_u32(&shared->next, 0);
+	pg_atomic_init_u32(&shared->started, 0);
+	pg_atomic_init_u32(&shared->finished, 0);
+	shared->nentries		= nentries;
+	shared->use_cachestat	= pgfincore_use_cachestat;
+	for (i = 0; i < nentries; i++)
+	{
+		pgfincore_sweep_entry	*entry = &shared->entries[i];
+
+		*entry = entries[i];
+		pg_atomic_init_u32(&entry->nextseg, 0);
+		pg_atomic_init_u64(&entry->segments, 0);
+		pg_atomic_init_u64(&entry->rel_os_pages, 0);
+		pg_atomic_init_u64(&entry->pages_mem, 0);
+	}
+	pfree(entries);
+
+	/*
+	 * The workers, as many as max_worker_processes allows. The backend scans
+	 * too, so the sweep completes without any worker.
+	 */
+	handles = (BackgroundWorkerHandle **)
+		palloc(Max(workers, 1) * sizeof(BackgroundWorkerHandle *));
+	for (i = 0; i < workers; i++)
+	{
+		BackgroundWorker	worker;
+
+		memset(&worker, 0, sizeof(worker));
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+		worker.bgw_start_time = BgWorkerStart_ConsistentState;
+		worker.bgw_restart_time = BGW_NEVER_RESTART;
+		snprintf(worker.bgw_library_name, BGW_MAXLEN, "pgfincore");
+		snprintf(worker.bgw_function_name, BGW_MAXLEN, "pgfincore_sweep_main");
+		snprintf(worker.bgw_name, BGW_MAXLEN, "pgfincore sweep worker %d", i);
+		snprintf(worker.bgw_type, BGW_MAXLEN, "pgfincore sweep");
+		worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(seg));
+		worker.bgw_notify_pid = MyProcPid;
+
+		if (!RegisterDynamicBackgroundWorker(&worker, &handles[nlaunched]))
+			break;
+		nlaunched++;
+	}
+	elog(DEBUG1, "pgfincore_database_parallel: %d forks, %d workers launched",
+		 nentries, nlaunched);
+
+	tmpcontext = AllocSetContextCreate(CurrentMemoryContext,
+									   "pgfincore sweep",
+									   ALLOCSET_DEFAULT_SIZES);
+	pgfincore_sweep_run(shared, tmpcontext);
+	MemoryContextDelete(tmpcontext);
+
+	/*
+	 * A worker may still be scanning a segment, or may have failed before
+	 * adding its segment. A worker which could not start has not claimed
+	 * anything.
+	 */
+	for (i = 0; i < nlaunched; i++)
+		if (WaitForBackgroundWorkerShutdown(handles[i]) == BGWH_POSTMASTER_DIED)
+			elog(ERROR, "pgfincore_database_parallel: postmaster died during the sweep");
+	if (pg_atomic_read_u32(&shared->finished) !=
+		pg_atomic_read_u32(&shared->started))
+		elog(ERROR, "pgfincore_database_parallel: a worker exited before the end of the sweep");
+
+	/* one row per fork with segments */
+	for (i = 0; i < nentries; i++)
+	{
+		pgfincore_sweep_entry	*entry = &shared->entries[i];
+		Datum		values[PGFINCORE_PARALLEL_COLS];
+		bool		nulls[PGFINCORE_PARALLEL_COLS];
+
+		if (pg_atomic_read_u64(&entry->segments) == 0)
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = ObjectIdGetDatum(entry->relid);
+		values[1] = CStringGetTextDatum(forkNames[entry->forknum]);
+		values[2] = Int64GetDatum((int64) pg_atomic_read_u64(&entry->segments));
+		values[3] = Int64GetDatum((int64) pg_atomic_read_u64(&entry->rel_os_pages));
+		values[4] = Int64GetDatum((int64) pg_atomic_read_u64(&entry->pages_mem));
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	dsm_detach(seg);
+
+	return (Datum) 0;
+#else
+	elog(ERROR, "pgfincore_database_parallel: PostgreSQL >= 12 is required");
+	PG_RETURN_VOID();
+#endif
+}
+
+/*
+ * Database snapshot
+ *
+ * pgfincore_snapshot_database() walks pg_class once and writes the state of
+ * each segment of each fork of the relations of the current database into a
+ * binary file. Segments with no page or all pages in cache are stored
+ * without their bitmap.
+ * pgfincore_restore_database() reads the file back and calls
+ * pgfadvise_loader_file() for each segment whose relation still has the same
+ * relfilenode.
+ */
+#define PGF_SNAPSHOT_MAGIC		0x50474653	/* "PGFS" */
+#define PGF_SNAPSHOT_VERSION	1
+
+#define PGF_SNAPSHOT_NONE		0	/* no page in cache, no bitmap */
+#define PGF_SNAPSHOT_ALL		1	/* all pages in cache, no bitmap */
+#define PGF_SNAPSHOT_MAP		2	/* followed by a bitmap of nbits */
+
+#define PGF_SNAPSHOT_COLS		4
+#define PGF_RESTORE_COLS		6
+
+typedef struct
+{
+	uint32	magic;			/* PGF_SNAPSHOT_MAGIC */
+	uint32	version;		/* PGF_SNAPSHOT_VERSION */
+	uint32	pageSize;		/* os page size of the snapshot */
+	Oid		dbOid;			/* database of the snapshot */
+} pgfincore_snapshot_header;
+
+typedef struct
+{
+	Oid		relid;			/* the relation */
+	Oid		relfilenode;	/* its relfilenode at snapshot time */
+	int32	forknum;		/* the fork */
+	uint32	segno;			/* the segment */
+	uint32	nbits;			/* os pages in the segment */
+	uint32	pages_mem;		/* os pages in cache */
+	uint32	kind;			/* PGF_SNAPSHOT_NONE, _ALL or _MAP */
+} pgfincore_snapshot_record;
+
+/*
+ * pgfincore_snapshot_write
+ * write the snapshot of the current database into file, tmppath for the
+ * messages. Return false when the deadline (0 for none) is reached.
+ */
+static bool
+pgfincore_snapshot_write(FILE *file, const char *tmppath,
+						 pgfincore_db_counters *counters, TimestampTz deadline)
+{
+	bool		complete = true;
+
+	pgfincore_snapshot_header header;
+	Relation	classRel;
+	SysScanDesc	scan;
+	HeapTuple	classTuple;
+	MemoryContext	tmpcontext;
+	MemoryContext	oldcontext;
+
+	header.magic	= PGF_SNAPSHOT_MAGIC;
+	header.version	= PGF_SNAPSHOT_VERSION;
+	header.pageSize	= sysconf(_SC_PAGESIZE);
+	header.dbOid	= MyDatabaseId;
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		elog(ERROR, "pgfincore_snapshot_database: Can not write file %s: %m",
+			 tmppath);
+
+	/* the bitmaps are freed after each relation */
+	tmpcontext = AllocSetContextCreate(CurrentMemoryContext,
+									   "pgfincore snapshot",
+									   ALLOCSET_DEFAULT_SIZES);
+
+	/*
+	 * The relations are not opened: the paths come from pg_class, and a
+	 * relation removed in the meantime just has no file anymore.
+	 */
+	classRel = table_open(RelationRelationId, AccessShareLock);
+	scan = systable_beginscan(classRel, InvalidOid, false, NULL, 0, NULL);
+	while (HeapTupleIsValid(classTuple = systable_getnext(scan)))
+	{
+		Form_pg_class	classForm = (Form_pg_class) GETSTRUCT(classTuple);
+		Oid				relid = pgfincore_class_oid(classTuple);
+		Oid				relfilenode;
+		bool			found = false;
+		int				forknum;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (deadline != 0 && GetCurrentTimestamp() >= deadline)
+		{
+			complete = false;
+			break;
+		}
+
+		oldcontext = MemoryContextSwitchTo(tmpcontext);
+		for (forknum = 0; forknum <= MAX_FORKNUM; forknum++)
+		{
+			char			*relationpath;
+			unsigned int	segno;
+
+			relationpath = pgfincore_class_relpath(relid, classForm,
+												   (ForkNumber) forknum,
+												   &relfilenode);
+			if (relationpath == NULL)
+				break;
+
+			for (segno = 0; ; segno++)
+			{
+				pgfincoreStruct				pgfncr;
+				pgfincore_snapshot_record	rec;
+				char						filename[MAXPGPATH];
+
+				pgfincore_segment_path(filename, relationpath, segno);
+				if (pgfincore_file(filename, true, 0, 0, &pgfncr) != 0)
+					break;
+
+				rec.relid		= relid;
+				rec.relfilenode	= relfilenode;
+				rec.forknum		= forknum;
+				rec.segno		= segno;
+				rec.nbits		= pgfncr.rel_os_pages;
+				rec.pages_mem	= pgfncr.pages_mem;
+				if (pgfncr.pages_mem == 0)
+					rec.kind = PGF_SNAPSHOT_NONE;
+				else if (pgfncr.pages_mem == pgfncr.rel_os_pages)
+					rec.kind = PGF_SNAPSHOT_ALL;
+				else
+					rec.kind = PGF_SNAPSHOT_MAP;
+
+#ifdef HAVE_FINCORE
+				/* keep only the in memory bit of each page */
+				if (rec.kind == PGF_SNAPSHOT_MAP)
+				{
+					bits8	*r = VARBITS(pgfncr.databit);
+					bits8	*m = palloc0((rec.nbits + BITS_PER_BYTE - 1) / BITS_PER_BYTE);
+					int64	pageIndex;
+
+					for (pageIndex = 0; pageIndex < pgfncr.rel_os_pages; pageIndex++)
+						if ((r[pageIndex / 4] >> (7 - 2 * (pageIndex % 4))) & 1)
+							m[pageIndex / 8] |= 0x80 >> (pageIndex % 8);
+					memcpy(r, m, (rec.nbits + BITS_PER_BYTE - 1) / BITS_PER_BYTE);
+				}
+#endif
+				if (fwrite(&rec, sizeof(rec), 1, file) != 1 ||
+					(rec.kind == PGF_SNAPSHOT_MAP &&
+					 fwrite(VARBITS(pgfncr.databit),
+							(rec.nbits + BITS_PER_BYTE - 1) / BITS_PER_BYTE,
+							1, file) != 1))
+					elog(ERROR, "pgfincore_snapshot_database: Can not write file %s: %m",
+						 tmppath);
+
+				counters->segments++;
+				counters->rel_os_pages += pgfncr.rel_os_pages;
+				counters->pages_mem += pgfncr.pages_mem;
+				found = true;
+			}
+		}
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(tmpcontext);
+
+		if (found)
+			counters->relations++;
+	}
+	systable_endscan(scan);
+	table_close(classRel, AccessShareLock);
+	MemoryContextDelete(tmpcontext);
+
+	return complete;
+}
+
+/*
+ * pgfincore_snapshot_file
+ * write the page cache state of the current database into a file
+ * When the deadline (0 for none) is reached, the snapshot is given up and
+ * false is returned, the previous file is kept.
+ */
+static bool
+pgfincore_snapshot_file(const char *path, pgfincore_db_counters *counters,
+						TimestampTz deadline)
+{
+	char		tmppath[MAXPGPATH];
+	FILE		*file;
+	bool		complete;
+
+	memset(counters, 0, sizeof(pgfincore_db_counters));
+
+	/* the file is replaced only once complete */
+	snprintf(tmppath, MAXPGPATH, "%s.tmp", path);
+	file = AllocateFile(tmppath, PG_BINARY_W);
+	if (file == NULL)
+		elog(ERROR, "pgfincore_snapshot_database: Can not create file %s: %m",
+			 tmppath);
+
+	/*
+	 * no partial file is left behind on error, the file itself is closed at
+	 * the end of the transaction
+	 */
+	PG_TRY();
+	{
+		complete = pgfincore_snapshot_write(file, tmppath, counters, deadline);
+
+		if (FreeFile(file) != 0)
+			elog(ERROR, "pgfincore_snapshot_database: Can not close file %s: %m",
+				 tmppath);
+	}
+	PG_CATCH();
+	{
+		unlink(tmppath);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	if (!complete)
+	{
+		unlink(tmppath);
+		elog(DEBUG1, "pgfincore_snapshot_database: %s not replaced, time is up",
+			 path);
+		return false;
+	}
+
+#if PG_VERSION_NUM >= 100000
+	(void) durable_rename(tmppath, path, ERROR);
+#else
+	if (rename(tmppath, path) != 0)
+		elog(ERROR, "pgfincore_snapshot_database: Can not rename %s to %s: %m",
+			 tmppath, path);
+#endif
+
+	elog(DEBUG1, "pgfincore_snapshot_database: %lld segments of %lld relations in %s",
+		 (long long int) counters->segments,
+		 (long long int) counters->relations, path);
+	return true;
+}
+
+/*
+ * pgfincore_snapshot_database
+ * write the page cache state of the current database into a file
+ */
+PG_FUNCTION_INFO_V1(pgfincore_snapshot_database);
+Datum
+pgfincore_snapshot_database(PG_FUNCTION_ARGS)
+{
+	pgfincore_db_counters	counters;
+
+	/*
+	 * Postgresql stuff to return a tuple
+	 */
+	HeapTuple	tuple;
+	TupleDesc	tupdesc;
+	Datum		values[PGF_SNAPSHOT_COLS];
+	bool		nulls[PGF_SNAPSHOT_COLS];
+
+	if (PG_ARGISNULL(0))
+		elog(ERROR, "pgfincore_snapshot_database: path argument shouldn't be NULL");
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "pgfincore_snapshot_database: return type must be a row type");
+
+	(void) pgfincore_snapshot_file(text_to_cstring(PG_GETARG_TEXT_PP(0)),
+								   &counters, 0);
+
+	/* initialize nulls array to build the tuple */
+	memset(nulls, 0, sizeof(nulls));
+
+	/* relations in the snapshot */
+	values[0] = Int64GetDatum(counters.relations);
+	/* segments in the snapshot */
+	values[1] = Int64GetDatum(counters.segments);
+	/* os pages of these segments */
+	values[2] = Int64GetDatum(counters.rel_os_pages);
+	/* os pages in cache */
+	values[3] = Int64GetDatum(counters.pages_mem);
+
+	/* Build and return the result tuple. */
+	tuple = heap_form_tuple(tupdesc, values, nulls);
+	PG_RETURN_DATUM( HeapTupleGetDatum(tuple) );
+}
+
+/*
+ * a record of the snapshot, where its bitmap is in the file and the pages in
+ * cache of its relation to restore the hottest relations first
+ */
+typedef struct
+{
+	pgfincore_snapshot_record	rec;
+	off_t		bitsOffset;
+	int64		relPagesMem;
+	int			index;
+} pgfincore_restore_entry;
+
+static int
+pgfincore_restore_entry_cmp(const void *a, const void *b)
+{
+	const pgfincore_restore_entry *ea = (const pgfincore_restore_entry *) a;
+	const pgfincore_restore_entry *eb = (const pgfincore_restore_entry *) b;
+
+	if (ea->relPagesMem != eb->relPagesMem)
+		return ea->relPagesMem > eb->relPagesMem ? -1 : 1;
+	/* the segments of a relation stay together and in order */
+	return ea->index - eb->index;
+}
+
+/*
+ * pgfincore_restore_file
+ * restore the page cache state from a file written by
+ * pgfincore_snapshot_file(), the relations with the most pages in cache
+ * first. The records are read first, then the bitmaps one by one.
+ */
+static void
+pgfincore_restore_file(const char *path, bool willneed, bool dontneed,
+					   pgfincore_throttle *throttle,
+					   pgfincore_db_counters *counters)
+{
+	FILE		*file;
+
+	pgfincore_snapshot_header	header;
+	pgfincore_restore_entry		*entries;
+	int			nentries = 0;
+	int			maxentries = 1024;
+	int			first = 0;
+	int			i;
+	bits8		*bits = NULL;
+	size_t		bitsSize = 0;
+	Oid			lastRelid = InvalidOid;
+
+	memset(counters, 0, sizeof(pgfincore_db_counters));
+
+	file = AllocateFile(path, PG_BINARY_R);
+	if (file == NULL)
+		elog(ERROR, "pgfincore_restore_database: Can not open file %s: %m",
+			 path);
+
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+		header.magic != PGF_SNAPSHOT_MAGIC ||
+		header.version != PGF_SNAPSHOT_VERSION)
+		elog(ERROR, "pgfincore_restore_database: %s is not a pgfincore snapshot",
+			 path);
+	if (header.dbOid != MyDatabaseId)
+		elog(ERROR, "pgfincore_restore_database: %s is a snapshot of database %u, not of the current database",
+			 path, header.dbOid);
+	if (header.pageSize != sysconf(_SC_PAGESIZE))
+		elog(ERROR, "pgfincore_restore_database: %s has been taken with an os page size of %u",
+			 path, header.pageSize);
+
+	/* the records, and the pages in cache of each relation */
+	entries = (pgfincore_restore_entry *)
+		palloc(maxentries * sizeof(pgfincore_restore_entry));
+	for (;;)
+	{
+		pgfincore_restore_entry	*entry;
+
+		if (nentries == maxentries)
+		{
+			maxentries *= 2;
+			entries = (pgfincore_restore_entry *)
+				repalloc_huge(entries, maxentries * sizeof(pgfincore_restore_entry));
+		}
+		entry = &entries[nentries];
+		if (fread(&entry->rec, sizeof(entry->rec), 1, file) != 1)
+			break;
+
+		if (entry->rec.forknum < 0 || entry->rec.forknum > MAX_FORKNUM ||
+			entry->rec.kind > PGF_SNAPSHOT_MAP)
+			elog(ERROR, "pgfincore_restore_database: %s is corrupted", path);
+
+		entry->bitsOffset = ftello(file);
+		if (entry->rec.kind == PGF_SNAPSHOT_MAP &&
+			fseeko(file, (entry->rec.nbits + BITS_PER_BYTE - 1) / BITS_PER_BYTE,
+				   SEEK_CUR) != 0)
+			elog(ERROR, "pgfincore_restore_database: Can not read file %s: %m",
+				 path);
+
+		/* the records of a relation are together in the file */
+		if (entry->rec.relid != entries[first].rec.relid)
+			first = nentries;
+		entry->index = nentries;
+		entry->relPagesMem = entry->rec.pages_mem;
+		if (first < nentries)
+			entry->relPagesMem += entries[nentries - 1].relPagesMem;
+		nentries++;
+	}
+	if (ferror(file))
+		elog(ERROR, "pgfincore_restore_database: Can not read file %s: %m",
+			 path);
+
+	/* the last record of each relation has the total, give it to the others */
+	for (i = nentries - 2; i >= 0; i--)
+		if (entries[i].rec.relid == entries[i + 1].rec.relid)
+			entries[i].relPagesMem = entries[i + 1].relPagesMem;
+	qsort(entries, nentries, sizeof(pgfincore_restore_entry),
+		  pgfincore_restore_entry_cmp);
+
+	for (i = 0; i < nentries && !pgfincore_got_sigterm; i++)
+	{
+		pgfincore_snapshot_record	*rec = &entries[i].rec;
+		HeapTuple		classTuple;
+		char			*relationpath = NULL;
+		Oid				relfilenode = InvalidOid;
+		size_t			nbytes = (rec->nbits + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+		char			filename[MAXPGPATH];
+		pgfloaderStruct	pgfloader;
+		pgfincore_runs	runs;
+
+		CHECK_FOR_INTERRUPTS();
+
+		/* the bitmap of the segment, read or built */
+		if (nbytes > bitsSize)
+		{
+			bits = bits ? repalloc(bits, nbytes) : palloc(nbytes);
+			bitsSize = nbytes;
+		}
+		if (rec->kind == PGF_SNAPSHOT_MAP)
+		{
+			if (fseeko(file, entries[i].bitsOffset, SEEK_SET) != 0 ||
+				fread(bits, nbytes, 1, file) != 1)
+				elog(ERROR, "pgfincore_restore_database: %s is truncated", path);
+		}
+		else if (nbytes > 0)
+			memset(bits, rec->kind == PGF_SNAPSHOT_ALL ? 0xff : 0, nbytes);
+
+		/* the relation must still be there, with the same file */
+		classTuple = SearchSysCache1(RELOID, ObjectIdGetDatum(rec->relid));
+		if (HeapTupleIsValid(classTuple))
+		{
+			relationpath = pgfincore_class_relpath(rec->relid,
+												   (Form_pg_class) GETSTRUCT(classTuple),
+												   (ForkNumber) rec->forknum,
+												   &relfilenode);
+			ReleaseSysCache(classTuple);
+		}
+#if PG_VERSION_NUM >= 90600
+		/* do not hold back the xmin horizon during a long restore */
+		InvalidateCatalogSnapshot();
+#endif
+		if (relationpath == NULL || relfilenode != rec->relfilenode)
+		{
+			elog(DEBUG1, "pgfincore_restore_database: relation %u has changed, skipped",
+				 rec->relid);
+			counters->segments_skipped++;
+			continue;
+		}
+
+		pgfincore_segment_path(filename, relationpath, rec->segno);
+		pfree(relationpath);
+		pgfincore_runs_bitmap(&runs, bits, rec->nbits);
+		if (pgfadvise_loader_file(filename, willneed, dontneed,
+								  &runs, throttle, &pgfloader) != 0)
+		{
+			counters->segments_skipped++;
+			continue;
+		}
+
+		counters->segments++;
+		if (rec->relid != lastRelid)
+			counters->relations++;
+		lastRelid = rec->relid;
+		counters->pages_loaded		+= pgfloader.pagesLoaded;
+		counters->pages_unloaded	+= pgfloader.pagesUnloaded;
+		counters->syscalls			+= pgfloader.syscalls;
+	}
+	FreeFile(file);
+	pfree(entries);
+	if (bits)
+		pfree(bits);
+
+	elog(DEBUG1, "pgfincore_restore_database: %lld segments of %lld relations restored from %s",
+		 (long long int) counters->segments,
+		 (long long int) counters->relations, path);
+}
+
+/*
+ * pgfincore_restore_database
+ * restore the page cache state from a file written by
+ * pgfincore_snapshot_database()
+ */
+PG_FUNCTION_INFO_V1(pgfincore_restore_database);
+Datum
+pgfincore_restore_database(PG_FUNCTION_ARGS)
+{
+	bool		willneed;
+	bool		dontneed;
+	pgfincore_db_counters	counters;
+
+	/*
+	 * Postgresql stuff to return a tuple
+	 */
+	HeapTuple	tuple;
+	TupleDesc	tupdesc;
+	Datum		values[PGF_RESTORE_COLS];
+	bool		nulls[PGF_RESTORE_COLS];
+
+	if (PG_ARGISNULL(0))
+		elog(ERROR, "pgfincore_restore_database: path argument shouldn't be NULL");
+	if (PG_ARGISNULL(1) || PG_ARGISNULL(2))
+		elog(ERROR, "pgfincore_restore_database: load and unload arguments shouldn't be NULL");
+	willneed	= PG_GETARG_BOOL(1);
+	dontneed	= PG_GETARG_BOOL(2);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "pgfincore_restore_database: return type must be a row type");
+
+	pgfincore_restore_file(text_to_cstring(PG_GETARG_TEXT_PP(0)),
+						   willneed, dontneed, NULL, &counters);
+
+	/* initialize nulls array to build the tuple */
+	memset(nulls, 0, sizeof(nulls));
+
+	/* relations restored */
+	values[0] = Int64GetDatum(counters.relations);
+	/* segments restored */
+	values[1] = Int64GetDatum(counters.segments);
+	/* segments whose relation has been dropped or rewritten */
+	values[2] = Int64GetDatum(counters.segments_skipped);
+	/* pages loaded */
+	values[3] = Int64GetDatum(counters.pages_loaded);
+	/* pages unloaded */
+	values[4] = Int64GetDatum(counters.pages_unloaded);
+	/* posix_fadvise calls */
+	values[5] = Int64GetDatum(counters.syscalls);
+
+	/* Build and return the result tuple. */
+	tuple = heap_form_tuple(tupdesc, values, nulls);
+	PG_RETURN_DATUM( HeapTupleGetDatum(tuple) );
+}
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * Background worker
+ *
+ * When pgfincore is in shared_preload_libraries, a worker is started for
+ * each database of pgfincore.databases. It restores the last snapshot of its
+ * database at startup, at pgfincore.restore_rate, then takes a snapshot every
+ * pgfincore.snapshot_interval and when the server stops. It also refills the
+ * pins of its database every pgfincore.pin_interval.
+ * The snapshot of a database is the file pgfincore.<database oid>.snap in the
+ * data directory.
+ */
+static void
+pgfincore_worker_sighup(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	pgfincore_got_sighup = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+static void
+pgfincore_worker_sigterm(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	pgfincore_got_sigterm = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+/*
+ * pgfincore_worker_register
+ * register one worker per database of pgfincore.databases
+ */
+static void
+pgfincore_worker_register(void)
+{
+	char		*rawstring;
+	List		*dbnames;
+	ListCell	*lc;
+
+	pgfincore_nworkers = 0;
+	rawstring = pstrdup(pgfincore_databases);
+	if (!SplitIdentifierString(rawstring, ',', &dbnames))
+		elog(ERROR, "pgfincore: invalid list syntax in parameter pgfincore.databases");
+
+	foreach(lc, dbnames)
+	{
+		char				*dbname = (char *) lfirst(lc);
+		BackgroundWorker	worker;
+
+		if (strlen(dbname) >= NAMEDATALEN)
+			elog(ERROR, "pgfincore: database name too long in parameter pgfincore.databases: %s",
+				 dbname);
+
+		memset(&worker, 0, sizeof(worker));
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+			BGWORKER_BACKEND_DATABASE_CONNECTION;
+		worker.bgw_start_time = BgWorkerStart_ConsistentState;
+		worker.bgw_restart_time = 60;
+		/* the slot of its restored flag in shared memory */
+		worker.bgw_main_arg = Int32GetDatum(pgfincore_nworkers++);
+		snprintf(worker.bgw_library_name, BGW_MAXLEN, "pgfincore");
+		snprintf(worker.bgw_function_name, BGW_MAXLEN, "pgfincore_worker_main");
+		snprintf(worker.bgw_name, BGW_MAXLEN, "pgfincore worker for database %s",
+				 dbname);
+		snprintf(worker.bgw_type, BGW_MAXLEN, "pgfincore worker");
+		strlcpy(worker.bgw_extra, dbname, BGW_EXTRALEN);
+
+		RegisterBackgroundWorker(&worker);
+	}
+	list_free(dbnames);
+	pfree(rawstring);
+}
+
+/* the time the snapshot taken when the server stops may last, in ms */
+#define PGF_SHUTDOWN_SNAPSHOT_TIMEOUT	5000
+
+/*
+ * pgfincore_worker_snapshot
+ * take the snapshot of the database of the worker, given up at the deadline
+ * (0 for none)
+ */
+static void
+pgfincore_worker_snapshot(const char *path, TimestampTz deadline)
+{
+	pgfincore_db_counters	counters;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	pgstat_report_activity(STATE_RUNNING, "pgfincore snapshot");
+
+	if (!pgfincore_snapshot_file(path, &counters, deadline))
+		elog(LOG, "pgfincore worker: snapshot not completed in %d ms, %s is kept",
+			 PGF_SHUTDOWN_SNAPSHOT_TIMEOUT, path);
+
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+/*
+ * Soft pinning
+ *
+ * The relations of the table pgfincore_pin are kept in the page cache by the
+ * worker of their database: every pgfincore.pin_interval it counts their
+ * pages in cache, and loads with POSIX_FADV_WILLNEED only the runs of pages
+ * which have been evicted. The counters of each pin are in shared memory,
+ * for pgfincore_pin_stats().
+ *
+ * Hard pinning
+ *
+ * The segments of the pins in mode hard are mapped read-only by the worker
+ * and locked in memory with mlock(), within pgfincore.pin_budget for all the
+ * workers and RLIMIT_MEMLOCK for each one. A segment is mapped again when
+ * its size changes, and released when its relation is rewritten (a new
+ * relfilenode is a new file) or unpinned. Each segment takes a slot in
+ * shared memory, by device and inode, before it is locked: the budget is
+ * checked against all the slots, and pgfincore() reports them.
+ * When the budget or the slots are exhausted the pin falls back to the soft
+ * mode. When the budget is lowered, the workers unlock segments until it is
+ * respected again.
+ */
+typedef struct
+{
+	Oid			dbOid;			/* InvalidOid for a free slot */
+	Oid			relid;
+	ForkNumber	forknum;
+	int64		checks;			/* residency checks */
+	int64		refills;		/* checks which found evicted pages */
+	int64		pages_refilled;	/* os pages loaded again */
+	int64		pages_locked;	/* os pages locked in memory */
+	TimestampTz	last_check;
+	TimestampTz	last_refill;
+} pgfincore_pin_counters;
+
+/* a segment locked in memory */
+typedef struct
+{
+	Oid			dbOid;			/* InvalidOid for a free slot */
+	dev_t		dev;
+	ino_t		ino;
+	size_t		len;			/* bytes locked */
+} pgfincore_hard_segment;
+
+/*
+ * the counters of the pins, then the slots of the segments locked, then
+ * one flag per worker set once it has restored its snapshot: a worker
+ * restarted does not restore it again during the life of the postmaster
+ */
+typedef struct
+{
+	LWLock		*lock;
+	int			npins;
+	int			nhardslots;
+	int			nworkers;
+	pg_atomic_uint32	nhard;	/* segments locked, read without the lock */
+	pgfincore_pin_counters	pins[FLEXIBLE_ARRAY_MEMBER];
+} pgfincore_pin_shared;
+
+#define PGF_HARD_SEGMENTS(shared) \
+	((pgfincore_hard_segment *) &(shared)->pins[(shared)->npins])
+#define PGF_RESTORED(shared) \
+	((bool *) &PGF_HARD_SEGMENTS(shared)[(shared)->nhardslots])
+
+static pgfincore_pin_shared *pgfincore_pins = NULL;
+
+/* the mappings of the segments locked by this worker */
+typedef struct
+{
+	dev_t		dev;
+	ino_t		ino;
+	void		*addr;
+	size_t		len;
+	int			slot;			/* its slot in shared memory */
+	bool		seen;			/* still pinned at the last check */
+} pgfincore_hard_map;
+
+static List *pgfincore_hard_maps = NIL;
+
+static Size
+pgfincore_pin_shmem_size(void)
+{
+	Size	size = offsetof(pgfincore_pin_shared, pins);
+
+	size = add_size(size, mul_size(pgfincore_max_pins,
+								   sizeof(pgfincore_pin_counters)));
+	size = add_size(size, mul_size(pgfincore_max_hard_segments,
+								   sizeof(pgfincore_hard_segment)));
+	return add_size(size, mul_size(pgfincore_nworkers, sizeof(bool)));
+}
+
+/*
+ * pgfincore_shmem_request
+ * the counters of the pins and their lock
+ */
+static void
+pgfincore_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(pgfincore_pin_shmem_size());
+	RequestNamedLWLockTranche("pgfincore", 1);
+}
+
+static void
+pgfincore_shmem_startup(void)
+{
+	bool	found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	pgfincore_pins = ShmemInitStruct("pgfincore",
+									 pgfincore_pin_shmem_size(), &found);
+	if (!found)
+	{
+		memset(pgfincore_pins, 0, pgfincore_pin_shmem_size());
+		pgfincore_pins->lock = &(GetNamedLWLockTranche("pgfincore"))->lock;
+		pgfincore_pins->npins = pgfincore_max_pins;
+		pgfincore_pins->nhardslots = pgfincore_max_hard_segments;
+		pgfincore_pins->nworkers = pgfincore_nworkers;
+		pg_atomic_init_u32(&pgfincore_pins->nhard, 0);
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * pgfincore_pin_slot
+ * the counters of a pin of the database, a free slot is taken for a new pin.
+ * NULL when all the slots are used. The lock is held exclusively.
+ */
+static pgfincore_pin_counters *
+pgfincore_pin_slot(Oid relid, ForkNumber forknum)
+{
+	pgfincore_pin_counters	*free = NULL;
+	int						i;
+
+	for (i = 0; i < pgfincore_pins->npins; i++)
+	{
+		pgfincore_pin_counters	*pin = &pgfincore_pins->pins[i];
+
+		if (pin->dbOid == MyDatabaseId && pin->relid == relid &&
+			pin->forknum == forknum)
+			return pin;
+		if (free == NULL && !OidIsValid(pin->dbOid))
+			free = pin;
+	}
+	if (free != NULL)
+	{
+		memset(free, 0, sizeof(pgfincore_pin_counters));
+		free->dbOid		= MyDatabaseId;
+		free->relid		= relid;
+		free->forknum	= forknum;
+	}
+	return free;
+}
+
+/*
+ * pgfincore_pin_refill
+ * load again the evicted pages of a fork, return the os pages loaded
+ */
+static int64
+pgfincore_pin_refill(const char *relationpath)
+{
+	int64			pagesLoaded = 0;
+	unsigned int	segno;
+
+	for (segno = 0;; segno++)
+	{
+		char				filename[MAXPGPATH];
+		pgfincoreStruct		pgfncr;
+		pgfloaderStruct		pgfloader;
+		pgfincore_runs		runs;
+		bits8				*evicted;
+		int64				i;
+
+		pgfincore_segment_path(filename, relationpath, segno);
+
+		/* the counters only, with cachestat when available */
+		if (pgfincore_file(filename, false, 0, 0, &pgfncr) != 0)
+			break;
+		if (pgfncr.pages_mem >= pgfncr.rel_os_pages)
+			continue;
+
+		/* the pages in cache, then the runs of pages out of it */
+		if (pgfincore_file(filename, true, 0, 0, &pgfncr) != 0)
+			break;
+		if (pgfncr.databit == NULL)
+			continue;
+
+		evicted = (bits8 *) palloc(VARBITBYTES(pgfncr.databit));
+		for (i = 0; i < VARBITBYTES(pgfncr.databit); i++)
+			evicted[i] = ~VARBITS(pgfncr.databit)[i];
+		pgfincore_runs_bitmap(&runs, evicted, VARBITLEN(pgfncr.databit));
+
+		if (pgfadvise_loader_file(filename, true, false, &runs, NULL,
+								  &pgfloader) == 0)
+			pagesLoaded += pgfloader.pagesLoaded;
+
+		pfree(evicted);
+		pfree(pgfncr.databit);
+	}
+
+	return pagesLoaded;
+}
+
+/*
+ * pgfincore_hard_available
+ * the bytes this worker may lock, RLIMIT_MEMLOCK. pgfincore.pin_budget is
+ * checked by pgfincore_hard_reserve() for all the workers.
+ */
+static size_t
+pgfincore_hard_available(void)
+{
+	static int64	warned = -1;
+	int64			budget = (int64) pgfincore_pin_budget * 1024 * 1024;
+	struct rlimit	rlim;
+
+	if (getrlimit(RLIMIT_MEMLOCK, &rlim) != 0 || rlim.rlim_cur == RLIM_INFINITY)
+		return SIZE_MAX;
+
+	if (budget > (int64) rlim.rlim_cur && warned != (int64) rlim.rlim_cur)
+	{
+		elog(WARNING, "pgfincore worker: pgfincore.pin_budget is above RLIMIT_MEMLOCK (%lld bytes)",
+			 (long long int) rlim.rlim_cur);
+		warned = (int64) rlim.rlim_cur;
+	}
+	return (size_t) rlim.rlim_cur;
+}
+
+/*
+ * pgfincore_hard_locked
+ * the bytes locked by all the workers. The lock is held.
+ */
+static int64
+pgfincore_hard_locked(void)
+{
+	pgfincore_hard_segment	*hard = PGF_HARD_SEGMENTS(pgfincore_pins);
+	int64	locked = 0;
+	int		i;
 
-	/*
-	 * If we are still looking the first segment
-	 * relationpath should not be suffixed
-	 */
-	if (fctx->segcount == 0)
-		snprintf(filename,
-		         MAXPGPATH,
-		         "%s",
-		         fctx->relationpath);
-	else
-		snprintf(filename,
-		         MAXPGPATH,
-		         "%s.%u",
-		         fctx->relationpath,
-		         fctx->segcount);
+	for (i = 0; i < pgfincore_pins->nhardslots; i++)
+	{
+		if (OidIsValid(hard[i].dbOid))
+			locked += hard[i].len;
+	}
+	return locked;
+}
 
-	elog(DEBUG1, "pgfincore: about to work with %s", filename);
+/*
+ * pgfincore_hard_reserve
+ * the slot of a segment about to be locked, -1 when pgfincore.pin_budget
+ * would be exceeded or no slot is free
+ */
+static int
+pgfincore_hard_reserve(dev_t dev, ino_t ino, size_t len)
+{
+	pgfincore_hard_segment	*hard = PGF_HARD_SEGMENTS(pgfincore_pins);
+	int64	budget = (int64) pgfincore_pin_budget * 1024 * 1024;
+	int		slot = -1;
+	int		i;
 
-	/*
-	 * Call pgfincore with the advice, returning the structure
-	 */
-	pgfncr = (pgfincoreStruct *) palloc(sizeof(pgfincoreStruct));
-	result = pgfincore_file(filename, pgfncr);
+	LWLockAcquire(pgfincore_pins->lock, LW_EXCLUSIVE);
+	if (pgfincore_hard_locked() + (int64) len <= budget)
+	{
+		for (i = 0; i < pgfincore_pins->nhardslots; i++)
+		{
+			if (!OidIsValid(hard[i].dbOid))
+			{
+				slot = i;
+				break;
+			}
+		}
+	}
+	if (slot >= 0)
+	{
+		hard[slot].dbOid	= MyDatabaseId;
+		hard[slot].dev		= dev;
+		hard[slot].ino		= ino;
+		hard[slot].len		= len;
+		pg_atomic_write_u32(&pgfincore_pins->nhard,
+							pg_atomic_read_u32(&pgfincore_pins->nhard) + 1);
+	}
+	LWLockRelease(pgfincore_pins->lock);
 
-	/*
-	* When we have work with all segment of the current relation, test success
-	* We exit from the SRF
-	*/
-	if (result)
+	return slot;
+}
+
+/*
+ * pgfincore_hard_unreserve
+ * free the slot of a segment not locked anymore
+ */
+static void
+pgfincore_hard_unreserve(int slot)
+{
+	pgfincore_hard_segment	*hard = PGF_HARD_SEGMENTS(pgfincore_pins);
+
+	LWLockAcquire(pgfincore_pins->lock, LW_EXCLUSIVE);
+	hard[slot].dbOid = InvalidOid;
+	pg_atomic_write_u32(&pgfincore_pins->nhard,
+						pg_atomic_read_u32(&pgfincore_pins->nhard) - 1);
+	LWLockRelease(pgfincore_pins->lock);
+}
+
+/*
+ * pgfincore_hard_unmap
+ * unlock a segment and forget it
+ */
+static void
+pgfincore_hard_unmap(pgfincore_hard_map *map, size_t *available)
+{
+	munmap(map->addr, map->len);
+	pgfincore_hard_unreserve(map->slot);
+	if (available != NULL)
+		*available += map->len;
+	pgfincore_hard_maps = list_delete_ptr(pgfincore_hard_maps, map);
+	pfree(map);
+}
+
+/*
+ * pgfincore_hard_forget
+ * free the slots of the database, of a previous worker or of this one
+ * exiting
+ */
+static void
+pgfincore_hard_forget(int code, Datum arg)
+{
+	pgfincore_hard_segment	*hard = PGF_HARD_SEGMENTS(pgfincore_pins);
+	uint32	nhard = 0;
+	int		i;
+
+	/* the lock may be held by the worker exiting on an error */
+	LWLockReleaseAll();
+	LWLockAcquire(pgfincore_pins->lock, LW_EXCLUSIVE);
+	for (i = 0; i < pgfincore_pins->nhardslots; i++)
 	{
-		elog(DEBUG1, "pgfincore: closing %s", fctx->relationpath);
-		relation_close(fctx->rel, AccessShareLock);
-		pfree(fctx);
-		SRF_RETURN_DONE(funcctx);
+		if (hard[i].dbOid == MyDatabaseId)
+			hard[i].dbOid = InvalidOid;
+		else if (OidIsValid(hard[i].dbOid))
+			nhard++;
 	}
-	else
+	pg_atomic_write_u32(&pgfincore_pins->nhard, nhard);
+	LWLockRelease(pgfincore_pins->lock);
+}
+
+/*
+ * pgfincore_hard_shrink
+ * unlock segments of this worker while all the workers lock more than
+ * pgfincore.pin_budget, after it has been lowered
+ */
+static void
+pgfincore_hard_shrink(void)
+{
+	int64	budget = (int64) pgfincore_pin_budget * 1024 * 1024;
+	int64	locked;
+
+	LWLockAcquire(pgfincore_pins->lock, LW_SHARED);
+	locked = pgfincore_hard_locked();
+	LWLockRelease(pgfincore_pins->lock);
+
+	while (locked > budget && pgfincore_hard_maps != NIL)
 	{
-		/*
-		* Postgresql stuff to return a tuple
-		*/
-		HeapTuple	tuple;
-		Datum		values[PGFINCORE_COLS];
-		bool		nulls[PGFINCORE_COLS];
+		pgfincore_hard_map	*map = (pgfincore_hard_map *) llast(pgfincore_hard_maps);
 
-		/* initialize nulls array to build the tuple */
-		memset(nulls, 0, sizeof(nulls));
+		locked -= map->len;
+		pgfincore_hard_unmap(map, NULL);
+	}
+}
 
-		/* Filename */
-		values[0] = CStringGetTextDatum(filename);
-		/* Segment Number */
-		values[1] = Int32GetDatum(fctx->segcount);
-		/* os page size */
-		values[2] = Int64GetDatum(pgfncr->pageSize);
-		/* number of pages used by segment */
-		values[3] = Int64GetDatum(pgfncr->rel_os_pages);
-		/* number of pages in OS cache */
-		values[4] = Int64GetDatum(pgfncr->pages_mem);
-		/* number of group of contigous page in os cache */
-		values[5] = Int64GetDatum(pgfncr->group_mem);
-		/* free page cache */
-		values[6] = Int64GetDatum(pgfncr->pagesFree);
-		/* the map of the file with bit set for in os cache page */
-		if (fctx->getvector && pgfncr->rel_os_pages)
+/*
+ * pgfincore_hard_unlock
+ * unlock the segments of a fork which can not be locked entirely, the pin
+ * falls back to the soft mode
+ */
+static void
+pgfincore_hard_unlock(List *maps, size_t *available, int64 *pagesLocked)
+{
+	ListCell	*lc;
+
+	foreach(lc, maps)
+		pgfincore_hard_unmap((pgfincore_hard_map *) lfirst(lc), available);
+	list_free(maps);
+	*pagesLocked = 0;
+}
+
+/*
+ * pgfincore_hard_lock
+ * map and lock the segments of a fork, within the bytes available.
+ * Return false when a segment can not be locked, the segments of the fork
+ * are then all unlocked.
+ */
+static bool
+pgfincore_hard_lock(const char *relationpath, size_t *available,
+					int64 *pagesLocked)
+{
+	size_t			pageSize = sysconf(_SC_PAGESIZE);
+	unsigned int	segno;
+	List			*maps = NIL;	/* the segments of the fork locked */
+	MemoryContext	oldcontext;
+
+	*pagesLocked = 0;
+
+	for (segno = 0;; segno++)
+	{
+		char				filename[MAXPGPATH];
+		struct stat			st;
+		size_t				len;
+		pgfincore_hard_map	*map = NULL;
+		ListCell			*lc;
+		int					fd;
+		int					slot;
+		void				*addr;
+
+		pgfincore_segment_path(filename, relationpath, segno);
+		if (stat(filename, &st) != 0)
+			break;
+		len = (st.st_size + pageSize - 1) / pageSize * pageSize;
+		if (len == 0)
+			continue;
+
+		foreach(lc, pgfincore_hard_maps)
 		{
-			values[7] = VarBitPGetDatum(pgfncr->databit);
+			pgfincore_hard_map	*m = (pgfincore_hard_map *) lfirst(lc);
+
+			if (m->dev == st.st_dev && m->ino == st.st_ino)
+			{
+				map = m;
+				break;
+			}
 		}
-		else
+
+		/* already locked, or extended or truncated since */
+		if (map != NULL && map->len == len)
 		{
-			nulls[7]  = true;
-			values[7] = (Datum) NULL;
+			map->seen = true;
+			maps = lappend(maps, map);
+			*pagesLocked += len / pageSize;
+			continue;
 		}
-		/* number of pages dirty in OS cache */
-		values[8] = Int64GetDatum(pgfncr->pages_dirty);
-		/* number of group of contigous dirty pages in os cache */
-		values[9] = Int64GetDatum(pgfncr->group_dirty);
-		/* Build the result tuple. */
-		tuple = heap_form_tuple(fctx->tupd, values, nulls);
+		if (map != NULL)
+			pgfincore_hard_unmap(map, available);
 
-        /* prepare the number of the next segment */
-        fctx->segcount++;
+		if (len > *available ||
+			(slot = pgfincore_hard_reserve(st.st_dev, st.st_ino, len)) < 0)
+		{
+			elog(DEBUG1, "pgfincore worker: pgfincore.pin_budget reached, %s is not locked",
+				 filename);
+			pgfincore_hard_unlock(maps, available, pagesLocked);
+			return false;
+		}
 
-		/* Ok, return results, and go for next call */
-		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+		fd = OpenTransientFile(filename, O_RDONLY | PG_BINARY);
+		if (fd < 0)
+		{
+			pgfincore_hard_unreserve(slot);
+			break;
+		}
+		addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+		CloseTransientFile(fd);
+		if (addr == MAP_FAILED)
+		{
+			elog(WARNING, "pgfincore worker: could not map %s: %m", filename);
+			pgfincore_hard_unreserve(slot);
+			pgfincore_hard_unlock(maps, available, pagesLocked);
+			return false;
+		}
+		if (mlock(addr, len) != 0)
+		{
+			elog(WARNING, "pgfincore worker: could not lock %s: %m", filename);
+			munmap(addr, len);
+			pgfincore_hard_unreserve(slot);
+			pgfincore_hard_unlock(maps, available, pagesLocked);
+			return false;
+		}
+
+		map = (pgfincore_hard_map *)
+			MemoryContextAlloc(TopMemoryContext, sizeof(pgfincore_hard_map));
+		map->dev	= st.st_dev;
+		map->ino	= st.st_ino;
+		map->addr	= addr;
+		map->len	= len;
+		map->slot	= slot;
+		map->seen	= true;
+		oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+		pgfincore_hard_maps = lappend(pgfincore_hard_maps, map);
+		MemoryContextSwitchTo(oldcontext);
+		maps = lappend(maps, map);
+		*available -= len;
+		*pagesLocked += len / pageSize;
 	}
+
+	list_free(maps);
+	return true;
 }
 
 /*
- * pgfincore_drawer A very naive renderer. (for testing)
+ * pgfincore_hard_release
+ * unlock the segments not pinned anymore
  */
-PG_FUNCTION_INFO_V1(pgfincore_drawer);
-Datum
-pgfincore_drawer(PG_FUNCTION_ARGS)
+static void
+pgfincore_hard_release(void)
 {
-        char *result,
-             *r;
-	int  len,i,k;
-	VarBit *databit;
-	bits8 *sp;
-	bits8 x;
+	List		*maps = list_copy(pgfincore_hard_maps);
+	ListCell	*lc;
 
-	if (PG_ARGISNULL(0))
-		elog(ERROR, "pgfincore_drawer: databit argument shouldn't be NULL");
+	foreach(lc, maps)
+	{
+		pgfincore_hard_map	*map = (pgfincore_hard_map *) lfirst(lc);
 
-        databit	= PG_GETARG_VARBIT_P(0);
+		if (!map->seen)
+			pgfincore_hard_unmap(map, NULL);
+	}
+	list_free(maps);
+}
+/*
+ * pgfincore_worker_pin
+ * check the pins of the database of the worker, refill the evicted pages
+ */
+static void
+pgfincore_worker_pin(void)
+{
+	Oid			pinRelid;
+	Relation	rel;
+	SysScanDesc	scan;
+	HeapTuple	tuple;
+	List		*seen = NIL;
+	size_t		available = 0;
+	ListCell	*lc;
+	int			i;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	pgstat_report_activity(STATE_RUNNING, "pgfincore pin");
+
+	/* pgfincore.pin_budget may have been lowered since the last check */
+	pgfincore_hard_shrink();
+
+	/* the segments locked and not seen during this check are released */
+	if (pgfincore_pin_budget > 0)
+		available = pgfincore_hard_available();
+	foreach(lc, pgfincore_hard_maps)
+	{
+		pgfincore_hard_map	*map = (pgfincore_hard_map *) lfirst(lc);
 
-	len =  VARBITLEN(databit);
-	result = (char *) palloc((len/FINCORE_BITS) + 1);
-	sp = VARBITS(databit);
-	r = result;
+		map->seen = false;
+		available -= Min(map->len, available);
+	}
 
-	for (i = 0; i <= len - BITS_PER_BYTE; i += BITS_PER_BYTE, sp++)
+	pinRelid = pgfincore_extension_table("pgfincore_pin");
+	if (!OidIsValid(pinRelid))
 	{
-		x = *sp;
-		/*  Is this bit set ? */
-		for (k = 0; k < (BITS_PER_BYTE/FINCORE_BITS); k++)
+		pgfincore_hard_release();
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+		return;
+	}
+
+	rel = table_open(pinRelid, AccessShareLock);
+	scan = systable_beginscan(rel, InvalidOid, false, NULL, 0, NULL);
+	while (HeapTupleIsValid(tuple = systable_getnext(scan)))
+	{
+		bool					isnull;
+		Datum					relid;
+		Datum					fork;
+		Datum					mode;
+		char					*relationpath;
+		ForkNumber				forknum;
+		int64					pagesLoaded = 0;
+		int64					pagesLocked = 0;
+		bool					locked = false;
+		pgfincore_pin_counters	*pin;
+
+		relid = heap_getattr(tuple, 1, RelationGetDescr(rel), &isnull);
+		if (isnull)
+			continue;
+		fork = heap_getattr(tuple, 2, RelationGetDescr(rel), &isnull);
+		if (isnull)
+			continue;
+		mode = heap_getattr(tuple, 3, RelationGetDescr(rel), &isnull);
+
+		CHECK_FOR_INTERRUPTS();
+
+		forknum = forkname_to_number(TextDatumGetCString(fork));
+		relationpath = pgfincore_nolock_relpath(DatumGetObjectId(relid),
+												DatumGetTextPP(fork));
+		if (relationpath == NULL)
+			continue;
+
+		/* locked in memory, or the evicted pages loaded again */
+		if (!isnull && pgfincore_pin_budget > 0 &&
+			strcmp(TextDatumGetCString(mode), "hard") == 0)
+			locked = pgfincore_hard_lock(relationpath, &available,
+										 &pagesLocked);
+		if (!locked)
 		{
-		  char out = ' ';
-			if (IS_HIGHBIT_SET(x))
-			  out = '.' ;
-			x <<= 1;
-			if (FINCORE_BITS > 1)
+			pagesLoaded = pgfincore_pin_refill(relationpath);
+			elog(DEBUG1, "pgfincore worker: %lld pages of %s refilled",
+				 (long long int) pagesLoaded, relationpath);
+		}
+		pfree(relationpath);
+
+		LWLockAcquire(pgfincore_pins->lock, LW_EXCLUSIVE);
+		pin = pgfincore_pin_slot(DatumGetObjectId(relid), forknum);
+		if (pin != NULL)
+		{
+			pin->checks++;
+			pin->pages_locked = pagesLocked;
+			pin->last_check = GetCurrentTimestamp();
+			if (pagesLoaded > 0)
 			{
-				if (IS_HIGHBIT_SET(x))
-					out = '*';
-				x <<= 1;
+				pin->refills++;
+				pin->pages_refilled += pagesLoaded;
+				pin->last_refill = pin->last_check;
 			}
-			*r++ = out;
+			seen = lappend(seen, pin);
 		}
+		LWLockRelease(pgfincore_pins->lock);
 	}
-	if (i < len)
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	pgfincore_hard_release();
+
+	/* the counters of the pins removed from the table are released */
+	LWLockAcquire(pgfincore_pins->lock, LW_EXCLUSIVE);
+	for (i = 0; i < pgfincore_pins->npins; i++)
 	{
-		/* print the last partial byte */
-		x = *sp;
-		for (k = i; k < (len/FINCORE_BITS); k++)
+		pgfincore_pin_counters	*pin = &pgfincore_pins->pins[i];
+
+		if (pin->dbOid == MyDatabaseId && !list_member_ptr(seen, pin))
+			pin->dbOid = InvalidOid;
+	}
+	LWLockRelease(pgfincore_pins->lock);
+
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+/*
+ * pgfincore_worker_timeout
+ * milliseconds until the next action of the worker, every interval seconds
+ */
+static long
+pgfincore_worker_timeout(TimestampTz last, int interval)
+{
+	long	secs;
+	int		usecs;
+
+	TimestampDifference(GetCurrentTimestamp(),
+						TimestampTzPlusMilliseconds(last, interval * 1000L),
+						&secs, &usecs);
+	return secs * 1000 + usecs / 1000;
+}
+
+/*
+ * pgfincore_worker_main
+ * entry point of the worker, the database name is in bgw_extra
+ */
+void
+pgfincore_worker_main(Datum main_arg)
+{
+	char		dbname[NAMEDATALEN];
+	char		path[MAXPGPATH];
+	int			slot = DatumGetInt32(main_arg);
+	bool		restored = true;
+	struct stat	st;
+	TimestampTz	last_snapshot;
+	TimestampTz	last_pin;
+
+	pqsignal(SIGHUP, pgfincore_worker_sighup);
+	pqsignal(SIGTERM, pgfincore_worker_sigterm);
+	BackgroundWorkerUnblockSignals();
+
+	strlcpy(dbname, MyBgworkerEntry->bgw_extra, NAMEDATALEN);
+	BackgroundWorkerInitializeConnection(dbname, NULL, 0);
+	snprintf(path, MAXPGPATH, "pgfincore.%u.snap", MyDatabaseId);
+
+	/* the segments locked by a previous worker are not locked anymore */
+	if (pgfincore_pins != NULL)
+	{
+		pgfincore_hard_forget(0, (Datum) 0);
+		before_shmem_exit(pgfincore_hard_forget, (Datum) 0);
+	}
+
+	/* a worker restarted does not restore the snapshot again */
+	if (pgfincore_pins != NULL && slot >= 0 &&
+		slot < pgfincore_pins->nworkers)
+	{
+		LWLockAcquire(pgfincore_pins->lock, LW_EXCLUSIVE);
+		restored = PGF_RESTORED(pgfincore_pins)[slot];
+		PGF_RESTORED(pgfincore_pins)[slot] = true;
+		LWLockRelease(pgfincore_pins->lock);
+	}
+
+	/* restore the last snapshot, hottest relations first */
+	if (!restored && stat(path, &st) == 0)
+	{
+		pgfincore_throttle		throttle;
+		pgfincore_db_counters	counters;
+
+		pgfincore_throttle_init(&throttle, pgfincore_restore_rate, 0);
+
+		SetCurrentStatementStartTimestamp();
+		StartTransactionCommand();
+		pgstat_report_activity(STATE_RUNNING, "pgfincore restore");
+
+		pgfincore_restore_file(path, true, false, &throttle, &counters);
+
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+
+		elog(LOG, "pgfincore worker: %lld pages of %lld relations of database %s restored",
+			 (long long int) counters.pages_loaded,
+			 (long long int) counters.relations, dbname);
+	}
+
+	last_snapshot = GetCurrentTimestamp();
+	last_pin = 0;
+	while (!pgfincore_got_sigterm)
+	{
+		long		timeout = -1;
+
+		if (pgfincore_got_sighup)
 		{
-		        char out = ' ';
-			if (IS_HIGHBIT_SET(x))
-			  out = '.' ;
-			x <<= 1;
-			if (FINCORE_BITS > 1)
+			pgfincore_got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		if (pgfincore_snapshot_interval > 0)
+		{
+			timeout = pgfincore_worker_timeout(last_snapshot,
+											   pgfincore_snapshot_interval);
+			if (timeout <= 0)
 			{
-				if (IS_HIGHBIT_SET(x))
-					out = '*';
-				x <<= 1;
+				pgfincore_worker_snapshot(path, 0);
+				last_snapshot = GetCurrentTimestamp();
+				continue;
 			}
-			*r++ = out;
 		}
+
+		if (pgfincore_pin_interval > 0)
+		{
+			long	pin_timeout;
+
+			pin_timeout = pgfincore_worker_timeout(last_pin,
+												   pgfincore_pin_interval);
+			if (pin_timeout <= 0)
+			{
+				pgfincore_worker_pin();
+				last_pin = GetCurrentTimestamp();
+				continue;
+			}
+			if (timeout < 0 || pin_timeout < timeout)
+				timeout = pin_timeout;
+		}
+
+		(void) WaitLatch(MyLatch,
+						 WL_LATCH_SET | WL_EXIT_ON_PM_DEATH |
+						 (timeout >= 0 ? WL_TIMEOUT : 0),
+						 timeout, PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
 	}
 
-	*r = '\0';
-	PG_RETURN_CSTRING(result);
+	/*
+	 * the last state before the server stops, within a time limit not to
+	 * delay the shutdown: the periodic snapshot is kept otherwise
+	 */
+	pgfincore_worker_snapshot(path,
+							  TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+														  PGF_SHUTDOWN_SNAPSHOT_TIMEOUT));
+
+	proc_exit(0);
+}
+#endif							/* PG_VERSION_NUM >= 120000 */
+
+/*
+ * pgfincore_pin_stats
+ * the counters of the pins of the current database
+ */
+PG_FUNCTION_INFO_V1(pgfincore_pin_stats);
+Datum
+pgfincore_pin_stats(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	Tuplestorestate	*tupstore;
+	TupleDesc		tupdesc;
+	Datum			values[PGFINCORE_PIN_STATS_COLS];
+	bool			nulls[PGFINCORE_PIN_STATS_COLS];
+	int				i;
+
+	if (pgfincore_pins == NULL)
+		elog(ERROR, "pgfincore_pin_stats: pgfincore must be in shared_preload_libraries");
+
+	tupstore = pgfincore_materialize(fcinfo, &tupdesc);
+
+	LWLockAcquire(pgfincore_pins->lock, LW_SHARED);
+	for (i = 0; i < pgfincore_pins->npins; i++)
+	{
+		pgfincore_pin_counters	*pin = &pgfincore_pins->pins[i];
+
+		if (pin->dbOid != MyDatabaseId)
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = ObjectIdGetDatum(pin->relid);
+		values[1] = CStringGetTextDatum(forkNames[pin->forknum]);
+		values[2] = Int64GetDatum(pin->checks);
+		values[3] = Int64GetDatum(pin->refills);
+		values[4] = Int64GetDatum(pin->pages_refilled);
+		values[5] = Int64GetDatum(pin->pages_locked);
+		values[6] = TimestampTzGetDatum(pin->last_check);
+		if (pin->refills > 0)
+			values[7] = TimestampTzGetDatum(pin->last_refill);
+		else
+			nulls[7] = true;
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+	LWLockRelease(pgfincore_pins->lock);
+
+	return (Datum) 0;
+#else
+	elog(ERROR, "pgfincore_pin_stats: PostgreSQL >= 12 is required");
+	PG_RETURN_VOID();
+#endif
+}
+
+/*
+ * pgfincore_hard_pinned
+ * is the file locked in memory by a worker ?
+ */
+static bool
+pgfincore_hard_pinned(dev_t dev, ino_t ino)
+{
+#if PG_VERSION_NUM >= 120000
+	pgfincore_hard_segment	*hard;
+	bool					pinned = false;
+	int						i;
+
+	/* no lock taken for each file when nothing is locked in memory */
+	if (pgfincore_pins == NULL || pgfincore_pin_budget == 0 ||
+		pg_atomic_read_u32(&pgfincore_pins->nhard) == 0)
+		return false;
+
+	hard = PGF_HARD_SEGMENTS(pgfincore_pins);
+	LWLockAcquire(pgfincore_pins->lock, LW_SHARED);
+	for (i = 0; i < pgfincore_pins->nhardslots && !pinned; i++)
+		pinned = OidIsValid(hard[i].dbOid) && hard[i].dev == dev &&
+			hard[i].ino == ino;
+	LWLockRelease(pgfincore_pins->lock);
+
+	return pinned;
+#else
+	return false;
+#endif
 }
@@ -0,0 +1,288 @@
+/*
+*  PgFincore
+*  pgfincore_pack.h
+*
+*  Pack the vector filled by mincore(2) into a bit string with the varbit
+*  layout (one bit per page, first page in the highest bit of the first byte)
+*  and count the pages in cache and the groups of contiguous pages in cache
+*  at the same time.
+*
+*  The vector is handled 64 pages at a time: the word of 64 bits is built
+*  with a movemask like instruction when the CPU provides one (SSE2, AVX2 on
+*  x86-64, NEON on aarch64), with a multiplication otherwise. The kernel is
+*  selected at runtime on the first call.
+*
+*  This file does not depend on PostgreSQL, it is also used by the micro
+*  benchmark in bench/.
+*/
+#ifndef PGFINCORE_PACK_H
+#define PGFINCORE_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(_M_AMD64)) && \
+	(defined(__GNUC__) || defined(__clang__))
+#define PGFINCORE_PACK_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define PGFINCORE_PACK_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PGFINCORE_PACK_UNUSED __attribute__((unused))
+#else
+#define PGFINCORE_PACK_UNUSED
+#endif
+
+/*
+ * counters kept across calls, so a file can be packed by windows
+ */
+typedef struct
+{
+	uint64_t	pages_mem;	/* pages in cache */
+	uint64_t	group_mem;	/* groups of contiguous pages in cache */
+	uint64_t	prev;		/* 1 if the last page packed is in cache */
+} pgfincore_pack_state;
+
+/*
+ * pack npages entries of vec into out (if not NULL) and update the counters.
+ * out must be byte aligned with the first page: only the last call for a
+ * file can have a npages which is not a multiple of 8.
+ */
+typedef void (*pgfincore_pack_fn) (const unsigned char *vec, size_t npages,
+								   uint8_t *out, pgfincore_pack_state *st);
+
+static inline int
+pgfincore_pack_popcount64(uint64_t w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(w);
+#else
+	w = w - ((w >> 1) & UINT64_C(0x5555555555555555));
+	w = (w & UINT64_C(0x3333333333333333)) +
+		((w >> 2) & UINT64_C(0x3333333333333333));
+	w = (w + (w >> 4)) & UINT64_C(0x0f0f0f0f0f0f0f0f);
+	return (int) ((w * UINT64_C(0x0101010101010101)) >> 56);
+#endif
+}
+
+/*
+ * account a word of 64 pages, first page in the highest bit, and store it
+ */
+static inline void
+pgfincore_pack_word(uint64_t w, uint8_t *out, pgfincore_pack_state *st)
+{
+	/* a group starts where a page in cache follows a page not in cache */
+	uint64_t	starts = w & ~((w >> 1) | (st->prev << 63));
+	int			i;
+
+	st->pages_mem += pgfincore_pack_popcount64(w);
+	st->group_mem += pgfincore_pack_popcount64(starts);
+	st->prev = w & 1;
+
+	if (out != NULL)
+		for (i = 0; i < 8; i++)
+			out[i] = (uint8_t) (w >> (56 - 8 * i));
+}
+
+/*
+ * 8 entries of the vector to one byte of the bit string: the bit 0 of
+ * each entry is moved to its position by a single multiplication.
+ */
+static inline uint8_t
+pgfincore_pack_byte(const unsigned char *vec)
+{
+	uint64_t	v;
+
+	memcpy(&v, vec, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	v &= UINT64_C(0x0101010101010101);
+	return (uint8_t) ((v * UINT64_C(0x8040201008040201)) >> 56);
+}
+
+/*
+ * the last pages of a file, less than 64 of them
+ */
+static inline void
+pgfincore_pack_tail(const unsigned char *vec, size_t npages,
+					uint8_t *out, pgfincore_pack_state *st)
+{
+	uint64_t	w = 0;
+	size_t		i;
+
+	if (npages == 0)
+		return;
+
+	for (i = 0; i < npages; i++)
+		w |= (uint64_t) (vec[i] & 1) << (63 - i);
+
+	/* as if the missing pages were not in cache */
+	st->pages_mem += pgfincore_pack_popcount64(w);
+	st->group_mem += pgfincore_pack_popcount64(w & ~((w >> 1) | (st->prev << 63)));
+	st->prev = (w >> (64 - npages)) & 1;
+
+	if (out != NULL)
+		for (i = 0; i < (npages + 7) / 8; i++)
+			out[i] = (uint8_t) (w >> (56 - 8 * i));
+}
+
+/*
+ * Portable kernel
+ */
+static PGFINCORE_PACK_UNUSED void
+pgfincore_pack_scalar(const unsigned char *vec, size_t npages,
+					  uint8_t *out, pgfincore_pack_state *st)
+{
+	size_t		i;
+	int			k;
+
+	for (i = 0; i + 64 <= npages; i += 64)
+	{
+		uint64_t	w = 0;
+
+		for (k = 0; k < 8; k++)
+			w = (w << 8) | pgfincore_pack_byte(vec + i + 8 * k);
+		pgfincore_pack_word(w, out ? out + i / 8 : NULL, st);
+	}
+	pgfincore_pack_tail(vec + i, npages - i, out ? out + i / 8 : NULL, st);
+}
+
+#if defined(PGFINCORE_PACK_X86)
+/*
+ * movemask gives the first page in the lowest bit, the bit string wants it
+ * in the highest bit.
+ */
+static inline uint64_t
+pgfincore_pack_reverse64(uint64_t w)
+{
+	w = ((w >> 1) & UINT64_C(0x5555555555555555)) |
+		((w & UINT64_C(0x5555555555555555)) << 1);
+	w = ((w >> 2) & UINT64_C(0x3333333333333333)) |
+		((w & UINT64_C(0x3333333333333333)) << 2);
+	w = ((w >> 4) & UINT64_C(0x0f0f0f0f0f0f0f0f)) |
+		((w & UINT64_C(0x0f0f0f0f0f0f0f0f)) << 4);
+	return __builtin_bswap64(w);
+}
+
+/*
+ * SSE2 kernel, always available on x86-64
+ * The shift by 7 moves bit 0 of each entry to bit 7, read by movemask.
+ */
+static void
+pgfincore_pack_sse2(const unsigned char *vec, size_t npages,
+					uint8_t *out, pgfincore_pack_state *st)
+{
+	size_t		i;
+	int			k;
+
+	for (i = 0; i + 64 <= npages; i += 64)
+	{
+		uint64_t	w = 0;
+
+		for (k = 0; k < 4; k++)
+		{
+			__m128i		v = _mm_loadu_si128((const __m128i *) (vec + i + 16 * k));
+
+			w |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_slli_epi64(v, 7)) << (16 * k);
+		}
+		pgfincore_pack_word(pgfincore_pack_reverse64(w),
+							out ? out + i / 8 : NULL, st);
+	}
+	pgfincore_pack_tail(vec + i, npages - i, out ? out + i / 8 : NULL, st);
+}
+
+/*
+ * AVX2 kernel, used when the CPU supports it
+ */
+__attribute__((target("avx2,popcnt")))
+static void
+pgfincore_pack_avx2(const unsigned char *vec, size_t npages,
+					uint8_t *out, pgfincore_pack_state *st)
+{
+	size_t		i;
+
+	for (i = 0; i + 64 <= npages; i += 64)
+	{
+		__m256i		lo = _mm256_loadu_si256((const __m256i *) (vec + i));
+		__m256i		hi = _mm256_loadu_si256((const __m256i *) (vec + i + 32));
+		uint64_t	w;
+
+		w = (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_slli_epi64(lo, 7)) |
+			(uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_slli_epi64(hi, 7)) << 32;
+		pgfincore_pack_word(pgfincore_pack_reverse64(w),
+							out ? out + i / 8 : NULL, st);
+	}
+	pgfincore_pack_tail(vec + i, npages - i, out ? out + i / 8 : NULL, st);
+}
+#endif							/* PGFINCORE_PACK_X86 */
+
+#if defined(PGFINCORE_PACK_NEON)
+/*
+ * NEON kernel, always available on aarch64
+ * There is no movemask: each entry is shifted to its position in its byte of
+ * the bit string, then the 8 entries of each byte are summed.
+ */
+static void
+pgfincore_pack_neon(const unsigned char *vec, size_t npages,
+					uint8_t *out, pgfincore_pack_state *st)
+{
+	static const int8_t shifts[8] = {7, 6, 5, 4, 3, 2, 1, 0};
+	const int8x8_t	sh = vld1_s8(shifts);
+	const uint8x8_t	one = vdup_n_u8(1);
+	size_t		i;
+	int			k;
+
+	for (i = 0; i + 64 <= npages; i += 64)
+	{
+		uint64_t	w = 0;
+
+		for (k = 0; k < 8; k++)
+		{
+			uint8x8_t	v = vand_u8(vld1_u8(vec + i + 8 * k), one);
+
+			w = (w << 8) | vaddv_u8(vshl_u8(v, sh));
+		}
+		pgfincore_pack_word(w, out ? out + i / 8 : NULL, st);
+	}
+	pgfincore_pack_tail(vec + i, npages - i, out ? out + i / 8 : NULL, st);
+}
+#endif							/* PGFINCORE_PACK_NEON */
+
+static void pgfincore_pack_choose(const unsigned char *vec, size_t npages,
+								  uint8_t *out, pgfincore_pack_state *st);
+
+static pgfincore_pack_fn pgfincore_pack = pgfincore_pack_choose;
+
+/*
+ * pgfincore_pack_select
+ * return the best kernel for the CPU we are running on
+ */
+static pgfincore_pack_fn
+pgfincore_pack_select(void)
+{
+#if defined(PGFINCORE_PACK_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+		return pgfincore_pack_avx2;
+	return pgfincore_pack_sse2;
+#elif defined(PGFINCORE_PACK_NEON)
+	return pgfincore_pack_neon;
+#else
+	return pgfincore_pack_scalar;
+#endif
+}
+
+static void
+pgfincore_pack_choose(const unsigned char *vec, size_t npages,
+					  uint8_t *out, pgfincore_pack_state *st)
+{
+	pgfincore_pack = pgfincore_pack_select();
+	pgfincore_pack(vec, npages, out, st);
+}
+
+#endif							/* PGFINCORE_PACK_H */
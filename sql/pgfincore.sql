@@ -27,12 +27,26 @@ select from pgfadvise_loader('test', 0, false, false, B'1010');
 select from pgfadvise_loader('test', 0, false, false, B'');
 -- ERROR on NULL databit input
 select from pgfadvise_loader('test', 0, false, false, NULL);
+-- contiguous pages are advised with a single call
+select pages_loaded, pages_unloaded, syscalls
+from pgfadvise_loader('test', 0, true, true, B'1110001');
+select pages_loaded, pages_unloaded, syscalls
+from pgfadvise_loader('test', 0, true, false, B'0000000011111111111');
 
 --
 -- test pgfincore
 --
 select from pgfincore('test', true);
 select from pgfincore('test');
+-- the varbit is built only when requested
+select databit is null as no_databit from pgfincore('test');
+select databit is not null as has_databit from pgfincore('test', true);
+-- counters from mincore unless cachestat is enabled
+select group_mem is not null as has_group_mem, pages_writeback is null as no_writeback
+from pgfincore('test');
+set pgfincore.cachestat to on;
+select pages_mem <= rel_os_pages as counted from pgfincore('test');
+reset pgfincore.cachestat;
 
 --
 -- test DONTNEED, WILLNEED
@@ -51,3 +65,253 @@ select from pgfadvise_normal('test');
 -- tests drawers
 --
 select NULL || pgfincore_drawer(databit) from pgfincore('test','main',true);
+
+--
+-- test database snapshot
+--
+select relations > 0 as has_relations, segments >= relations as has_segments
+from pgfincore_snapshot_database('pgfincore_regress.snap');
+select segments > 0 as has_segments, pages_unloaded
+from pgfincore_restore_database('pgfincore_regress.snap');
+select from pgfincore_restore_database('postmaster.pid');
+select from pgfincore_restore_database('pgfincore_regress.snap', NULL, false);
+
+--
+-- test pgfincore_map
+--
+select '0,3,3,1'::pgfincore_map;
+select B'1110001'::varbit::pgfincore_map, '0,3,3,1'::pgfincore_map::varbit;
+select '0'::pgfincore_map::varbit = B''::varbit as empty;
+select '1,0'::pgfincore_map;
+select '0,3000000000'::pgfincore_map;
+select pgfincore_drawer('2,3,1'::pgfincore_map);
+select pages_loaded, pages_unloaded, syscalls
+from pgfadvise_loader('test', 0, true, true, '0,3,3,1'::pgfincore_map);
+select databit::pgfincore_map::varbit = databit as roundtrip
+from pgfincore('test', true);
+
+--
+-- test prefetch engines
+--
+select engine, pages_completed is null as no_completion
+from pgfadvise_prefetch('test');
+set pgfincore.prefetch_engine to io_uring;
+select (engine = 'fadvise' and pages_completed is null)
+	or (engine = 'io_uring' and pages_completed = rel_os_pages) as completed
+from pgfadvise_prefetch('test');
+select from pgfadvise_willneed('test');
+-- io_uring counts the pages read, up to the end of the file
+select pages_loaded between 1 and 3 as loaded
+from pgfadvise_loader('test', 0, true, false, B'111');
+reset pgfincore.prefetch_engine;
+
+--
+-- test budget
+--
+select pages_loaded = rel_os_pages as loaded, pages_skipped
+from pgfadvise_willneed('test', 100, 0);
+select pages_loaded, pages_skipped = rel_os_pages as skipped
+from pgfadvise_willneed('test', 0, 1000000000);
+select pages_loaded, pages_skipped
+from pgfadvise_loader('test', 0, true, false, B'1110001', 100, 0);
+select pages_loaded, pages_skipped
+from pgfadvise_loader('test', 0, true, false, '0,3,3,1'::pgfincore_map, 0, 1000000000);
+select from pgfadvise_loader('test', 0, true, false, B'111', -1, 0);
+
+--
+-- test block ranges
+--
+select segment, rel_os_pages * os_page_size as bytes
+from pgfincore('test', 'main', 1, 1);
+select length(databit) * os_page_size as bytes
+from pgfincore('test', 'main', true, 0, 1);
+select rel_os_pages * os_page_size as bytes
+from pgfadvise('test', 'main', 10, 1, 100);
+select count(*) from pgfincore('test', 'main', 0, 0);
+select count(*) from pgfincore('test', 'main', 131072, 1);
+select from pgfincore('test', 'main', -1, 1);
+
+--
+-- test blocks
+--
+select count(*) = pg_relation_size('test') / current_setting('block_size')::int as all_blocks,
+	   bool_and(state in ('full', 'partial', 'absent')) as states,
+	   bool_and(os_pages_mem <= os_pages) as counts
+from pgfincore_blocks('test');
+select relblocknumber, segment from pgfincore_blocks('test', 'main', 1, 10);
+
+--
+-- test double buffering
+--
+select segment, shared_blocks, os_pages_evicted
+from pgfincore_double_buffered('test');
+select shared_blocks, os_pages_evicted <= os_pages_double as evicted
+from pgfincore_double_buffered('test', true);
+
+--
+-- test batch
+--
+-- duplicates are removed
+select relid, fork, segment from pgfincore(array['test', 'test']::regclass[], 'main', false, false);
+select relid, fork from pgfadvise(array['test']::regclass[], 'main', 10, true);
+-- no relation
+select count(*) from pgfincore(null::regclass[], 'main', false, false);
+select count(*) from pgfadvise(null::regclass[], 'main', 10, false);
+
+--
+-- test entire object
+--
+CREATE TABLE test_object (a int primary key, b text);
+INSERT INTO test_object SELECT i, 'x' FROM generate_series(1, 1000) i;
+VACUUM test_object;
+select fork from pgfincore_object('test_object')
+where relid = 'test_object'::regclass order by 1;
+-- the table, its index, its TOAST table and TOAST index
+select count(distinct relid) from pgfincore_object('test_object');
+select count(distinct relid) from pgfadvise_object('test_object', 10);
+DROP TABLE test_object;
+
+--
+-- test nolock
+--
+CREATE TABLE test_nolock AS SELECT generate_series(1, 1000) as a;
+select a.rel_os_pages = b.rel_os_pages
+from pgfincore_nolock('test_nolock') a, pgfincore('test_nolock') b;
+BEGIN;
+select segment from pgfincore_nolock('test_nolock', 'main', false);
+select relpath is not null from pgfadvise_nolock('test_nolock', 'main', 10);
+select count(*) from pg_locks where relation = 'test_nolock'::regclass;
+COMMIT;
+-- temporary relations are not found
+select count(*) from pgfincore_nolock('test');
+select fork, segment from pgfincore_database()
+where relid = 'test_nolock'::regclass;
+DROP TABLE test_nolock;
+
+--
+-- test estimate
+--
+-- all the windows are sampled: the estimate is exact
+select rel_os_pages = sampled_pages, pages_mem = sampled_pages_mem,
+       pages_mem_low = pages_mem_high
+from pgfincore_estimate('test', 'main', 1000, 1);
+select sampled_pages <= rel_os_pages,
+       pages_mem_low <= pages_mem and pages_mem <= pages_mem_high
+from pgfincore_estimate('test', 'main', 1, 1);
+-- ERROR
+select from pgfincore_estimate('test', 'main', 0, 1);
+
+--
+-- test advice
+--
+CREATE TABLE test_advice AS SELECT generate_series(1, 1000) as a;
+INSERT INTO pgfincore_advice VALUES ('test_advice', 'sequential');
+select count(*) from test_advice;
+UPDATE pgfincore_advice SET advice = 'random';
+select count(*) from test_advice;
+-- ERROR
+INSERT INTO pgfincore_advice VALUES ('test', 'backwards');
+DELETE FROM pgfincore_advice;
+select count(*) from test_advice;
+DROP TABLE test_advice;
+
+--
+-- test scan prefetch
+--
+CREATE TABLE test_scan_prefetch AS SELECT generate_series(1, 100000) as a;
+SET pgfincore.scan_prefetch_window = '1MB';
+SET pgfincore.scan_prefetch_min_size = 0;
+select count(*) from test_scan_prefetch;
+-- rescan in a nested loop
+select count(*) from (values (1), (2)) v(i)
+  cross join lateral (select count(*) from test_scan_prefetch where a > v.i) s;
+RESET pgfincore.scan_prefetch_window;
+RESET pgfincore.scan_prefetch_min_size;
+DROP TABLE test_scan_prefetch;
+
+--
+-- test pin
+--
+CREATE TABLE test_pin AS SELECT generate_series(1, 1000) as a;
+VACUUM test_pin;
+INSERT INTO pgfincore_pin VALUES ('test_pin'), ('test_pin', 'vm', 'hard');
+select relid, fork, mode from pgfincore_pin order by fork;
+-- ERROR
+INSERT INTO pgfincore_pin VALUES ('test_pin', 'all');
+INSERT INTO pgfincore_pin VALUES ('test_pin', 'fsm', 'locked');
+-- no worker, nothing is locked
+select bool_or(pinned) from pgfincore('test_pin');
+DELETE FROM pgfincore_pin;
+DROP TABLE test_pin;
+
+--
+-- test diff
+--
+-- the live state against itself
+select d.pages_to_load, d.pages_to_unload, d.load = d.unload
+from pgfincore('test', 'main', true) p,
+     pgfincore_diff('test', 'main', 0, p.databit) d;
+select d.pages_to_load, d.pages_to_unload
+from pgfincore('test', 'main', true) p,
+     pgfincore_diff('test', 'main', 0, p.databit::pgfincore_map) d;
+-- all the pages, and none
+select d.pages_to_load + p.pages_mem = p.rel_os_pages, d.pages_to_unload
+from pgfincore('test', 'main', true) p,
+     pgfincore_diff('test', 'main', 0, repeat('1', p.rel_os_pages::int)::varbit) d;
+select d.pages_to_load, d.pages_to_unload = p.pages_mem
+from pgfincore('test', 'main', true) p,
+     pgfincore_diff('test', 'main', 0, repeat('0', p.rel_os_pages::int)::varbit) d;
+-- the pages past the snapshot do not change
+select pages_to_load, pages_to_unload
+from pgfincore_diff('test', 'main', 0, B'');
+-- nothing to do
+select l.pages_loaded, l.pages_unloaded, l.syscalls
+from pgfincore('test', 'main', true) p,
+     pgfadvise_loader_delta('test', 'main', 0, true, true, p.databit) l;
+-- ERROR
+select from pgfincore_diff('test', 'main', 0, NULL::varbit);
+
+--
+-- test heat
+--
+select pgfincore_heat_databit(h, 1) as heat1,
+       pgfincore_heat_databit(h, 2) as heat2,
+       pgfincore_heat_databit(h, 3) as heat3,
+       pgfincore_heat_databit(h, 4) as heat4
+from (select pgfincore_heat_agg(d) as h
+      from (values (B'1100'), (B'1010'), (NULL), (B'1000')) t(d)) a;
+-- snapshots of different lengths
+select pgfincore_heat_databit(h, 1) as heat1,
+       pgfincore_heat_databit(h, 2) as heat2
+from (select pgfincore_heat_agg(d::pgfincore_map) as h
+      from (values (B'1'), (B'011'), (B'01')) t(d)) a;
+-- hottest first, no limit
+select l.pages_loaded, l.pages_unloaded, l.syscalls, l.pages_skipped
+from (select pgfincore_heat_agg(d) as h
+      from (values (B'101'), (B'100')) t(d)) a,
+     pgfadvise_loader_heat('test', 'main', 0, true, true, a.h, 0) l;
+-- within 1MB
+select l.pages_loaded * l.os_page_size = 1024 * 1024,
+       l.pages_loaded + l.pages_skipped
+from (select pgfincore_heat_agg(repeat('1', 100000)::varbit) as h) a,
+     pgfadvise_loader_heat('test', 'main', 0, true, false, a.h, 1) l;
+-- ERROR
+select from pgfadvise_loader_heat('test', 'main', 0, true, false, '\x00'::bytea, 0);
+select from pgfadvise_loader_heat('test', 'main', 0, true, false, NULL::bytea, 0);
+select pgfincore_heat_databit(pgfincore_heat_agg(B'1'), 0);
+
+--
+-- test ranges
+--
+select from pgfadvise_dontneed('test');
+select (select count(*) from pgfincore_ranges('test')) = sum(group_mem),
+       (select coalesce(sum(npages), 0) from pgfincore_ranges('test')) = sum(pages_mem)
+from pgfincore('test', true);
+-- merged, one call per run
+select pages_loaded, syscalls
+from pgfadvise_loader_ranges('test', 'main', '{10,0,1}', '{1,2,3}');
+select count(*)
+from pgfadvise_loader_ranges('test', 'main', '{}', '{}');
+-- ERROR
+select from pgfadvise_loader_ranges('test', 'main', '{0,1}', '{1}');
+select from pgfadvise_loader_ranges('test', 'main', '{-1}', '{1}');
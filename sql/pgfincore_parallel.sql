@@ -0,0 +1,6 @@
+--
+-- test PARALLEL SAFE, PostgreSQL >= 9.6
+--
+select proname, proparallel from pg_proc
+where proname in ('pgsysconf', 'pgfincore', 'pgfincore_blocks', 'pgfadvise')
+group by 1, 2 order by 1, 2;
@@ -0,0 +1,14 @@
+--
+-- test batch on partitions, PostgreSQL >= 10
+--
+CREATE TABLE test_batch (a int primary key, b text) PARTITION BY RANGE (a);
+CREATE TABLE test_batch_1 PARTITION OF test_batch FOR VALUES FROM (0) TO (100);
+CREATE TABLE test_batch_2 PARTITION OF test_batch FOR VALUES FROM (100) TO (200);
+INSERT INTO test_batch SELECT i, 'x' FROM generate_series(0, 199) i;
+-- the partitioned table has no storage
+select count(*) from pgfincore(array['test_batch']::regclass[], 'main', false, false);
+-- partitions, their indexes, TOAST tables and TOAST indexes
+select relid::text like 'pg_toast.%' as toast, count(distinct relid)
+from pgfincore(array['test_batch']::regclass[], 'main', false, true)
+group by 1 order by 1;
+DROP TABLE test_batch;
@@ -0,0 +1,14 @@
+--
+-- test the functions of the workers, PostgreSQL >= 12
+--
+CREATE TABLE test_parallel AS SELECT generate_series(1, 1000) as a;
+select p.segments, p.rel_os_pages = d.rel_os_pages
+from pgfincore_database_parallel(2) p join pgfincore_database() d using (relid, fork)
+where relid = 'test_parallel'::regclass;
+select segments from pgfincore_database_parallel(0)
+where relid = 'test_parallel'::regclass;
+-- ERROR
+select from pgfincore_database_parallel(-1);
+DROP TABLE test_parallel;
+-- ERROR, pgfincore is not in shared_preload_libraries
+select * from pgfincore_pin_stats();